@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+
+namespace lm {
+    /*
+        Branch free approximations of the angle functions used in the matching loops, in place of atan2/sin/cos and the fmod based wrap2pi()/angleDiff() in core.hpp.
+        The batch versions take arrays so that the compiler can vectorize them. The inputs and outputs of a batch call may be the same array.
+    */
+
+    // Maximum absolute errors, checked by angle_math_test. Both are well below the angle thresholds used for matching.
+    const float FAST_ATAN2_MAX_ERROR = 1e-5;
+    const float FAST_SINCOS_MAX_ERROR = 1e-5;   // For |angle| <= FAST_SINCOS_MAX_ANGLE
+    const float FAST_SINCOS_MAX_ANGLE = 100;
+
+    // Same as atan2(y, x), in [-pi, pi]. Returns 0 for (0, 0).
+    inline float fastAtan2(float y, float x) {
+        const float pi = M_PI;
+        float absX = std::abs(x);
+        float absY = std::abs(y);
+
+        // atan of the ratio in [0, 1] using a minimax polynomial, then reflected into the right octant
+        float maxXY = absX > absY ? absX : absY;
+        float minXY = absX > absY ? absY : absX;
+        float z = minXY / (maxXY > 0 ? maxXY : 1);
+        float z2 = z * z;
+        float angle = z * (0.99997726f + z2 * (-0.33262347f + z2 * (0.19354346f + z2 * (-0.11643287f + z2 * (0.05265332f + z2 * -0.01172120f)))));
+
+        angle = absY > absX ? pi/2 - angle : angle;
+        angle = x < 0 ? pi - angle : angle;
+        return y < 0 ? -angle : angle;
+    }
+
+    // Same as sin(angle) and cos(angle). Accuracy drops for angles beyond FAST_SINCOS_MAX_ANGLE as float range reduction loses precision.
+    inline void fastSinCos(float angle, float& sinOut, float& cosOut) {
+        const float halfPi = M_PI / 2;
+
+        // Reduce to r in [-pi/4, pi/4] and the quadrant of angle
+        float quadrant = std::floor(angle / halfPi + 0.5f);
+        float r = angle - quadrant * halfPi;
+        int q = static_cast<int>(quadrant) & 3;
+
+        float r2 = r * r;
+        float s = r * (1 + r2 * (-1.0f/6 + r2 * (1.0f/120 + r2 * (-1.0f/5040))));
+        float c = 1 + r2 * (-0.5f + r2 * (1.0f/24 + r2 * (-1.0f/720 + r2 * (1.0f/40320))));
+
+        // Rotate by the quadrant
+        float sinQ = q & 1 ? c : s;
+        float cosQ = q & 1 ? s : c;
+        sinOut = q & 2 ? -sinQ : sinQ;
+        cosOut = (q + 1) & 2 ? -cosQ : cosQ;
+    }
+
+    // Wraps angle into [-period/2, period/2), up to rounding
+    inline float fastWrap(float angle, float period = 2*M_PI) {
+        return angle - period * std::floor(angle / period + 0.5f);
+    }
+
+    // Same as angleDiff() in core.hpp except that a difference of exactly period/2 is returned as -period/2
+    inline float fastAngleDiff(float angle1, float angle2, float period = 2*M_PI) {
+        return fastWrap(angle1 - angle2, period);
+    }
+
+    void atan2Batch(const float* y, const float* x, float* angleOut, size_t n);
+
+    void sinCosBatch(const float* angle, float* sinOut, float* cosOut, size_t n);
+
+    // angleOut[i] = fastAngleDiff(angle1[i], angle2[i], period)
+    void angleDiffBatch(const float* angle1, const float* angle2, float* angleOut, size_t n, float period = 2*M_PI);
+}
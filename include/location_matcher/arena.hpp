@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+
+namespace lm {
+    /*
+        Monotonic arena for temporaries which only live for a single call, such as one LocationMatcher::findMatch(). Allocating is a pointer bump, deallocating does nothing, and reset() releases everything at once.
+
+        When the buffer is exhausted memory is taken from the global allocator. The next reset() grows the buffer to the high water mark, so repeated calls of a similar size stop calling the global allocator after the first one.
+
+        Anything allocated from resource() must be destroyed before reset() is called.
+    */
+    class Arena {
+        public:
+        explicit Arena(size_t initialSize = 1 << 20);
+        ~Arena();
+
+        Arena(const Arena&) = delete;
+        Arena& operator=(const Arena&) = delete;
+
+        std::pmr::memory_resource* resource();
+
+        // Releases every allocation made since the last reset
+        void reset();
+
+        // Size of the preallocated buffer
+        size_t capacity() const;
+
+        // Bytes taken from the global allocator since the last reset because the buffer was exhausted
+        size_t overflowBytes() const;
+
+        private:
+        // Forwards to the global allocator while counting what it hands out
+        class OverflowResource : public std::pmr::memory_resource {
+            public:
+            OverflowResource();
+            size_t bytes;
+
+            protected:
+            void* do_allocate(size_t bytes, size_t alignment) override;
+            void do_deallocate(void* p, size_t bytes, size_t alignment) override;
+            bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+        };
+
+        std::unique_ptr<std::byte[]> buffer_;
+        size_t capacity_;
+        OverflowResource overflow_;
+        std::unique_ptr<std::pmr::monotonic_buffer_resource> resource_;
+    };
+}; // namespace lm
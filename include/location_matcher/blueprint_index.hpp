@@ -0,0 +1,97 @@
+#pragma once
+
+#include <memory>
+#include <memory_resource>
+#include <vector>
+
+#include "location_matcher/core.hpp"
+#include "location_matcher/match_cache.hpp"
+#include "location_matcher/segment.hpp"
+#include "location_matcher/segment_trie.hpp"
+
+namespace lm {
+    // A map segment and a blueprint segment which may match, found by BlueprintIndex::findCandidates()
+    struct IndexCandidate {
+        int blueprint;          // Id the blueprint was added to the index with
+        int blueprintSegment;   // Index in the blueprint's Segments::data()
+        int mapSegment;         // Index in the map's Segments::data()
+        int firstRun;           // The runs between the two segments are runs[firstRun] to runs[firstRun + numRuns - 1] of BlueprintIndex::findRuns()
+        int numRuns;
+    };
+
+    /*
+        The segments of every blueprint in one structure, so that each map segment is compared with the whole library in a single pass instead of once per blueprint.
+
+        Every line length of every blueprint segment is stored in one array sorted by length and tagged with its segment. A map segment looks up the band of lengths like each of its lines by binary search, and only the blueprint segments with at least SEGMENT_MIN_MATCH_LENGTH like line pairs are checked with Segment::mayMatch(). Blueprint segments with no length near any line of the map segment are never touched.
+
+        The runs of the candidates are found with a SegmentTrie of every blueprint segment, so blueprints which share sequences of walls, such as variants of the same building, only have the walls in which they differ compared with each map segment.
+
+        Blueprints are appended with add() and the lengths are only sorted by finalize(), so loading a library of N blueprints sorts once rather than N times.
+
+        The index shares the Segment objects of the blueprints, so it must be rebuilt whenever their Segments change.
+    */
+    class BlueprintIndexTest;
+    class BlueprintIndex {
+        friend class BlueprintIndexTest;
+
+        public:
+        BlueprintIndex();
+
+        // Adds the segments of a blueprint under the id blueprint. Ids must be added in ascending order. thresholds must be the ones later passed to matchCandidates().
+        // Only appends: finalize() must be called before the next findCandidates().
+        void add(int blueprint, const Segments& segments, const MatchThresholds& thresholds = MatchThresholds());
+        void clear();
+
+        // Sorts the lengths added since the last call into the lengths already sorted. Does nothing if nothing was added.
+        void finalize();
+        bool isFinalized() const;
+
+        // Segment::fingerprint() of each map segment, computed once per map for findRuns()
+        void fingerprint(const Segments& mapSegments, std::pmr::vector<uint64_t>& fingerprintsOut) const;
+
+        // Appends every pair of a map segment and a blueprint segment for which Segment::mayMatch() holds, sorted by blueprint, then blueprint segment, then map segment. This is the order Segments::matchSegments() compares them in.
+        void findCandidates(const Segments& mapSegments, float lengthThreshold, std::pmr::vector<IndexCandidate>& candidatesOut) const;
+
+        // Appends to runsOut the runs of each candidate in [candidatesBegin, candidatesEnd) and sets their IndexCandidate::firstRun and numRuns. Runs are looked up in cache, and otherwise found by walking the trie once per map segment for all of its candidates and added to cache.
+        // trieScratch is the per-node state of the walks, kept by the caller between calls, e.g. in a MatchContext.
+        void findRuns(
+            const Segments& mapSegments,
+            const std::pmr::vector<uint64_t>& mapFingerprints,
+            IndexCandidate* candidatesBegin,
+            IndexCandidate* candidatesEnd,
+            float lengthThreshold,
+            MatchCache& cache,
+            TrieScratch& trieScratch,
+            std::pmr::vector<SegmentRun>& runsOut) const;
+
+        // Turns the runs of each candidate in [candidatesBegin, candidatesEnd) into matches the same way as Segments::matchSegments(), adding them to matches in order
+        LmStatus matchCandidates(
+            const Segments& mapSegments,
+            const IndexCandidate* candidatesBegin,
+            const IndexCandidate* candidatesEnd,
+            const std::pmr::vector<SegmentRun>& runs,
+            std::vector<SegmentMatch>& matches,
+            const MatchThresholds& thresholds) const;
+
+        // Number of blueprint segments
+        int size() const;
+
+        protected:
+        struct LengthEntry {
+            float length;
+            int segment;    // Index in segments_
+        };
+
+        std::vector<LengthEntry> lengths_;  // Every line length of every segment. The first numSortedLengths_ are in ascending order, the rest were added since the last finalize().
+        int numSortedLengths_;
+        std::vector<std::shared_ptr<Segment>> segments_;
+        std::vector<int> segmentBlueprints_;    // Blueprint id of each segment
+        std::vector<int> segmentIndexes_;       // Index of each segment in its blueprint's Segments::data()
+        std::vector<uint64_t> segmentFingerprints_;
+        float fingerprintQuantum_;  // Of the fingerprints
+        SegmentTrie trie_;      // Every segment, under its index in segments_
+
+        // Index in segments_ of the blueprint segment of candidate
+        int segmentIndex(const IndexCandidate& candidate) const;
+    };
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <vector>
+
+#include "opencv2/core.hpp"
+
+#include "location_matcher/core.hpp"
+
+namespace lm {
+    // Distance in pixels between the points sampled along each line of a ChamferModel
+    const float CHAMFER_SAMPLE_STEP = 2;
+    // Distance in pixels from the nearest occupied pixel at which a sample stops contributing to the score
+    const float CHAMFER_MAX_DISTANCE = 3;
+
+    /*
+        Points sampled along a set of lines, used to verify a pose against a distance map. Coordinates are stored as separate x and y arrays so that transforming a block of samples can be vectorized.
+    */
+    struct ChamferModel {
+        std::vector<float> x;
+        std::vector<float> y;
+
+        size_t size() const;
+    };
+
+    // Samples every line in lines at intervals of sampleStep, including both end points
+    LmStatus buildChamferModel(KeyLinesIn lines, float sampleStep, ChamferModel& modelOut);
+
+    // Input: occupancy map as a 2D matrix with values closer to 0 as occupied, and 255 as free
+    // Output: CV_32FC1 matrix of the distance in pixels from each pixel to the nearest occupied pixel
+    LmStatus computeDistanceMap(const cv::Mat& occupancyIn, cv::Mat& distanceMapOut);
+
+    // Same as above, thresholding occupancyIn into freeSpace, which keeps its allocation when it is passed again for a map of the same size
+    LmStatus computeDistanceMap(const cv::Mat& occupancyIn, cv::Mat& distanceMapOut, cv::Mat& freeSpace);
+
+    // Scores the model placed in the distance map by rotating it by angle about origin and moving origin to translation.
+    // The model, origin and translation may be in any unit, e.g. metres; pixelsPerUnit converts the placed model to distance map pixels. maxDistance is in distance map pixels.
+    // Each sample scores max(0, 1 - d/maxDistance) and the mean over all samples is returned, so 1.0 is a perfect fit. Samples outside the map score 0.
+    // Scoring stops as soon as the mean can no longer reach minScore, in which case a value below minScore is returned.
+    float chamferScore(
+        const ChamferModel& model,
+        const cv::Mat& distanceMap,
+        cv::Point2f origin,
+        cv::Point2f translation,
+        float angle,
+        float maxDistance = CHAMFER_MAX_DISTANCE,
+        float minScore = 0,
+        float pixelsPerUnit = 1);
+}; // namespace lm
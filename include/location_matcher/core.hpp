@@ -11,7 +11,8 @@ namespace lm {
         LM_STATUS_ERROR_GENERIC,
         LM_STATUS_ERROR_LINES_UNCONNECTED,
         LM_STATUS_ERROR_MATCH_FAILED,
-        LM_STATUS_SIZE_MISMATCH
+        LM_STATUS_SIZE_MISMATCH,
+        LM_STATUS_DEADLINE_EXCEEDED     // Work was stopped at a deadline. Results found before it are still returned.
     };
 
     enum LineJoint {
@@ -58,6 +59,55 @@ namespace lm {
         }
     }
 
+    /*
+        Line used by the matching core in place of KeyLine, which carries many fields matching never reads. At 24 bytes against KeyLine's 80, the lines of a whole map fit in cache.
+        KeyLines are converted once when they are added to a Segment. Follows the same angle convention as LineDetector.
+    */
+    struct Line {
+        Line() = default;
+        Line(const cv::line_descriptor::KeyLine& keyLine) :
+            pt((keyLine.getStartPoint() + keyLine.getEndPoint()) / 2),
+            halfVec((keyLine.getEndPoint() - keyLine.getStartPoint()) / 2),
+            angle(keyLine.angle),
+            lineLength(keyLine.lineLength) {
+
+        }
+
+        cv::Point2f getStartPoint() const {
+            return pt - halfVec;
+        }
+
+        cv::Point2f getEndPoint() const {
+            return pt + halfVec;
+        }
+
+        // Fields which Line does not keep are zeroed
+        cv::line_descriptor::KeyLine toKeyLine() const {
+            cv::line_descriptor::KeyLine keyLine;
+            cv::Point2f start = getStartPoint();
+            cv::Point2f end = getEndPoint();
+            keyLine.startPointX = keyLine.sPointInOctaveX = start.x;
+            keyLine.startPointY = keyLine.sPointInOctaveY = start.y;
+            keyLine.endPointX = keyLine.ePointInOctaveX = end.x;
+            keyLine.endPointY = keyLine.ePointInOctaveY = end.y;
+            keyLine.pt = pt;
+            keyLine.angle = angle;
+            keyLine.lineLength = lineLength;
+            keyLine.response = 0;
+            keyLine.size = 0;
+            keyLine.octave = 0;
+            keyLine.class_id = 0;
+            keyLine.numOfPixels = 0;
+            return keyLine;
+        }
+
+        cv::Point2f pt;         // Midpoint
+        cv::Point2f halfVec;    // From the midpoint to the end point
+        float angle;            // atan2(end - start)
+        float lineLength;
+    };
+    static_assert(sizeof(Line) == 24, "Line should stay compact");
+
     typedef std::vector<cv::line_descriptor::KeyLine> KeyLines;
 
     typedef const KeyLines& KeyLinesIn;
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <memory_resource>
+#include <vector>
+
+#include "opencv2/core.hpp"
+
+namespace lm {
+    /*
+        2D KD-tree over a set of points, for finding the points near a query point in O(log n) rather than checking every point.
+
+        The tree is stored implicitly in a single array of indexes: the root of the indexes in [begin, end) is the median at (begin + end) / 2, which splits them on x at even depths and on y at odd depths. Indexes returned by queries are the indexes of the points passed to build().
+    */
+    class KdTreeTest;
+    class KdTree {
+        friend class KdTreeTest;
+
+        public:
+        explicit KdTree(std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+
+        void build(const std::vector<cv::Point2f>& points);
+        void clear();
+
+        // Appends the index of every point within radius of pt, in no particular order
+        void radiusSearch(cv::Point2f pt, float radius, std::pmr::vector<int>& indexesOut) const;
+
+        // Index of the point nearest to pt, or -1 if the tree is empty
+        int nearest(cv::Point2f pt) const;
+
+        int size() const;
+
+        protected:
+        std::pmr::vector<cv::Point2f> points_;  // Points in the order passed to build()
+        std::pmr::vector<int> indexes_;         // Indexes of points_ in tree order
+
+        void buildRange(int begin, int end, int depth);
+        void radiusSearchRange(int begin, int end, int depth, cv::Point2f pt, float radiusSquared, std::pmr::vector<int>& indexesOut) const;
+        void nearestRange(int begin, int end, int depth, cv::Point2f pt, int& nearestOut, float& distSquaredOut) const;
+    };
+}
@@ -8,36 +8,106 @@
 #include <opencv2/features2d.hpp>
 
 // Stdlib dependencies
+#include <string>
+#include <vector>
 
 #include "location_matcher/core.hpp"
 
-// Using LSD lines seems to be more stable but parameters need to be tuned for it since it does not detecte some instances of lines (eg a single pixel wide horizontal line). If LSD lines is not used, EDLines is used instead. Currently has memory corruption issues for some reason.
-// Current implementation is designed for EDLines. The angle definition of KeyLine needs to be changed for it to work with LSD lines, since angle for LSD line is perpendicular to the line, and angle for EDLines is parallel to the line.
-#define USE_LSD_DETECTOR // Comment this out to use EDLines
-
 namespace lm {
     class LineDetectorTest;
 
+    enum LineDetectorType {
+        LINE_DETECTOR_LSD = 0,
+        LINE_DETECTOR_EDLINES,
+        LINE_DETECTOR_NUM_TYPES
+    };
+
+    /*
+        A line detection algorithm. Backends only need to return the lines they find; LineDetector normalizes them so that every backend follows the same KeyLine conventions.
+    */
+    class LineDetectorBackend {
+        public:
+        virtual ~LineDetectorBackend();
+
+        // Use a mask with the same shape as imgIn, with 1's for pixels to be kept, 0's for pixels to be removed.
+        virtual void detect(const cv::Mat& imgIn, KeyLinesOut lines, const cv::Mat& mask) = 0;
+
+        virtual std::string name() const = 0;
+
+        // A new instance with the same settings. OpenCV's detectors keep state between calls, so each thread needs its own instance.
+        virtual cv::Ptr<LineDetectorBackend> clone() const = 0;
+    };
+
+    // Using LSD lines seems to be more stable but parameters need to be tuned for it since it does not detecte some instances of lines (eg a single pixel wide horizontal line).
+    class LsdBackend : public LineDetectorBackend {
+        public:
+        LsdBackend();
+
+        void detect(const cv::Mat& imgIn, KeyLinesOut lines, const cv::Mat& mask) override;
+        std::string name() const override;
+        cv::Ptr<LineDetectorBackend> clone() const override;
+
+        private:
+        cv::Ptr<cv::line_descriptor::LSDDetector> lineDetector_;
+    };
+
+    // EDLines. Currently has memory corruption issues for some reason.
+    class EdLinesBackend : public LineDetectorBackend {
+        public:
+        EdLinesBackend();
+
+        void detect(const cv::Mat& imgIn, KeyLinesOut lines, const cv::Mat& mask) override;
+        std::string name() const override;
+        cv::Ptr<LineDetectorBackend> clone() const override;
+
+        private:
+        cv::line_descriptor::BinaryDescriptor::Params bdParams_;
+        cv::Ptr<cv::line_descriptor::BinaryDescriptor> lineDetector_;
+    };
+
+    // Result of LineDetector::benchmark() for a single backend
+    struct LineDetectorBenchmark {
+        std::string name;           // LineDetectorBackend::name()
+        size_t numLines;            // Total lines detected over every image
+        double seconds;             // Total time spent detecting
+        double linesPerSecond;
+        double agreement;           // [0, 1] fraction of the lines which the reference backend also found
+    };
+
     class LineDetector {
         friend class LineDetectorTest;
         public:
-        LineDetector();
+        LineDetector(LineDetectorType type = LINE_DETECTOR_LSD);
+
+        // Use a custom backend
+        LineDetector(cv::Ptr<LineDetectorBackend> backend);
+
+        // Copies get their own clone of the backend so that they can be used on different threads
+        LineDetector(const LineDetector& other);
+        LineDetector& operator=(const LineDetector& other);
+
         ~LineDetector();   
 
+        // Every returned KeyLine has angle = atan2(end - start), the direction from its start point to its end point, whichever backend found it.
         LmStatus detect(const cv::Mat& imgIn, KeyLinesOut lines);
 
         // Use a mask with the same shape as imgIn, with 1's for pixels to be kept, 0's for pixels to be removed.
         LmStatus detect(const cv::Mat& imgIn, KeyLinesOut lines, const cv::Mat& mask);
 
+        // Same as above with detectedLines as scratch for the lines as the backend returns them. Passing the same buffer to every call keeps its capacity, so repeated detection does not allocate it again.
+        LmStatus detect(const cv::Mat& imgIn, KeyLinesOut lines, const cv::Mat& mask, KeyLines& detectedLines);
+
         LmStatus mergeDuplicates(KeyLines lines);
 
-#ifdef USE_LSD_DETECTOR
-        cv::Ptr<cv::line_descriptor::LSDDetector> lineDetector_;
-#else
-        cv::line_descriptor::BinaryDescriptor::Params bdParams_;
-        cv::Ptr<cv::line_descriptor::BinaryDescriptor> lineDetector_;
-        static int numInstances;        
-#endif
+        std::string name() const;
+
+        static cv::Ptr<LineDetectorBackend> createBackend(LineDetectorType type);
+
+        // Runs every backend on every image in images and reports its speed and how well it agrees with the first backend (LSD), so the fastest suitable backend can be picked for a deployment.
+        // Two lines agree when both of their end points are within positionTolerance pixels of each other.
+        static LmStatus benchmark(const std::vector<cv::Mat>& images, std::vector<LineDetectorBenchmark>& resultsOut, float positionTolerance = 3);
+
+        cv::Ptr<LineDetectorBackend> backend_;
     };
 
-}; // namespace lm
\ No newline at end of file
+}; // namespace lm
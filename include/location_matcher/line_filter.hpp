@@ -3,6 +3,7 @@
 #include "opencv2/core.hpp"
 
 #include "location_matcher/core.hpp"
+#include "location_matcher/occupancy_bitmap.hpp"
 
 namespace lm {
     class LineFilterTest;
@@ -16,6 +17,9 @@ namespace lm {
 
         LmStatus filterByLine(const cv::Mat& imgIn, cv::Mat& imgOut, KeyLinesIn lines,  const int lineThickness);
 
+        // Same as above on a bitmap of the occupied cells of the image: only the occupied cells on lines within the length range are kept. The lines are filled straight into a bitmap, so no full size 8 bit mask is drawn.
+        LmStatus filterByLine(const OccupancyBitmap& occupiedIn, OccupancyBitmap& occupiedOut, KeyLinesIn lines, const int lineThickness);
+
         void setMinLineLength(double minLength);
         void setMaxLineLength(double maxLength);
 
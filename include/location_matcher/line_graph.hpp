@@ -0,0 +1,77 @@
+#pragma once
+
+#include <array>
+#include <memory_resource>
+#include <unordered_map>
+
+#include "opencv2/core.hpp"
+#include "opencv2/line_descriptor.hpp"
+
+#include "location_matcher/core.hpp"
+#include "location_matcher/segment.hpp"
+
+namespace lm {
+    /*
+        Lines joined at their end points into a graph, with a node at each joint and a line as each edge. Unlike Segments, which only holds chains without branches, any number of lines may meet at a node. Every line is stored once, so walls with T or X junctions are neither split into overlapping chains nor compared more than once.
+
+        Lines and nodes are allocated from the memory resource passed on construction. A graph backed by an Arena must not outlive the Arena's next reset().
+    */
+    class LineGraphTest;
+    class LineGraph {
+        friend class LineGraphTest;
+
+        public:
+        explicit LineGraph(std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+
+        // Ends of lines within thresholds.joinDistThreshold of an existing node are joined to it
+        LmStatus addLines(const KeyLines& lines, const MatchThresholds& thresholds = MatchThresholds());
+        LmStatus clear();
+
+        // Walks every path through the graph which matches a run of SEGMENT_MIN_MATCH_LENGTH or more consecutive lines of a segment in segments, using the same likeness as Segment::compareWith().
+        // Only the longest path of a run is returned, not the shorter paths inside it.
+        // Returns SegmentMatch with segment1 made of the lines along the path, and segment2 from segments, the same as Segments::matchSegments().
+        LmStatus matchSegments(const Segments& segments, std::vector<SegmentMatch>& matches, const MatchThresholds& thresholds = MatchThresholds()) const;
+
+        const std::pmr::vector<Line>& lines() const;
+        const std::pmr::vector<cv::Point2f>& nodes() const;
+
+        // Number of lines with an end at node
+        int degree(int node) const;
+
+        private:
+        std::pmr::memory_resource* resource_;
+
+        std::pmr::vector<Line> lines_;
+        std::pmr::vector<std::array<int, 2>> lineNodes_;    // Nodes at the start and end of each line
+        std::pmr::vector<cv::Point2f> nodes_;               // Position of each node
+
+        // Lines at each node, stored contiguously: the lines at node i are nodeLines_[nodeLinesBegin_[i]] up to nodeLines_[nodeLinesBegin_[i+1]]
+        std::pmr::vector<int> nodeLinesBegin_;
+        std::pmr::vector<int> nodeLines_;
+
+        // Nodes bucketed by the cell of side nodeCellSize_ they lie in, so a node is only compared with the nodes of the neighbouring cells
+        float nodeCellSize_;
+        std::pmr::unordered_multimap<int64_t, int> nodeCells_;
+
+        // Returns the node nearest pt within distThreshold, adding a new node if there is none
+        int findOrAddNode(cv::Point2f pt, float distThreshold);
+
+        // Key of the cell at column x and row y of nodeCells_
+        static int64_t cellKey(int x, int y);
+
+        // Node at the other end of line from node
+        int otherNode(int line, int node) const;
+
+        // Helper for matchSegments(). Extends path, which ends at node and matches lines of segment up to index, by every line at node which matches the next line of segment. Adds a SegmentMatch for each path which cannot be extended further and whose offsets are within thresholds.
+        // pathSegment holds the lines of path, so that a path is validated in place and only copied into a SegmentMatch once it is accepted.
+        void walkPath(
+            std::pmr::vector<int>& path,
+            Segment& pathSegment,
+            int node,
+            int index,
+            const std::pmr::vector<char>& isLike,
+            const Segment& segment,
+            const MatchThresholds& thresholds,
+            std::vector<SegmentMatch>& matches) const;
+    };
+};
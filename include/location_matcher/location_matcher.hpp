@@ -1,8 +1,20 @@
 #pragma once
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+#include "location_matcher/arena.hpp"
+#include "location_matcher/blueprint_index.hpp"
+#include "location_matcher/chamfer.hpp"
 #include "location_matcher/core.hpp"
 #include "location_matcher/line_detector.hpp"
 #include "location_matcher/line_filter.hpp"
+#include "location_matcher/line_graph.hpp"
+#include "location_matcher/match_cache.hpp"
+#include "location_matcher/occupancy_bitmap.hpp"
 #include "location_matcher/segment.hpp"
+#include "location_matcher/segment_grid.hpp"
 #include "location_matcher/utils.hpp"
 
 namespace lm {
@@ -11,14 +23,89 @@ namespace lm {
         std::string name;       // Identifier
         cv::Mat blueprintImg;   // Lines are extracted from this image to match against the map
         cv::Point2f centroid;   // Centroid of blueprintImg
-        float scale;            // metres per pixel (unimplemented currently)
+        float scale;            // metres per pixel. Must be greater than 0.
     };
 
     struct LocationMatch {
         std::string name;       // Identifier of blueprint it is matched against
         cv::Point2f position;   // pixel position of the blueprint's centroid in the search image
         double angle;           // Angle by which the blueprint is rotated to fit onto the found match
-        double certainty;       // [0, 1] confidence in match (unimplemented currently)
+        double certainty;       // [0, 1] fraction of the blueprint's walls which are found in the search image
+    };
+
+    // LocationMatch delivered to a MatchCallback, with the blueprint identified by LocationMatcher::blueprintId() so no name is copied per match
+    struct BlueprintMatch {
+        int blueprintId;        // Id of the blueprint it is matched against
+        cv::Point2f position;   // Same as LocationMatch
+        double angle;
+        double certainty;
+    };
+
+    // Called by findMatch() with each match as soon as it is verified. Returning false stops the search.
+    typedef std::function<bool(const BlueprintMatch&)> MatchCallback;
+
+    // Where a blueprint is expected to be in the search image, e.g. from odometry
+    struct PosePrior {
+        std::string name;       // Identifier of the blueprint
+        cv::Point2f position;   // Expected pixel position of the blueprint's centroid in the search image
+        float uncertainty;      // Radius in metres around position in which the centroid is searched for
+    };
+
+    // Size in metres of the cells of the grid used to find the map segments near a PosePrior
+    const float PRIOR_GRID_CELL_SIZE = 2;
+
+    // Running statistics of how a blueprint has matched, kept by LocationMatcher to schedule blueprints
+    struct BlueprintStats {
+        BlueprintStats();
+        uint64_t numQueries;    // Number of maps the blueprint was matched against
+        uint64_t numHits;       // Number of those maps in which it was found
+        uint64_t numTimed;      // Number of queries which contributed to averageSeconds
+        double averageSeconds;  // Exponential moving average of the time spent matching the blueprint against a map
+
+        // Hit rate with one hit and one miss added, so blueprints with few queries are neither written off nor trusted too early
+        double expectedHitRate() const;
+    };
+
+    // Weight of the latest time in BlueprintStats::averageSeconds
+    const double BLUEPRINT_COST_SMOOTHING = 0.1;
+
+    // Added to BlueprintStats::averageSeconds when ranking, so blueprints which have never been timed come first without dividing by 0
+    const double BLUEPRINT_MIN_SECONDS = 1e-4;
+
+    // How the lines of the search image are grouped before they are matched against the blueprints
+    enum MapRepresentation {
+        MAP_REPRESENTATION_SEGMENTS,    // Chains of lines without branches
+        MAP_REPRESENTATION_LINE_GRAPH   // LineGraph, which also matches walls through T and X junctions
+    };
+
+    // Data extracted from a Blueprint once when it is added, so findMatch() and filterMatches() do not have to redo it on every call
+    // Everything used for matching is in metres so that one compiled blueprint can be matched against maps of any resolution.
+    struct CompiledBlueprint {
+        int id;                 // LocationMatcher::blueprintId() of the blueprint
+        KeyLines lines;         // Lines detected in blueprintImg, in blueprint pixel coordinates
+        ChamferModel chamfer;   // Points sampled along lines in metres, used to verify matches
+        Segments segments;      // lines in metres joined into segments
+        std::vector<int> segmentOrder;  // Indexes of segments by descending length, the order they are matched in when there is a deadline
+        float radius;           // Largest distance in metres of a line end from the centroid
+    };
+
+    // Scratch state for findMatch(). Temporaries of a call are allocated from arena, which is reset at the start of the next call, and the buffers below keep their capacity between calls so steady-state matching does not use the global allocator.
+    // A context must only be used by one findMatch() call at a time.
+    struct MatchContext {
+        MatchContext(const LineDetector& lineDetector);
+
+        LineDetector lineDetector;                  // Own copy because detectors are not thread safe
+        Arena arena;
+        KeyLines lines;                             // Lines detected in the search image
+        KeyLines detectedLines;                     // Lines as the detector backend returns them, before they are normalized into lines
+        cv::Mat detectMask;                         // Mask of the whole search image passed to the detector
+        cv::Mat freeSpace;                          // Thresholded search image the distance transform is computed from
+        KeyLines metricLines;                       // lines in metres
+        KeyLines nearbyLines;                       // Lines of the segments near the pose prior being matched
+        std::vector<SegmentMatch> segmentMatches;   // Candidates for the blueprint currently being matched
+        cv::Mat distanceMap;                        // Distance transform of the search image
+        MatchCache matchCache;                      // Runs between map and blueprint segments from previous calls
+        TrieScratch trieScratch;                    // Per-node state of the BlueprintIndex trie walks
     };
 
     /*  Typical usage for LocationMatcher
@@ -36,6 +123,12 @@ namespace lm {
         // Create storage for matches and find matches in image
         vector<LocationMatch> matches;
         matcher.findMatch(map, matches);
+
+        // Or act on each match as it is found, e.g. stop at the first
+        int bp1Id = matcher.blueprintId(bp1.name);
+        matcher.findMatch(map, 0, [&](const BlueprintMatch& match) {
+            return match.blueprintId != bp1Id;
+        });
     */
 
     class LocationMatcherTest;
@@ -64,31 +157,176 @@ namespace lm {
                 to find matches
                 - The centroid of the matches are used to find the equivalent 
                 location in the new image.
+                - Every match is verified by scoring the blueprint lines 
+                against a distance transform of the image, which is computed 
+                once per call.
 
         */
 
         // Input: occupancy map as a 2D matrix with values closer to 0 as occupied, and 255 as free
-        LmStatus findMatch(const cv::Mat& imageIn, std::vector<LocationMatch>& matchesOut);
+        // mapScale is the resolution of imageIn in metres per pixel. Matching is done in metres, so blueprints of any scale can be matched without resampling either image. A mapScale <= 0 means imageIn has the same resolution as each blueprint it is compared with.
+        // Can be called from several threads at once on the same LocationMatcher, which share its blueprints. Each call takes a MatchContext from a pool.
+        // In MAP_REPRESENTATION_SEGMENTS, when every blueprint is compared at the same scale, the map segments are looked up in one BlueprintIndex of all blueprints rather than compared with each blueprint in turn.
+        // Work is ordered so that the best matches are likely to be found first: blueprints by expected matches per second, from the fraction of their length which may match imageIn and their BlueprintStats, then the longest segments of each blueprint. Blueprints with nothing which may match are skipped.
+        // Stops once setMaxMatches() matches have been found.
+        LmStatus findMatch(const cv::Mat& imageIn, float mapScale, std::vector<LocationMatch>& matchesOut) const;
+
+        // Same as above using scratch state owned by the caller, e.g. one context per worker thread
+        LmStatus findMatch(const cv::Mat& imageIn, float mapScale, std::vector<LocationMatch>& matchesOut, MatchContext& context) const;
+
+        // imageIn is assumed to have the same resolution as each blueprint
+        LmStatus findMatch(const cv::Mat& imageIn, std::vector<LocationMatch>& matchesOut) const;
+        LmStatus findMatch(const cv::Mat& imageIn, std::vector<LocationMatch>& matchesOut, MatchContext& context) const;
+
+        // Same as above, but stops once deadline has passed and returns LM_STATUS_DEADLINE_EXCEEDED with the matches verified until then in matchesOut.
+        // Stops with LM_STATUS_OK once setMaxMatches() matches have been found.
+        // Line detection and the distance transform of imageIn are always completed, so the deadline is overrun by up to their duration.
+        LmStatus findMatch(const cv::Mat& imageIn, float mapScale, std::chrono::steady_clock::time_point deadline, std::vector<LocationMatch>& matchesOut) const;
+        LmStatus findMatch(const cv::Mat& imageIn, float mapScale, std::chrono::steady_clock::time_point deadline, std::vector<LocationMatch>& matchesOut, MatchContext& context) const;
+
+        // Only searches for the blueprints of priors, each within its prior's uncertainty. Only the map segments whose bounding boxes intersect the blueprint's footprint, grown by the uncertainty, are matched, using a grid of the map segments built once per call, so the cost depends on the size of the uncertainty rather than of the map.
+        // Matches whose centroid is further than the uncertainty from the prior position are discarded. Priors for unknown blueprints are ignored.
+        LmStatus findMatch(const cv::Mat& imageIn, float mapScale, const std::vector<PosePrior>& priors, std::vector<LocationMatch>& matchesOut) const;
+        LmStatus findMatch(const cv::Mat& imageIn, float mapScale, const std::vector<PosePrior>& priors, std::vector<LocationMatch>& matchesOut, MatchContext& context) const;
+
+        // Same as the overloads above, but each match is passed to callback as soon as it is verified instead of being collected, and the search stops with LM_STATUS_OK as soon as callback returns false.
+        // Matches are passed in the same order as they are appended to matchesOut, and the overloads above are implemented with these.
+        LmStatus findMatch(const cv::Mat& imageIn, float mapScale, const MatchCallback& callback) const;
+        LmStatus findMatch(const cv::Mat& imageIn, float mapScale, const MatchCallback& callback, MatchContext& context) const;
+        LmStatus findMatch(const cv::Mat& imageIn, float mapScale, std::chrono::steady_clock::time_point deadline, const MatchCallback& callback) const;
+        LmStatus findMatch(const cv::Mat& imageIn, float mapScale, std::chrono::steady_clock::time_point deadline, const MatchCallback& callback, MatchContext& context) const;
+        LmStatus findMatch(const cv::Mat& imageIn, float mapScale, const std::vector<PosePrior>& priors, const MatchCallback& callback) const;
+        LmStatus findMatch(const cv::Mat& imageIn, float mapScale, const std::vector<PosePrior>& priors, const MatchCallback& callback, MatchContext& context) const;
+
+        // Creates scratch state for findMatch()
+        std::unique_ptr<MatchContext> createContext() const;
 
         // Input: mask of 255 in areas which have been explored and hence cannot contain a line, and 0 in unexplored areas or obstructed areas
-        LmStatus filterMatches(const cv::Mat& mask, std::vector<LocationMatch>& matchesInOut);
+        // Removes every match whose blueprint walls would lie in explored free space. The mask is packed into an OccupancyBitmap once per call, and each wall sample checks a box of it a word per row.
+        // mapScale is the resolution of mask in metres per pixel, with the same meaning as in findMatch().
+        LmStatus filterMatches(const cv::Mat& mask, float mapScale, std::vector<LocationMatch>& matchesInOut) const;
+        LmStatus filterMatches(const cv::Mat& mask, std::vector<LocationMatch>& matchesInOut) const;
+
+        // Same as above with the explored cells already packed, e.g. kept up to date by the caller between calls
+        LmStatus filterMatches(const OccupancyBitmap& explored, float mapScale, std::vector<LocationMatch>& matchesInOut) const;
         
         // Add blueprint to blueprints_
+        // Blueprints and settings must not be changed while findMatch() is running on another thread.
         LmStatus addBlueprint(const Blueprint& blueprint);
 
+        // Blueprint names are interned when they are first added, in the order they are added. The id of a name stays the same when its blueprint is replaced.
+        // Returns -1 for a name which has not been added.
+        int blueprintId(const std::string& name) const;
+
+        // Name of a valid id from blueprintId()
+        const std::string& blueprintName(int blueprintId) const;
+
+        // LocationMatch with the name of the blueprint of match
+        LocationMatch toLocationMatch(const BlueprintMatch& match) const;
+
+        // Matches with a certainty below minCertainty are not returned by findMatch(). Defaults to 0.
+        void setMinCertainty(double minCertainty);
+
+        // Distances in thresholds are in metres. The defaults are the pixel defaults of MatchThresholds at 5cm per pixel.
+        void setThresholds(const MatchThresholds& thresholds);
+
+        // findMatch() stops once it has found maxMatches matches, with or without a deadline. 0, the default, means no limit.
+        void setMaxMatches(int maxMatches);
+
+        // Statistics of every blueprint which has been matched, updated by every findMatch() call. A blueprint's statistics are reset when it is added again.
+        std::map<std::string, BlueprintStats> blueprintStats() const;
+        void resetStats();
+
+        // Defaults to MAP_REPRESENTATION_SEGMENTS
+        void setMapRepresentation(MapRepresentation mapRepresentation);
+
         // Draw matches on to img for debugging purposes
         void drawMatch(cv::Mat img, const LocationMatch& match)  const;
 
         std::map<std::string, Blueprint> blueprints_;
+        std::map<std::string, CompiledBlueprint> compiledBlueprints_;
 
         LineDetector lineDetector_;
         LineFilter lineFilter_;
 
         // Helper function for converting from SegmentMatch used by Segment to a LocationMatch
+        // The segments of match are in pixels and the search image has the same resolution as the blueprint.
         LocationMatch segmentMatchToLocationMatch(const Blueprint& blueprint, const SegmentMatch& match) const;
 
+        // The segments of match are in metres and the search image has a resolution of mapScale metres per pixel.
+        LocationMatch segmentMatchToLocationMatch(const Blueprint& blueprint, const SegmentMatch& match, float mapScale) const;
+
+        // Transforms a point in blueprint pixel coordinates to the search image using the pose of match. mapScale has the same meaning as in findMatch().
+        cv::Point2f blueprintToImage(const Blueprint& blueprint, const LocationMatch& match, cv::Point2f pt, float mapScale = 0) const;
+
         protected:
-        
-        
+        double minCertainty_;
+        int maxMatches_;
+        MatchThresholds thresholds_;
+        MapRepresentation mapRepresentation_;
+
+        // Outcome of matching one blueprint against one map
+        struct BlueprintSample {
+            const std::string* name;
+            bool isHit;
+            double seconds;     // < 0 if the blueprint was not fully matched, so its cost is unknown
+        };
+
+        // Statistics are updated by concurrent findMatch() calls, once per call
+        mutable std::mutex statsMutex_;
+        mutable std::map<std::string, BlueprintStats> stats_;
+
+        void recordStats(const std::pmr::vector<BlueprintSample>& samples) const;
+
+        // BlueprintStats::expectedHitRate() and averageSeconds of every blueprint, indexed by CompiledBlueprint::id. Only these are read under statsMutex_, so ranking does not copy stats_.
+        void readStats(std::pmr::vector<std::pair<double, double>>& statsOut) const;
+
+        // Segments of every compiled blueprint under its CompiledBlueprint::id, used by findMatch() when all blueprints are compared at the same scale.
+        // addBlueprint() only appends a new blueprint, and the index is finalized by the first findMatch() after it, so loading a library sorts the index once. It is only rebuilt when a blueprint is replaced or the thresholds change.
+        mutable std::mutex indexMutex_;
+        mutable BlueprintIndex blueprintIndex_;
+
+        void rebuildIndex();
+
+        // Finalizes blueprintIndex_ if blueprints were added since it was last finalized
+        void finalizeIndex() const;
+
+        // Names of the blueprints by blueprintId()
+        std::vector<std::string> blueprintNames_;
+
+        // Pool of contexts for findMatch() calls which do not bring their own
+        mutable std::mutex contextsMutex_;
+        mutable std::vector<std::unique_ptr<MatchContext>> contexts_;
+
+        std::unique_ptr<MatchContext> acquireContext() const;
+        void releaseContext(std::unique_ptr<MatchContext> context) const;
+
+        // Resets context for a findMatch() call on imageIn, and detects its lines and computes its distance map into the buffers of context
+        void prepareContext(const cv::Mat& imageIn, MatchContext& context) const;
+
+        // Lines of the image of a findMatch() call, shared by the blueprints it is compared with
+        struct ImageLines;
+
+        // Looks the image segments up in blueprintIndex_ if every blueprint is compared at the same scale
+        void prepareImageLines(float mapScale, ImageLines& image, MatchContext& context) const;
+
+        // Rebuilds the segments of image at imageScale metres per pixel if they are at another scale
+        void updateImageSegments(float imageScale, ImageLines& image, MatchContext& context) const;
+
+        // The step of every findMatch() for a single blueprint: finds its matches in image, verifies them and passes them to callback until it returns false, which sets isStopped, or numMatches reaches maxMatches_.
+        // Adds a BlueprintSample for the blueprint to samples. Returns LM_STATUS_DEADLINE_EXCEEDED if deadline passed before the blueprint was done.
+        LmStatus matchBlueprint(
+            const std::string& name,
+            float mapScale,
+            std::chrono::steady_clock::time_point deadline,
+            const MatchCallback& callback,
+            ImageLines& image,
+            MatchContext& context,
+            int& numMatches,
+            bool& isStopped,
+            std::pmr::vector<BlueprintSample>& samples) const;
+
+        // Converts a match between segments in units of unitsPerBlueprintPixel blueprint pixels to a pose in a search image with imagePixelsPerUnit
+        BlueprintMatch toBlueprintMatch(int blueprintId, const Blueprint& blueprint, const SegmentMatch& match, float unitsPerBlueprintPixel, float imagePixelsPerUnit) const;
     };
 };
\ No newline at end of file
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <memory_resource>
+#include <unordered_map>
+
+#include "location_matcher/segment.hpp"
+
+namespace lm {
+    // Fraction of MatchThresholds::lengthThreshold that line lengths are quantized to for Segment::fingerprint()
+    // Walls re-detected in consecutive maps differ in length by a pixel or two, so a quantum much finer than lengthThreshold would give a new fingerprint to nearly every segment and the cache would never hit.
+    const float MATCH_CACHE_LENGTH_QUANTUM = 1;
+
+    /*
+        Bounded least recently used cache of the SegmentRuns found between a map segment and a blueprint segment, used by Segments::matchSegments(). Between consecutive maps from the same robot most segments do not change, so only new or changed segments need to be compared again.
+
+        Segments are identified by Segment::fingerprint(). Runs are indexes along the two segments and only depend on their line lengths, so cached runs still hold after a segment has moved in the map. Offsets are always recomputed from the current segments.
+        Lengths are quantized to lengthThreshold, so a hit may return the runs of a segment whose lines differ by up to about half of lengthThreshold. A run whose lines are no longer alike gives offsets which fail the thresholds in Segment::matchRuns() rather than a wrong match.
+        A cache must only be used by one thread at a time.
+    */
+    class MatchCacheTest;
+    class MatchCache {
+        friend class MatchCacheTest;
+
+        public:
+        explicit MatchCache(size_t capacity = 1 << 14);
+
+        // Returns the runs stored for the pair of segments and marks them as recently used, or nullptr if there are none
+        const std::pmr::vector<SegmentRun>* find(uint64_t mapFingerprint, uint64_t blueprintFingerprint);
+
+        // Stores a copy of runs for the pair of segments, evicting the least recently used pair if the cache is full. Returns the stored runs.
+        const std::pmr::vector<SegmentRun>& insert(uint64_t mapFingerprint, uint64_t blueprintFingerprint, const std::pmr::vector<SegmentRun>& runs);
+
+        void clear();
+
+        // Number of pairs stored
+        size_t size() const;
+        size_t capacity() const;
+
+        // Number of calls to find() which did and did not find the pair since the cache was created
+        size_t numHits() const;
+        size_t numMisses() const;
+
+        private:
+        struct Key {
+            uint64_t mapFingerprint;
+            uint64_t blueprintFingerprint;
+            bool operator==(const Key& other) const;
+        };
+
+        struct KeyHash {
+            size_t operator()(const Key& key) const;
+        };
+
+        // Runs are stored with the default memory resource so they outlive the Arena the caller found them with
+        struct Entry {
+            Key key;
+            std::pmr::vector<SegmentRun> runs;
+        };
+
+        size_t capacity_;
+        size_t numHits_;
+        size_t numMisses_;
+
+        // Most recently used first
+        std::list<Entry> entries_;
+        std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> index_;
+    };
+};
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "opencv2/core.hpp"
+
+#include "location_matcher/core.hpp"
+
+namespace lm {
+    /*
+        Grid of cells which are either set or clear, e.g. occupied or explored, packed one bit per cell. Each row is padded to whole 64 bit words, so whole rows are combined and counted a word at a time, and a multi-megapixel map takes an eighth of the memory of an 8 bit cv::Mat.
+
+        Cell x of row y is bit x % 64 of word x / 64 of the row. The padding bits are always clear.
+    */
+    class OccupancyBitmapTest;
+    class OccupancyBitmap {
+        friend class OccupancyBitmapTest;
+
+        public:
+        OccupancyBitmap();
+        OccupancyBitmap(int rows, int cols);
+
+        // Resizes to rows by cols with every cell clear
+        void create(int rows, int cols);
+
+        // Sets the cells of a CV_8UC1 image whose value is greater than threshold, like cv::threshold() with THRESH_BINARY. With isInverted, the cells at or below threshold are set instead, e.g. the occupied cells of a map in which 0 is occupied.
+        LmStatus fromMat(const cv::Mat& img, int threshold, bool isInverted = false);
+
+        // Sets the cells of a row major grid of int8 values, such as a ROS OccupancyGrid, which are at least minValue. Unknown cells (-1) are not set for any minValue >= 0.
+        LmStatus fromGrid(const int8_t* grid, int rows, int cols, int8_t minValue);
+
+        // CV_8UC1 image of 255 for set cells and 0 for clear cells
+        void toMat(cv::Mat& imgOut) const;
+
+        int rows() const;
+        int cols() const;
+        bool empty() const;
+
+        bool get(int x, int y) const;
+        void set(int x, int y);
+
+        // Sets cells xStart to xEnd inclusive of row y. The range is clipped to the bitmap.
+        void setRange(int y, int xStart, int xEnd);
+
+        // Sets every cell whose centre lies within radius of the segment from pt1 to pt2, the shape cv::line() draws with a thickness of 2*radius
+        void fillLine(cv::Point2f pt1, cv::Point2f pt2, float radius);
+
+        // Combine with a bitmap of the same size a word at a time
+        LmStatus andWith(const OccupancyBitmap& other);
+        LmStatus orWith(const OccupancyBitmap& other);
+
+        // Number of set cells
+        int count() const;
+
+        // Whether every cell of box is set. Cells outside the bitmap count as clear.
+        bool isAllSet(const cv::Rect& box) const;
+
+        protected:
+        int rows_;
+        int cols_;
+        int wordsPerRow_;
+        std::vector<uint64_t> words_;
+
+        uint64_t* row(int y);
+        const uint64_t* row(int y) const;
+    };
+}
@@ -1,12 +1,17 @@
 #pragma once
 
+#include <chrono>
+#include <memory_resource>
 #include <numeric> // accumulate
 #include <time.h>   // For initializing random
 
 #include "opencv2/core.hpp"
 #include "opencv2/line_descriptor.hpp"
 
+#include "location_matcher/angle_math.hpp"
+#include "location_matcher/chamfer.hpp"
 #include "location_matcher/core.hpp"
+#include "location_matcher/trace.hpp"
 #include "location_matcher/utils.hpp"
 
 namespace lm{
@@ -22,60 +27,149 @@ namespace lm{
     const int SEGMENT_JOINT_2 = 1;
     const int SEGMENT_JOINT_JOINED = 0;
 
+    // compareWith() matches runs of at least SEGMENT_MIN_MATCH_LENGTH consecutive line pairs with a likeness of at least SEGMENT_LIKENESS_THRESHOLD
+    const int SEGMENT_MIN_MATCH_LENGTH = 2;
+    const float SEGMENT_LIKENESS_THRESHOLD = 0.4;
+
+    // Segment::findSymmetry() compares a segment with itself turned by half a turn using this fraction of the MatchThresholds. Matches of a symmetric segment are derived rather than validated, so a segment only counts as symmetric if the derived pose is as good as an estimated one.
+    const float SEGMENT_SYMMETRY_TOLERANCE = 0.1;
+
     class Segment;
     class Segments;
+    class LineGraph;
+    class MatchCache;
     struct SegmentMatch;
+
+    // Consecutive lines of two segments which are alike, found by Segment::findRuns(). Indexes are inclusive. The end index is before the start index when the run goes backwards along that segment.
+    struct SegmentRun {
+        int startIndex1;
+        int endIndex1;
+        int startIndex2;
+        int endIndex2;
+    };
+
+    // Sorts runs found between a segment and one of numCols lines into the order Segment::findRuns() returns them in
+    void sortRuns(std::pmr::vector<SegmentRun>::iterator runsBegin, std::pmr::vector<SegmentRun>::iterator runsEnd, int numCols);
+
+    // Thresholds for building segments and accepting a SegmentMatch. Passed by the caller rather than stored globally so that matches can be computed concurrently with different settings.
+    // Distances are in the same units as the lines they are applied to. The defaults are in pixels.
+    struct MatchThresholds {
+        MatchThresholds();
+
+        // StdDeviation thresholds for whether a line is considered to be a valid match. 
+        float angleThreshold;
+        float positionThreshold;
+
+        float lengthThreshold;          // Difference in length at which two lines have no likeness
+        float joinDistThreshold;        // Max distance between the ends of two lines for them to be joined into a segment
+        float directionDistThreshold;   // Max distance between line ends when finding which end of a line its neighbour is joined to
+    };
                         
+    // Likeness of two lines by length alone, which is 0 when the lengths differ by lengthThreshold or more. Shared by compareLines(), Segment::mayMatch() and BlueprintIndex so they all agree exactly.
+    inline float compareLengths(float length1, float length2, float lengthThreshold) {
+        return std::max(0.0f, 1 - std::abs(length1 - length2)/lengthThreshold);
+    }
+
     // Compares the likeness of two lines, with 1.0 being the same, 0 being completely different.
-    float compareLines(const cv::line_descriptor::KeyLine& line1, const cv::line_descriptor::KeyLine& line2, bool angleInvariont=false);
+    float compareLines(const Line& line1, const Line& line2, bool angleInvariont=false, float lengthThreshold=11);
 
     /*
-        Segment contains a single sequence of connected lines. Branch is not allowed in Segment. I.e. there is no implementation for a single corner with 3 lines connected to it.
+        Segment contains a single sequence of connected lines. Branch is not allowed in Segment. I.e. there is no implementation for a single corner with 3 lines connected to it. LineGraph handles branches.
+
+        Lines are allocated from the memory resource passed on construction, which copies and slices of the segment inherit. A segment backed by an Arena must not outlive the Arena's next reset().
     */
     class Segment {
         friend class Segments;
         friend class SegmentMatch;
+        friend class LineGraph;
         friend class SegmentTest;
         
         // Data is stored as a list for quick reversing and accessing from the front and back
-        typedef std::list<cv::line_descriptor::KeyLine> segment_t;
+        typedef std::pmr::list<Line> segment_t;
 
         public:
-        Segment();
+        explicit Segment(std::pmr::memory_resource* resource = std::pmr::get_default_resource());
 
         // Create a segment starting from a single line
-        Segment(const cv::line_descriptor::KeyLine& line);
+        Segment(const Line& line, std::pmr::memory_resource* resource = std::pmr::get_default_resource());
 
         // Create a segment from slicing an existing segment.
         Segment(const Segment& segment, int beginIndex, int endIndex);
 
+        // Same as above with the lines copied into resource instead of the memory resource of segment
+        Segment(const Segment& segment, int beginIndex, int endIndex, std::pmr::memory_resource* resource);
+
+        // Copies keep the memory resource of the original
+        Segment(const Segment& other);
+        Segment(Segment&& other) = default;
+        Segment& operator=(const Segment& other) = default;
+        Segment& operator=(Segment&& other) = default;
+
         const segment_t& data() const;
 
+        // Sum of the lengths of the lines
+        float length() const;
+
+        // Smallest upright rectangle containing every line
+        cv::Rect2f boundingBox() const;
+
         // The other.data_ is appended to this->data_ and other.data_ is omptied
-        LmStatus join(Segment& other);
+        LmStatus join(Segment& other, float connectionDistThresh = 5);
 
         // Check if the line is joined from the Front(F) or Back(B) of segment1 to the F or B of segment2.
-        SegmentJoint isJoinedTo(const Segment& other) const;
+        SegmentJoint isJoinedTo(const Segment& other, float connectionDistThresh = 5) const;
 
         // Returns the k nearest best matches
-        LmStatus compareWith(const Segment& other, std::vector<SegmentMatch>& matches) const;
+        // Same as findRuns() followed by matchRuns()
+        LmStatus compareWith(const Segment& other, std::vector<SegmentMatch>& matches, const MatchThresholds& thresholds = MatchThresholds()) const;
+
+        // Finds every run of SEGMENT_MIN_MATCH_LENGTH or more consecutive lines of this and other which are alike. Lines are compared by length only, so the runs do not depend on where the segments are.
+        LmStatus findRuns(const Segment& other, std::pmr::vector<SegmentRun>& runs, float lengthThreshold = 11) const;
+
+        // Adds a SegmentMatch for each run found between this and other whose offsets are within thresholds
+        // The lines of the matches are copied into the memory resource of this, like the temporaries of the call, so matching a map segment from an arena does not use the global allocator.
+        // If other is symmetric, a backward run whose lines of other are a forward run reversed gives the same match turned by half a turn, so it is derived from the forward run rather than estimated again.
+        LmStatus matchRuns(const Segment& other, const std::pmr::vector<SegmentRun>& runs, std::vector<SegmentMatch>& matches, const MatchThresholds& thresholds = MatchThresholds()) const;
+
+        // Hash of the line lengths quantized to lengthQuantum. Segments with the same fingerprint have lines within about lengthQuantum of each other, so they have nearly the same runs.
+        uint64_t fingerprint(float lengthQuantum) const;
+
+        // Returns false if compareWith() cannot find any match with other, using only the summaries of the two segments. This is conservative: true does not mean there is a match.
+        // Segments summarises every segment it builds. A segment which has not been summarised since it last changed may always match.
+        bool mayMatch(const Segment& other, float lengthThreshold = 11) const;
+        bool isSummarised() const;
+
+        // Records whether the segment maps on to itself reversed, within SEGMENT_SYMMETRY_TOLERANCE of the position, length and angle thresholds, when turned by half a turn about a centre, e.g. a straight wall or a Z shape. Such a segment matches in two poses half a turn apart and matchRuns() derives the second from the first without validating it.
+        // Mirror symmetries such as a U shape are not recorded: a mirror image is not a rotation, so the mirrored run never gives a second pose and is rejected by SegmentMatch::computeOffsets().
+        // A segment is not symmetric until this is called, nor after it is joined.
+        bool findSymmetry(const MatchThresholds& thresholds = MatchThresholds());
+        bool isSymmetric() const;
+        cv::Point2f symmetryCentre() const;
 
         // Draw the segment on to ImgIn for debug purposes. imgIn should be converted to BGR format.
         void draw(cv::InputOutputArray imgIn, cv::Scalar color, std::string label) const;
 
 
         protected:
-        // Helper function for compareWith()
-        // It traverses a diagonal from startIndex in the direction of incrementIndex and if it finds 2 or more adjacent values in likenessMatrix >= likenessRatio, it will add the SegmentMatch to matches
-        void findMatchesInDiag(
-            cv::Mat likenessMatrix, 
-            cv::Point2i startIndex, 
-            cv::Point2i incrementIndex, 
-            float likenessThreshold, 
-            const Segment& other, 
-            std::vector<SegmentMatch>& matches) const;
+        // Likeness of line i of this segment and line j of other at row i, col j. Only built for debug traces as findRuns() works on thresholded bits.
+        cv::Mat likenessMatrix(const Segment& other, float lengthThreshold) const;
+
+        // Updates the summary used by mayMatch() and findRuns() from data_
+        void summarise();
+
+        // Lengths of the lines in data_ in ascending order, and the index in data_ of each
+        void sortLengths(std::pmr::vector<float>& lengths, std::pmr::vector<int>& indexes) const;
 
         segment_t data_;
+
+        // Summary of data_: line lengths in ascending order, and the index in data_ of the line with each length
+        // isSummarised_ is cleared by everything which changes data_, so a summary is never used once its lines have changed, even if their number has not. Friends which edit data_ directly must clear it too.
+        std::pmr::vector<float> sortedLengths_;
+        std::pmr::vector<int> sortedIndexes_;
+        bool isSummarised_;
+
+        bool isSymmetric_;
+        cv::Point2f symmetryCentre_;    // Centre of the half turn which maps the segment on to itself reversed
     };
 
     /*
@@ -84,18 +178,40 @@ namespace lm{
     class Segments {
         friend class SegmentsTest;
 
-        typedef std::vector<std::shared_ptr<Segment>> data_t;
+        typedef std::pmr::vector<std::shared_ptr<Segment>> data_t;
 
         public:
+        // Every Segment, and the storage for its lines, is allocated from resource
+        explicit Segments(std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+
         LmStatus addSegment(const Segment& segment);
-        LmStatus addLines(const KeyLines& lines);
+        LmStatus addLines(const KeyLines& lines, const MatchThresholds& thresholds = MatchThresholds());
         LmStatus clear();
 
         // Return k nearest neighbour matches sorted by match strength.
         // Returns SegmentMatch with segment1 from this Segments, and segment2 from the other Segments
         LmStatus matchSegments(const Segment& segment, std::vector<SegmentMatch>& matches);
         
-        LmStatus matchSegments(const Segments& segments, std::vector<SegmentMatch>& matches);
+        LmStatus matchSegments(const Segments& segments, std::vector<SegmentMatch>& matches, const MatchThresholds& thresholds = MatchThresholds()) const;
+
+        // Same as above, but the runs between each pair of segments are looked up in cache first and added to it when missing, so only segments which changed since cache was last used are compared
+        LmStatus matchSegments(const Segments& segments, std::vector<SegmentMatch>& matches, const MatchThresholds& thresholds, MatchCache& cache) const;
+
+        // Same as above, but the segments of segments are matched in the order of their indexes in order, and matching stops once deadline has passed. The deadline is checked before each segment of segments.
+        // Returns LM_STATUS_DEADLINE_EXCEEDED if matching was stopped early, with the matches found until then in matches.
+        LmStatus matchSegments(const Segments& segments, const std::vector<int>& order, std::vector<SegmentMatch>& matches, const MatchThresholds& thresholds, MatchCache& cache, std::chrono::steady_clock::time_point deadline) const;
+
+        // Adds the segments of this at indexes to subsetOut. The Segment objects are shared rather than copied, so subsetOut must not outlive this.
+        void subset(const std::pmr::vector<int>& indexes, Segments& subsetOut) const;
+
+        // Indexes of data_ ordered by descending Segment::length(). Longer segments have more lines to match, so they are the most distinctive to try first.
+        std::vector<int> orderByLength() const;
+
+        // Total length of the segments of segments which may match a segment of this, using Segment::mayMatch(). An upper bound of how much of segments can be matched, and 0 if nothing can.
+        float matchableLength(const Segments& segments, float lengthThreshold = 11) const;
+
+        // Segment::findSymmetry() on every segment. Returns the number which are symmetric.
+        int findSymmetries(const MatchThresholds& thresholds = MatchThresholds());
 
         // imgIn is expected to be a BGR image
         // Draws every Segment as a different colour, with each line in the segment labelled with the index number. This function is used for debugging pursposes.
@@ -104,20 +220,19 @@ namespace lm{
         const data_t& data() const;
 
         private:
+        std::pmr::memory_resource* resource_;
+
         // Stores each segment as a shared_ptr because when joining segments some will be lost
         data_t data_;
 
         // Helper function to remove duplicates in data_
-        void pruneSegments(std::vector<bool> keepList);
+        void pruneSegments(const std::pmr::vector<bool>& keepList);
     };
 
     struct SegmentMatch {
-        // StdDeviation thresholds for whether a line is considered to be a valid match. 
-        static float angleThreshold;
-        static float positionThreshold;
-        
         SegmentMatch();
-        SegmentMatch(Segment seg1, int startIndex1, int endIndex1, Segment seg2, int startIndex2, int endIndex2);
+        // The lines of both segments are copied into resource, or into the memory resources of seg1 and seg2 if it is null
+        SegmentMatch(const Segment& seg1, int startIndex1, int endIndex1, const Segment& seg2, int startIndex2, int endIndex2, std::pmr::memory_resource* resource = nullptr);
 
         Segment segment1;
         Segment segment2;
@@ -130,7 +245,17 @@ namespace lm{
 
         // Returns LM_STATUS_OK if the angleOffset and the positionOffset are within their thresholds. Returns LM_STATUS_ERROR_MATCH_FAILED if they are outside their thresholds.
         // Sets positionOffset and angleOffset
-        LmStatus computeOffsets();
-        LmStatus computeConfidence();   // Unimplemented
+        LmStatus computeOffsets(const MatchThresholds& thresholds = MatchThresholds());
+
+        // Same as computeOffsets() on the match of run between segment1 and segment2, without building it. Works on the lines of the two segments in place and stops at the first check which fails, so a rejected run costs no copies. The offsets are only set when LM_STATUS_OK is returned.
+        static LmStatus computeOffsets(const Segment& segment1, const Segment& segment2, const SegmentRun& run, const MatchThresholds& thresholds, float& angleOffsetOut, cv::Point2f& positionOffsetOut);
+
+        // Sets confidence by scoring blueprintModel, placed with the pose from computeOffsets(), against distanceMap. segment2 is expected to come from the blueprint the model was built from, and segment1 from the map distanceMap was computed from.
+        // Returns LM_STATUS_ERROR_MATCH_FAILED if confidence is below minConfidence. Scoring stops early in that case so confidence is only a lower bound.
+        // pixelsPerUnit converts the units of the segments and the model to distanceMap pixels.
+        LmStatus computeConfidence(const cv::Mat& distanceMap, const ChamferModel& blueprintModel, float minConfidence=0, float pixelsPerUnit=1);
+
+        // Sets the offsets from those of match, which has the same segment1 and whose segment2 is this segment2 turned by half a turn about symmetryCentre, in place of computeOffsets()
+        void setSymmetricOffsets(const SegmentMatch& match, cv::Point2f symmetryCentre);
     };
 };
\ No newline at end of file
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <memory_resource>
+
+#include "opencv2/core.hpp"
+
+#include "location_matcher/core.hpp"
+#include "location_matcher/segment.hpp"
+
+namespace lm {
+    /*
+        Uniform grid over the bounding boxes of the segments of a Segments, to find the segments in a region without checking every segment. Each segment is listed in every cell its bounding box overlaps, so the cost of a query depends on the size of the region rather than the number of segments.
+
+        The grid is allocated from the memory resource passed on construction and refers to the segments by their index in Segments::data(), so it must be rebuilt when the Segments change.
+    */
+    class SegmentGridTest;
+    class SegmentGrid {
+        friend class SegmentGridTest;
+
+        public:
+        explicit SegmentGrid(std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+
+        // cellSize is in the units of the segments and must be greater than 0
+        LmStatus build(const Segments& segments, float cellSize);
+        LmStatus clear();
+
+        // Appends to indexesOut, in ascending order, the index of every segment whose bounding box intersects box
+        void query(const cv::Rect2f& box, std::pmr::vector<int>& indexesOut) const;
+
+        int numCells() const;
+
+        protected:
+        float cellSize_;
+        cv::Point2f origin_;    // Top left corner of cell 0
+        int cols_;
+        int rows_;
+
+        std::pmr::vector<cv::Rect2f> boxes_;    // Bounding box of each segment
+        std::pmr::vector<int> cellBegin_;       // The segments of cell i are cellSegments_[cellBegin_[i]] to cellSegments_[cellBegin_[i + 1] - 1]
+        std::pmr::vector<int> cellSegments_;
+
+        // Range of cells overlapped by box, clamped to the grid. Empty if lastCol < firstCol or lastRow < firstRow.
+        void cellRange(const cv::Rect2f& box, int& firstCol, int& firstRow, int& lastCol, int& lastRow) const;
+    };
+}
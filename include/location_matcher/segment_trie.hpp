@@ -0,0 +1,66 @@
+#pragma once
+
+#include <memory_resource>
+#include <vector>
+
+#include "location_matcher/core.hpp"
+#include "location_matcher/segment.hpp"
+
+namespace lm {
+    // Fraction of MatchThresholds::lengthThreshold that line lengths are quantized to in the trie. Fine enough that the runs found match Segment::findRuns() except for lengths right at a likeness threshold.
+    const float SEGMENT_TRIE_LENGTH_QUANTUM = 1.0 / 64;
+
+    // Per-node state of SegmentTrie::findRuns(), kept between calls so that a call only touches the nodes it visits rather than every node of the trie.
+    // Every entry is clear between calls. A scratch must only be used by one call at a time, but may be used with any trie.
+    struct TrieScratch {
+        std::vector<char> isWanted;     // Whether each node is on the path to a wanted id
+        std::vector<int> firstId;       // First wanted id ending at each node, or -1
+    };
+
+    /*
+        Segments stored as a trie of their line lengths, rounded to a length quantum, so segments which start with the same sequence of walls share the nodes of that prefix. Each segment is stored in the direction with the smaller sequence of lengths, so the direction it was joined in does not matter. Blueprints which are variants of the same building share long sequences of walls.
+
+        findRuns() walks the trie once per map segment. The likeness of the map lines to a node, and the runs which end within the prefix above it, are worked out once per node and fanned out to every segment through it, so only the lines in which segments differ cost extra.
+
+        Lengths are rounded to SEGMENT_TRIE_LENGTH_QUANTUM, much finer than the MATCH_CACHE_LENGTH_QUANTUM of Segment::fingerprint(), since the trie finds the runs which MatchCache then reuses.
+    */
+    class SegmentTrieTest;
+    class SegmentTrie {
+        friend class SegmentTrieTest;
+
+        public:
+        SegmentTrie();
+
+        // Lengths are rounded to multiples of lengthQuantum. Can only be changed while the trie is empty.
+        LmStatus setLengthQuantum(float lengthQuantum);
+
+        // Adds segment under id. Ids index an array of the caller, and each id is added once.
+        void add(int id, const Segment& segment);
+        void clear();
+
+        // For each id in ids, appends to runsOut the runs Segment::findRuns() would find between mapSegment and the segment added under id, in the same order, using the rounded lengths of that segment.
+        // offsetsOut is appended ids.size() + 1 indexes into runsOut, so the runs of ids[k] are runsOut[offsetsOut[k]] to runsOut[offsetsOut[k + 1] - 1].
+        void findRuns(const Segment& mapSegment, const std::pmr::vector<int>& ids, float lengthThreshold, std::pmr::vector<SegmentRun>& runsOut, std::pmr::vector<int>& offsetsOut) const;
+
+        // Same as above with the per-node state in scratch, so that the cost of a call depends on the nodes it visits
+        void findRuns(const Segment& mapSegment, const std::pmr::vector<int>& ids, float lengthThreshold, std::pmr::vector<SegmentRun>& runsOut, std::pmr::vector<int>& offsetsOut, TrieScratch& scratch) const;
+
+        // Number of nodes, excluding the root. Smaller than the number of lines added when segments share prefixes.
+        int numNodes() const;
+
+        protected:
+        struct Node {
+            int64_t quantizedLength;    // Length of the line of this node in multiples of lengthQuantum_
+            int depth;                  // Index of the line of this node in the segments through it. -1 for the root.
+            int parent;
+            int firstChild;
+            int nextSibling;
+        };
+
+        float lengthQuantum_;
+        int maxDepth_;
+        std::vector<Node> nodes_;   // The root is nodes_[0]
+        std::vector<int> idNodes_;  // Node of the last line of each id, or -1 if it has not been added
+        std::vector<bool> idIsReversed_;    // Whether each id is stored from its last line to its first
+    };
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <sstream>
+#include <string>
+
+/*
+    Tracing for debugging the matcher.
+
+    LM_TRACE_LEVEL selects the most detailed level which is compiled in and LM_TRACE_CATEGORIES is a bitmask of the TraceCategory values compiled in. With the default LM_TRACE_LEVEL of LM_TRACE_LEVEL_OFF every LM_TRACE() compiles to nothing and its arguments are never evaluated.
+
+    When enabled, each thread writes to its own lock-free ring buffer and a background thread drains the buffers to the sink stream, so tracing never blocks or serializes the matching threads. Messages are dropped if a buffer is full.
+    A message longer than trace::MAX_MESSAGE_SIZE bytes is cut short and ends with trace::TRUNCATION_MARKER, so a large trace such as a likeness matrix never looks complete when it is not.
+
+    Usage:
+        LM_TRACE(LM_TRACE_LEVEL_DEBUG, TRACE_SEGMENT, "Likeness Matrix\n" << likenessMatrix);
+*/
+
+#define LM_TRACE_LEVEL_OFF      0
+#define LM_TRACE_LEVEL_ERROR    1
+#define LM_TRACE_LEVEL_INFO     2
+#define LM_TRACE_LEVEL_DEBUG    3
+
+#ifndef LM_TRACE_LEVEL
+#define LM_TRACE_LEVEL LM_TRACE_LEVEL_OFF
+#endif
+
+#ifndef LM_TRACE_CATEGORIES
+#define LM_TRACE_CATEGORIES 0xffffffffu
+#endif
+
+namespace lm {
+    enum TraceCategory {
+        TRACE_DETECTOR  = 1 << 0,
+        TRACE_SEGMENT   = 1 << 1,
+        TRACE_MATCHER   = 1 << 2,
+        TRACE_VERIFY    = 1 << 3
+    };
+
+    namespace trace {
+        // Longest message which is written in full
+        const size_t MAX_MESSAGE_SIZE = 16 * 240;
+
+        // Ends a message which was cut to MAX_MESSAGE_SIZE bytes
+        const char TRUNCATION_MARKER[] = " [truncated]";
+
+        // Appends message to the calling thread's ring buffer. Never blocks; the message is dropped if the buffer is full.
+        void write(int level, int category, const std::string& message);
+
+        // Sets the stream messages are written to. Defaults to std::clog.
+        void setSink(std::ostream* stream);
+
+        // Blocks until every message written before the call has been written to the sink
+        void flush();
+
+        // Number of messages dropped because a ring buffer was full
+        uint64_t numDropped();
+
+        // Number of messages cut short because they were longer than MAX_MESSAGE_SIZE
+        uint64_t numTruncated();
+    }; // namespace trace
+}; // namespace lm
+
+#if LM_TRACE_LEVEL > LM_TRACE_LEVEL_OFF
+#define LM_TRACE(level, category, expr) \
+    do { \
+        if ((level) <= LM_TRACE_LEVEL && ((category) & LM_TRACE_CATEGORIES)) { \
+            std::ostringstream lmTraceStream; \
+            lmTraceStream << expr; \
+            ::lm::trace::write((level), (category), lmTraceStream.str()); \
+        } \
+    } while (0)
+#else
+#define LM_TRACE(level, category, expr) do {} while (0)
+#endif
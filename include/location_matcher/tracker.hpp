@@ -0,0 +1,93 @@
+#pragma once
+
+#include <vector>
+
+#include "opencv2/core.hpp"
+
+#include "location_matcher/core.hpp"
+#include "location_matcher/kd_tree.hpp"
+#include "location_matcher/line_detector.hpp"
+#include "location_matcher/location_matcher.hpp"
+
+namespace lm {
+    // Distances are in metres
+    struct TrackerThresholds {
+        TrackerThresholds();
+        float searchRadius;     // Blueprint lines are only paired with map lines within this distance
+        float angleThreshold;   // Paired lines must be parallel to within this angle in radians
+        float inlierThreshold;  // Both ends of a blueprint line must be within this distance of its map line for the line to be an inlier
+        float minInlierRatio;   // [0, 1] fraction of the blueprint's length which must be inliers for a refined pose to be kept
+        float maxResidual;      // Largest RMS distance of the inlier line ends from their map lines for a refined pose to be kept
+        int maxIterations;      // Of ICP
+    };
+
+    // Map lines are split into pieces of at most this length in metres before their midpoints are indexed, so that a short blueprint line finds the long wall it lies on
+    const float TRACKER_PIECE_LENGTH = 0.5;
+
+    /*  Typical usage for Tracker
+        // Find the blueprint once with a global search
+        vector<LocationMatch> matches;
+        matcher.findMatch(map, mapScale, matches);
+        LocationMatch pose = matches.front();
+
+        // Then follow it from map to map
+        Tracker tracker(matcher);
+        while (...) {
+            tracker.track(nextMap, mapScale, pose);
+        }
+    */
+
+    /*
+        Follows a blueprint found by a LocationMatcher from one map to the next. Rather than repeating the global search on every map, the previous pose is refined locally with line-to-line ICP: each blueprint line, placed with the current pose, is paired with the nearest parallel map line, found with a KdTree of map line midpoints, and the pose is updated by Gauss-Newton to minimise the distances of the blueprint line ends from their map lines.
+        The global search is only used when the refined pose has too few inliers or too large a residual.
+
+        A tracker must not be used by more than one thread at a time. The LocationMatcher must outlive it, and its blueprints must not change while it is tracking.
+    */
+    class TrackerTest;
+    class Tracker {
+        friend class TrackerTest;
+
+        public:
+        Tracker(const LocationMatcher& matcher, const TrackerThresholds& thresholds = TrackerThresholds());
+
+        // matchInOut is the pose of a blueprint in the previous map, and is updated to its pose in imageIn. mapScale has the same meaning as in LocationMatcher::findMatch().
+        // If refining the pose fails, the blueprint is searched for in the whole of imageIn and the match with the highest certainty is refined instead.
+        // Returns LM_STATUS_ERROR_MATCH_FAILED, leaving matchInOut unchanged, if the blueprint is not found.
+        LmStatus track(const cv::Mat& imageIn, float mapScale, LocationMatch& matchInOut);
+
+        // Refines the pose of matchInOut against mapLines, which are in metres, and sets its certainty to the fraction of the blueprint's length which are inliers.
+        // Returns LM_STATUS_ERROR_MATCH_FAILED if the refined pose is outside minInlierRatio or maxResidual, and LM_STATUS_ERROR_GENERIC if the blueprint of matchInOut is unknown. matchInOut is only changed on success.
+        LmStatus refine(const KeyLines& mapLines, float mapScale, LocationMatch& matchInOut);
+
+        // Whether the last call to track() fell back to a global search
+        bool usedGlobalSearch() const;
+
+        // RMS distance in metres of the inlier line ends from their map lines after the last call to refine()
+        float residual() const;
+
+        protected:
+        const LocationMatcher& matcher_;
+        TrackerThresholds thresholds_;
+        LineDetector lineDetector_;    // Own copy because detectors are not thread safe
+
+        KeyLines lines_;                            // Lines detected in the current map
+        KeyLines metricLines_;                      // lines_ in metres
+        std::vector<cv::Point2f> pieceMidpoints_;   // Midpoints of the pieces the map lines are split into
+        std::vector<int> pieceLines_;               // Index of the map line of each piece
+        KdTree pieceTree_;                          // Of pieceMidpoints_
+
+        bool usedGlobalSearch_;
+        float residual_;
+
+        // Pairs the blueprint lines, with ends blueprintEnds relative to the centroid in metres, with map lines using the pose (angle, position) and accumulates the Gauss-Newton system of the pose update (hessian, gradient) and the inlier statistics
+        void accumulate(
+            const KeyLines& mapLines,
+            const std::vector<cv::Point2f>& blueprintEnds,
+            float angle,
+            cv::Point2f position,
+            double hessian[3][3],
+            double gradient[3],
+            float& inlierLengthOut,
+            float& residualOut) const;
+    };
+}
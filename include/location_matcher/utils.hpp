@@ -8,10 +8,13 @@ namespace lm {
 
     cv::line_descriptor::KeyLine getKeyLine(float startX, float startY, float endX, float endY);
 
+    // Scales the position and length of every line in linesIn, e.g. from pixels to metres. linesOut is cleared first.
+    void scaleKeyLines(KeyLinesIn linesIn, float scale, KeyLinesOut linesOut);
+
     cv::Point2f rotateVector(cv::Point2f vec, float angle);
 
-    LineJoint isJoinedTo(const cv::line_descriptor::KeyLine& line1,
-                        const cv::line_descriptor::KeyLine& line2,
+    LineJoint isJoinedTo(const Line& line1,
+                        const Line& line2,
                         float distThreshold);
 
     void drawLines(cv::Mat& output, KeyLines lines);
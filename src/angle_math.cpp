@@ -0,0 +1,27 @@
+#include "location_matcher/angle_math.hpp"
+
+namespace lm {
+
+    // The scalar functions are inlined into branch free loops, which the compiler can vectorize
+
+    void atan2Batch(const float* y, const float* x, float* angleOut, size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            angleOut[i] = fastAtan2(y[i], x[i]);
+        }
+    }
+
+    void sinCosBatch(const float* angle, float* sinOut, float* cosOut, size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            float s, c;
+            fastSinCos(angle[i], s, c);
+            sinOut[i] = s;
+            cosOut[i] = c;
+        }
+    }
+
+    void angleDiffBatch(const float* angle1, const float* angle2, float* angleOut, size_t n, float period) {
+        for (size_t i = 0; i < n; i++) {
+            angleOut[i] = fastAngleDiff(angle1[i], angle2[i], period);
+        }
+    }
+}
@@ -0,0 +1,60 @@
+#include "location_matcher/arena.hpp"
+
+using namespace std;
+
+namespace lm {
+
+    Arena::OverflowResource::OverflowResource() : bytes(0) {
+
+    }
+
+    void* Arena::OverflowResource::do_allocate(size_t bytes, size_t alignment) {
+        this->bytes += bytes;
+        return pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+
+    void Arena::OverflowResource::do_deallocate(void* p, size_t bytes, size_t alignment) {
+        pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    }
+
+    bool Arena::OverflowResource::do_is_equal(const pmr::memory_resource& other) const noexcept {
+        return this == &other;
+    }
+
+    Arena::Arena(size_t initialSize) : buffer_(new byte[initialSize]), capacity_(initialSize) {
+        resource_.reset(new pmr::monotonic_buffer_resource(buffer_.get(), capacity_, &overflow_));
+    }
+
+    Arena::~Arena() {
+        // resource_ hands its overflow back to overflow_, so it has to go first
+        resource_.reset();
+    }
+
+    pmr::memory_resource* Arena::resource() {
+        return resource_.get();
+    }
+
+    void Arena::reset() {
+        if (overflow_.bytes == 0) {
+            // Rewinds to the start of buffer_
+            resource_->release();
+            return;
+        }
+
+        // The last call did not fit; grow so that the next one does
+        size_t newCapacity = capacity_ + overflow_.bytes;
+        resource_.reset();
+        buffer_.reset(new byte[newCapacity]);
+        capacity_ = newCapacity;
+        overflow_.bytes = 0;
+        resource_.reset(new pmr::monotonic_buffer_resource(buffer_.get(), capacity_, &overflow_));
+    }
+
+    size_t Arena::capacity() const {
+        return capacity_;
+    }
+
+    size_t Arena::overflowBytes() const {
+        return overflow_.bytes;
+    }
+}; // namespace lm
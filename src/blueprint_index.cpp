@@ -0,0 +1,188 @@
+#include "location_matcher/blueprint_index.hpp"
+
+using namespace std;
+using namespace cv;
+
+namespace lm {
+
+    BlueprintIndex::BlueprintIndex() : numSortedLengths_(0), fingerprintQuantum_(MatchThresholds().lengthThreshold * MATCH_CACHE_LENGTH_QUANTUM) {
+
+    }
+
+    void BlueprintIndex::add(int blueprint, const Segments& segments, const MatchThresholds& thresholds) {
+        fingerprintQuantum_ = thresholds.lengthThreshold * MATCH_CACHE_LENGTH_QUANTUM;
+        if (segments_.empty()) {
+            trie_.setLengthQuantum(thresholds.lengthThreshold * SEGMENT_TRIE_LENGTH_QUANTUM);
+        }
+
+        for (int i = 0; i < segments.data().size(); i++) {
+            const shared_ptr<Segment>& segment = segments.data()[i];
+            trie_.add(segments_.size(), *segment);
+            for (auto lineItr = segment->data().cbegin(); lineItr != segment->data().cend(); lineItr++) {
+                lengths_.push_back({lineItr->lineLength, (int)segments_.size()});
+            }
+            segments_.push_back(segment);
+            segmentBlueprints_.push_back(blueprint);
+            segmentIndexes_.push_back(i);
+            segmentFingerprints_.push_back(segment->fingerprint(fingerprintQuantum_));
+        }
+    }
+
+    void BlueprintIndex::finalize() {
+        // Entries of equal length stay in the order they were added: the new entries are sorted stably and merged in after the older entries of the same length
+        auto isShorter = [](const LengthEntry& entry1, const LengthEntry& entry2) {
+            return entry1.length < entry2.length;
+        };
+        stable_sort(lengths_.begin() + numSortedLengths_, lengths_.end(), isShorter);
+        inplace_merge(lengths_.begin(), lengths_.begin() + numSortedLengths_, lengths_.end(), isShorter);
+        numSortedLengths_ = lengths_.size();
+    }
+
+    bool BlueprintIndex::isFinalized() const {
+        return numSortedLengths_ == lengths_.size();
+    }
+
+    void BlueprintIndex::clear() {
+        lengths_.clear();
+        numSortedLengths_ = 0;
+        segments_.clear();
+        segmentBlueprints_.clear();
+        segmentIndexes_.clear();
+        segmentFingerprints_.clear();
+        trie_.clear();
+    }
+
+    void BlueprintIndex::fingerprint(const Segments& mapSegments, pmr::vector<uint64_t>& fingerprintsOut) const {
+        fingerprintsOut.clear();
+        for (auto segmentItr = mapSegments.data().cbegin(); segmentItr != mapSegments.data().cend(); segmentItr++) {
+            fingerprintsOut.push_back((*segmentItr)->fingerprint(fingerprintQuantum_));
+        }
+    }
+
+    void BlueprintIndex::findCandidates(const Segments& mapSegments, float lengthThreshold, pmr::vector<IndexCandidate>& candidatesOut) const {
+        const int firstCandidate = candidatesOut.size();
+        pmr::memory_resource* resource = candidatesOut.get_allocator().resource();
+
+        // Number of like line pairs between the current map segment and each blueprint segment, and the segments touched so the counts can be reset without clearing all of them
+        pmr::vector<int> numLikePairs(segments_.size(), 0, resource);
+        pmr::vector<int> touched(resource);
+
+        for (int i = 0; i < mapSegments.data().size(); i++) {
+            const Segment& mapSegment = *mapSegments.data()[i];
+            if (mapSegment.data().size() < SEGMENT_MIN_MATCH_LENGTH) {
+                continue;
+            }
+
+            for (auto lineItr = mapSegment.data().cbegin(); lineItr != mapSegment.data().cend(); lineItr++) {
+                float length = lineItr->lineLength;
+                auto entryItr = lower_bound(lengths_.cbegin(), lengths_.cend(), length - lengthThreshold, [](const LengthEntry& entry, float value) {
+                    return entry.length < value;
+                });
+                for (; entryItr != lengths_.cend() && entryItr->length <= length + lengthThreshold; entryItr++) {
+                    if (compareLengths(length, entryItr->length, lengthThreshold) >= SEGMENT_LIKENESS_THRESHOLD) {
+                        if (numLikePairs[entryItr->segment]++ == 0) {
+                            touched.push_back(entryItr->segment);
+                        }
+                    }
+                }
+            }
+
+            // mayMatch() needs SEGMENT_MIN_MATCH_LENGTH different lines of each segment with a like line, so fewer like pairs cannot match
+            for (auto segmentItr = touched.cbegin(); segmentItr != touched.cend(); segmentItr++) {
+                if (numLikePairs[*segmentItr] >= SEGMENT_MIN_MATCH_LENGTH && mapSegment.mayMatch(*segments_[*segmentItr], lengthThreshold)) {
+                    candidatesOut.push_back({segmentBlueprints_[*segmentItr], segmentIndexes_[*segmentItr], i, 0, 0});
+                }
+                numLikePairs[*segmentItr] = 0;
+            }
+            touched.clear();
+        }
+
+        sort(candidatesOut.begin() + firstCandidate, candidatesOut.end(), [](const IndexCandidate& candidate1, const IndexCandidate& candidate2) {
+            return make_tuple(candidate1.blueprint, candidate1.blueprintSegment, candidate1.mapSegment) < make_tuple(candidate2.blueprint, candidate2.blueprintSegment, candidate2.mapSegment);
+        });
+    }
+
+    void BlueprintIndex::findRuns(
+        const Segments& mapSegments,
+        const pmr::vector<uint64_t>& mapFingerprints,
+        IndexCandidate* candidatesBegin,
+        IndexCandidate* candidatesEnd,
+        float lengthThreshold,
+        MatchCache& cache,
+        TrieScratch& trieScratch,
+        pmr::vector<SegmentRun>& runsOut) const {
+
+        pmr::memory_resource* resource = runsOut.get_allocator().resource();
+
+        // Candidates whose runs are not cached, grouped by map segment
+        pmr::vector<IndexCandidate*> misses(resource);
+        for (IndexCandidate* candidate = candidatesBegin; candidate != candidatesEnd; candidate++) {
+            const pmr::vector<SegmentRun>* cachedRuns = cache.find(mapFingerprints[candidate->mapSegment], segmentFingerprints_[segmentIndex(*candidate)]);
+            if (cachedRuns == nullptr) {
+                misses.push_back(candidate);
+                continue;
+            }
+            candidate->firstRun = runsOut.size();
+            candidate->numRuns = cachedRuns->size();
+            runsOut.insert(runsOut.end(), cachedRuns->cbegin(), cachedRuns->cend());
+        }
+        stable_sort(misses.begin(), misses.end(), [](const IndexCandidate* candidate1, const IndexCandidate* candidate2) {
+            return candidate1->mapSegment < candidate2->mapSegment;
+        });
+
+        // The trie is walked once for each map segment, for all of its candidates
+        pmr::vector<int> ids(resource);
+        pmr::vector<SegmentRun> runs(resource);
+        pmr::vector<int> offsets(resource);
+        pmr::vector<SegmentRun> pairRuns(resource);
+        for (auto missItr = misses.cbegin(); missItr != misses.cend();) {
+            const int mapSegment = (*missItr)->mapSegment;
+            auto groupEnd = missItr;
+            ids.clear();
+            for (; groupEnd != misses.cend() && (*groupEnd)->mapSegment == mapSegment; groupEnd++) {
+                ids.push_back(segmentIndex(**groupEnd));
+            }
+
+            runs.clear();
+            offsets.clear();
+            trie_.findRuns(*mapSegments.data()[mapSegment], ids, lengthThreshold, runs, offsets, trieScratch);
+
+            for (int k = 0; k < ids.size(); k++) {
+                IndexCandidate& candidate = *missItr[k];
+                candidate.firstRun = runsOut.size();
+                candidate.numRuns = offsets[k + 1] - offsets[k];
+                pairRuns.assign(runs.cbegin() + offsets[k], runs.cbegin() + offsets[k + 1]);
+                runsOut.insert(runsOut.end(), pairRuns.cbegin(), pairRuns.cend());
+                cache.insert(mapFingerprints[mapSegment], segmentFingerprints_[ids[k]], pairRuns);
+            }
+            missItr = groupEnd;
+        }
+    }
+
+    LmStatus BlueprintIndex::matchCandidates(
+        const Segments& mapSegments,
+        const IndexCandidate* candidatesBegin,
+        const IndexCandidate* candidatesEnd,
+        const pmr::vector<SegmentRun>& runs,
+        std::vector<SegmentMatch>& matches,
+        const MatchThresholds& thresholds) const {
+
+        pmr::vector<SegmentRun> candidateRuns(runs.get_allocator().resource());
+        for (const IndexCandidate* candidate = candidatesBegin; candidate != candidatesEnd; candidate++) {
+            const Segment& mapSegment = *mapSegments.data()[candidate->mapSegment];
+            candidateRuns.assign(runs.cbegin() + candidate->firstRun, runs.cbegin() + candidate->firstRun + candidate->numRuns);
+            mapSegment.matchRuns(*segments_[segmentIndex(*candidate)], candidateRuns, matches, thresholds);
+        }
+
+        return LM_STATUS_OK;
+    }
+
+    int BlueprintIndex::segmentIndex(const IndexCandidate& candidate) const {
+        // Segments of a blueprint are stored together, in order
+        return lower_bound(segmentBlueprints_.cbegin(), segmentBlueprints_.cend(), candidate.blueprint) - segmentBlueprints_.cbegin() + candidate.blueprintSegment;
+    }
+
+    int BlueprintIndex::size() const {
+        return segments_.size();
+    }
+}
@@ -0,0 +1,104 @@
+#include "location_matcher/chamfer.hpp"
+
+#include <opencv2/imgproc.hpp>
+
+using namespace std;
+using namespace cv;
+using namespace cv::line_descriptor;
+
+namespace lm {
+
+    size_t ChamferModel::size() const {
+        return x.size();
+    }
+
+    LmStatus buildChamferModel(KeyLinesIn lines, float sampleStep, ChamferModel& modelOut) {
+        if (sampleStep <= 0) {
+            return LM_STATUS_ERROR_GENERIC;
+        }
+
+        modelOut.x.clear();
+        modelOut.y.clear();
+
+        for (auto lineItr = lines.cbegin(); lineItr != lines.cend(); lineItr++) {
+            Point2f start = lineItr->getStartPoint();
+            Point2f end = lineItr->getEndPoint();
+
+            int numSteps = max(1, (int)ceil(dist(start, end) / sampleStep));
+            for (int i = 0; i <= numSteps; i++) {
+                Point2f pt = start + (end - start) * ((float)i / numSteps);
+                modelOut.x.push_back(pt.x);
+                modelOut.y.push_back(pt.y);
+            }
+        }
+
+        return LM_STATUS_OK;
+    }
+
+    LmStatus computeDistanceMap(const cv::Mat& occupancyIn, cv::Mat& distanceMapOut) {
+        Mat freeSpace;
+        return computeDistanceMap(occupancyIn, distanceMapOut, freeSpace);
+    }
+
+    LmStatus computeDistanceMap(const cv::Mat& occupancyIn, cv::Mat& distanceMapOut, cv::Mat& freeSpace) {
+        if (occupancyIn.empty()) {
+            return LM_STATUS_ERROR_GENERIC;
+        }
+
+        // distanceTransform measures the distance to the nearest zero pixel, which are the occupied pixels after thresholding
+        threshold(occupancyIn, freeSpace, 127, 255, THRESH_BINARY);
+        distanceTransform(freeSpace, distanceMapOut, DIST_L2, DIST_MASK_3);
+
+        return LM_STATUS_OK;
+    }
+
+    float chamferScore(const ChamferModel& model, const cv::Mat& distanceMap, cv::Point2f origin, cv::Point2f translation, float angle, float maxDistance, float minScore, float pixelsPerUnit) {
+        const int blockSize = 64;
+        const int numSamples = model.size();
+        if (numSamples == 0) {
+            return 0;
+        }
+
+        // Rotation and conversion to pixels in one matrix
+        const float cosAngle = cos(angle) * pixelsPerUnit;
+        const float sinAngle = sin(angle) * pixelsPerUnit;
+        const Point2f pixelTranslation = translation * pixelsPerUnit;
+        const float invMaxDistance = 1.0f / maxDistance;
+        const float minSum = minScore * numSamples;
+
+        float mapX[blockSize];
+        float mapY[blockSize];
+        float scoreSum = 0;
+
+        for (int blockStart = 0; blockStart < numSamples; blockStart += blockSize) {
+            const int blockLength = min(blockSize, numSamples - blockStart);
+            const float* modelX = model.x.data() + blockStart;
+            const float* modelY = model.y.data() + blockStart;
+
+            // Transform the whole block first; this loop has no branches so it can be vectorized
+            for (int i = 0; i < blockLength; i++) {
+                float dx = modelX[i] - origin.x;
+                float dy = modelY[i] - origin.y;
+                mapX[i] = pixelTranslation.x + cosAngle*dx - sinAngle*dy;
+                mapY[i] = pixelTranslation.y + sinAngle*dx + cosAngle*dy;
+            }
+
+            for (int i = 0; i < blockLength; i++) {
+                int col = cvRound(mapX[i]);
+                int row = cvRound(mapY[i]);
+                if (row >= 0 && row < distanceMap.rows && col >= 0 && col < distanceMap.cols) {
+                    float d = distanceMap.ptr<float>(row)[col];
+                    scoreSum += max(0.0f, 1 - d*invMaxDistance);
+                }
+            }
+
+            // Every remaining sample scoring 1 is the best case; stop if even that cannot reach minScore
+            int numRemaining = numSamples - (blockStart + blockLength);
+            if (scoreSum + numRemaining < minSum) {
+                break;
+            }
+        }
+
+        return scoreSum / numSamples;
+    }
+}; // namespace lm
@@ -0,0 +1,112 @@
+#include <cfloat>
+
+#include "location_matcher/kd_tree.hpp"
+
+using namespace std;
+using namespace cv;
+
+namespace lm {
+
+    static inline float axisValue(const Point2f& pt, int depth) {
+        return depth % 2 == 0 ? pt.x : pt.y;
+    }
+
+    static inline float distSquared(const Point2f& pt1, const Point2f& pt2) {
+        Point2f diff = pt2 - pt1;
+        return diff.dot(diff);
+    }
+
+    KdTree::KdTree(pmr::memory_resource* resource) : points_(resource), indexes_(resource) {
+
+    }
+
+    void KdTree::build(const std::vector<cv::Point2f>& points) {
+        points_.assign(points.cbegin(), points.cend());
+        indexes_.resize(points.size());
+        for (int i = 0; i < indexes_.size(); i++) {
+            indexes_[i] = i;
+        }
+        buildRange(0, points_.size(), 0);
+    }
+
+    void KdTree::clear() {
+        points_.clear();
+        indexes_.clear();
+    }
+
+    void KdTree::buildRange(int begin, int end, int depth) {
+        if (end - begin <= 1) {
+            return;
+        }
+
+        // Partition the indexes around the median on this depth's axis
+        int mid = (begin + end) / 2;
+        nth_element(indexes_.begin() + begin, indexes_.begin() + mid, indexes_.begin() + end, [this, depth](int index1, int index2) {
+            return axisValue(points_[index1], depth) < axisValue(points_[index2], depth);
+        });
+
+        buildRange(begin, mid, depth + 1);
+        buildRange(mid + 1, end, depth + 1);
+    }
+
+    void KdTree::radiusSearch(cv::Point2f pt, float radius, std::pmr::vector<int>& indexesOut) const {
+        radiusSearchRange(0, points_.size(), 0, pt, radius * radius, indexesOut);
+    }
+
+    void KdTree::radiusSearchRange(int begin, int end, int depth, Point2f pt, float radiusSquared, pmr::vector<int>& indexesOut) const {
+        if (begin >= end) {
+            return;
+        }
+
+        int mid = (begin + end) / 2;
+        const Point2f& median = points_[indexes_[mid]];
+        if (distSquared(pt, median) <= radiusSquared) {
+            indexesOut.push_back(indexes_[mid]);
+        }
+
+        // Only visit the far side of the split if the circle crosses it
+        float axisDist = axisValue(pt, depth) - axisValue(median, depth);
+        if (axisDist <= 0 || axisDist * axisDist <= radiusSquared) {
+            radiusSearchRange(begin, mid, depth + 1, pt, radiusSquared, indexesOut);
+        }
+        if (axisDist >= 0 || axisDist * axisDist <= radiusSquared) {
+            radiusSearchRange(mid + 1, end, depth + 1, pt, radiusSquared, indexesOut);
+        }
+    }
+
+    int KdTree::nearest(cv::Point2f pt) const {
+        int nearestIndex = -1;
+        float nearestDistSquared = FLT_MAX;
+        nearestRange(0, points_.size(), 0, pt, nearestIndex, nearestDistSquared);
+        return nearestIndex;
+    }
+
+    void KdTree::nearestRange(int begin, int end, int depth, Point2f pt, int& nearestOut, float& distSquaredOut) const {
+        if (begin >= end) {
+            return;
+        }
+
+        int mid = (begin + end) / 2;
+        const Point2f& median = points_[indexes_[mid]];
+        float medianDistSquared = distSquared(pt, median);
+        if (medianDistSquared < distSquaredOut) {
+            nearestOut = indexes_[mid];
+            distSquaredOut = medianDistSquared;
+        }
+
+        // Search the side of the split containing pt first, then the other side only if it may hold something nearer
+        float axisDist = axisValue(pt, depth) - axisValue(median, depth);
+        int nearBegin = axisDist < 0 ? begin : mid + 1;
+        int nearEnd = axisDist < 0 ? mid : end;
+        int farBegin = axisDist < 0 ? mid + 1 : begin;
+        int farEnd = axisDist < 0 ? end : mid;
+        nearestRange(nearBegin, nearEnd, depth + 1, pt, nearestOut, distSquaredOut);
+        if (axisDist * axisDist < distSquaredOut) {
+            nearestRange(farBegin, farEnd, depth + 1, pt, nearestOut, distSquaredOut);
+        }
+    }
+
+    int KdTree::size() const {
+        return points_.size();
+    }
+}
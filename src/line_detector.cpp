@@ -5,11 +5,29 @@ using namespace cv;
 using namespace cv::line_descriptor;
 
 namespace lm {  
-#ifndef USE_LSD_DETECTOR
-    int LineDetector::numInstances = 0;
-#endif
+    // ######## Backends ########
 
-    LineDetector::LineDetector() {
+    LineDetectorBackend::~LineDetectorBackend() {
+
+    }
+
+    LsdBackend::LsdBackend() {
+        lineDetector_ = LSDDetector::createLSDDetector();
+    }
+
+    void LsdBackend::detect(const cv::Mat& imgIn, KeyLinesOut lines, const cv::Mat& mask) {
+        lineDetector_->detect(imgIn, lines, 1, 1, mask);
+    }
+
+    string LsdBackend::name() const {
+        return "LSD";
+    }
+
+    cv::Ptr<LineDetectorBackend> LsdBackend::clone() const {
+        return makePtr<LsdBackend>();
+    }
+
+    EdLinesBackend::EdLinesBackend() {
         BinaryDescriptor::Params bdParams;
         bdParams.ksize_ = 5;            // Gaussian kernel size. Higher = less 
                                         // sensitivity of disjointed sections
@@ -18,14 +36,41 @@ namespace lm {
                                         // constructing gaussian pyramid octaves
         bdParams.widthOfBand_ = 1;
 
-#ifdef USE_LSD_DETECTOR
-        lineDetector_ = LSDDetector::createLSDDetector();
-#else
         bdParams_ = bdParams;
         lineDetector_ = BinaryDescriptor::createBinaryDescriptor(bdParams);
-#endif
+    }
+
+    void EdLinesBackend::detect(const cv::Mat& imgIn, KeyLinesOut lines, const cv::Mat& mask) {
+        lineDetector_->detect(imgIn, lines, mask);
+    }
+
+    string EdLinesBackend::name() const {
+        return "EDLines";
+    }
+
+    cv::Ptr<LineDetectorBackend> EdLinesBackend::clone() const {
+        return makePtr<EdLinesBackend>();
+    }
+
+    // ######## LineDetector ########
+
+    LineDetector::LineDetector(LineDetectorType type) : backend_(createBackend(type)) {
+
     } 
 
+    LineDetector::LineDetector(cv::Ptr<LineDetectorBackend> backend) : backend_(backend) {
+
+    }
+
+    LineDetector::LineDetector(const LineDetector& other) : backend_(other.backend_ ? other.backend_->clone() : cv::Ptr<LineDetectorBackend>()) {
+
+    }
+
+    LineDetector& LineDetector::operator=(const LineDetector& other) {
+        backend_ = other.backend_ ? other.backend_->clone() : cv::Ptr<LineDetectorBackend>();
+        return *this;
+    }
+
     LineDetector::~LineDetector() {
     }     
     
@@ -36,11 +81,17 @@ namespace lm {
 
     LmStatus LineDetector::detect(const cv::Mat& imgIn, KeyLinesOut lines, const cv::Mat& mask) {
         KeyLines detectedLines;
-#ifdef USE_LSD_DETECTOR
-        lineDetector_->detect(imgIn, detectedLines,  1, 1, mask);
-#else
-        lineDetector_->detect(imgIn, detectedLines, mask );
-#endif
+        return detect(imgIn, lines, mask, detectedLines);
+    }
+
+    LmStatus LineDetector::detect(const cv::Mat& imgIn, KeyLinesOut lines, const cv::Mat& mask, KeyLines& detectedLines) {
+        if (!backend_) {
+            return LM_STATUS_ERROR_GENERIC;
+        }
+
+        detectedLines.clear();
+        backend_->detect(imgIn, detectedLines, mask);
+
         float offsetR = 0.0; // Estimation of impact of gaussian kernel smoothing on line position
         for ( size_t i = 0; i < detectedLines.size(); i++ )
         {
@@ -53,6 +104,10 @@ namespace lm {
                 Point2f pt1 = Point2f( kl.startPointX, kl.startPointY );
                 Point2f pt2 = Point2f( kl.endPointX, kl.endPointY );
 
+                // LSD reports the angle perpendicular to the line and EDLines the angle parallel to it. Both are replaced by the direction from start to end.
+                Point2f lineVec = pt2 - pt1;
+                kl.angle = atan2(lineVec.y, lineVec.x);
+
                 // Shift the line by an offset because of the detection position bias of gaussian kernel smoothing
                 float angle = kl.angle;
                 angle = M_PI - angle;
@@ -70,7 +125,77 @@ namespace lm {
         return LM_STATUS_OK;
     }
 
+    string LineDetector::name() const {
+        return backend_ ? backend_->name() : "";
+    }
+
+    cv::Ptr<LineDetectorBackend> LineDetector::createBackend(LineDetectorType type) {
+        switch (type) {
+            case LINE_DETECTOR_LSD:
+                return makePtr<LsdBackend>();
+            case LINE_DETECTOR_EDLINES:
+                return makePtr<EdLinesBackend>();
+            default:
+                return cv::Ptr<LineDetectorBackend>();
+        }
+    }
+
+    // True if line has a counterpart in lines with both end points within tolerance, in either direction
+    static bool hasMatchingLine(const KeyLine& line, KeyLinesIn lines, float tolerance) {
+        for (auto lineItr = lines.cbegin(); lineItr != lines.cend(); lineItr++) {
+            Point2f start = lineItr->getStartPoint();
+            Point2f end = lineItr->getEndPoint();
+            if ((dist(line.getStartPoint(), start) <= tolerance && dist(line.getEndPoint(), end) <= tolerance) ||
+                (dist(line.getStartPoint(), end) <= tolerance && dist(line.getEndPoint(), start) <= tolerance)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    LmStatus LineDetector::benchmark(const std::vector<cv::Mat>& images, std::vector<LineDetectorBenchmark>& resultsOut, float positionTolerance) {
+        // Lines found by the reference backend in each image
+        vector<KeyLines> referenceLines(images.size());
+
+        for (int type = 0; type < LINE_DETECTOR_NUM_TYPES; type++) {
+            LineDetector detector(static_cast<LineDetectorType>(type));
+
+            LineDetectorBenchmark result;
+            result.name = detector.name();
+            result.numLines = 0;
+            result.seconds = 0;
+
+            size_t numAgreed = 0;
+            for (size_t i = 0; i < images.size(); i++) {
+                KeyLines lines;
+
+                int64 startTicks = getTickCount();
+                detector.detect(images[i], lines);
+                result.seconds += (getTickCount() - startTicks) / getTickFrequency();
+                result.numLines += lines.size();
+
+                if (type == 0) {
+                    referenceLines[i] = lines;
+                    numAgreed += lines.size();
+                    continue;
+                }
+
+                for (auto lineItr = lines.cbegin(); lineItr != lines.cend(); lineItr++) {
+                    if (hasMatchingLine(*lineItr, referenceLines[i], positionTolerance)) {
+                        numAgreed++;
+                    }
+                }
+            }
+
+            result.linesPerSecond = result.seconds > 0 ? result.numLines / result.seconds : 0;
+            result.agreement = result.numLines > 0 ? (double)numAgreed / result.numLines : 0;
+            resultsOut.push_back(result);
+        }
+
+        return LM_STATUS_OK;
+    }
+
     LmStatus mergeDuplicates(KeyLines& lines) {
         
     }
-} // namespace bzd
\ No newline at end of file
+} // namespace bzd
@@ -44,6 +44,22 @@ namespace lm {
         return LM_STATUS_OK;
     }
 
+    LmStatus LineFilter::filterByLine(const OccupancyBitmap& occupiedIn, OccupancyBitmap& occupiedOut, KeyLinesIn lines, const int lineThickness) {
+        occupiedOut.create(occupiedIn.rows(), occupiedIn.cols());
+
+        for (auto lineItr = lines.cbegin(); lineItr != lines.cend(); lineItr++) {
+            Point2f pt1 = lineItr->getStartPoint();
+            Point2f pt2 = lineItr->getEndPoint();
+
+            float length = dist(pt1, pt2);
+            if (length >= minLineLength_ && length <= maxLineLength_) {
+                occupiedOut.fillLine(pt1, pt2, lineThickness / 2.0f);
+            }
+        }
+
+        return occupiedOut.andWith(occupiedIn);
+    }
+
     void LineFilter::setMinLineLength(double minLength) {
         minLineLength_ = minLength;
     }
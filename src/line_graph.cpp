@@ -0,0 +1,219 @@
+#include "location_matcher/line_graph.hpp"
+
+using namespace std;
+using namespace cv;
+using namespace cv::line_descriptor;
+
+namespace lm {
+
+    LineGraph::LineGraph(pmr::memory_resource* resource) : 
+        resource_(resource), 
+        lines_(resource), 
+        lineNodes_(resource), 
+        nodes_(resource), 
+        nodeLinesBegin_(1, 0, resource), 
+        nodeLines_(resource),
+        nodeCellSize_(0),
+        nodeCells_(resource) {
+
+    }
+
+    LmStatus LineGraph::addLines(const KeyLines& lines, const MatchThresholds& thresholds) {
+        for (auto lineItr = lines.cbegin(); lineItr != lines.cend(); lineItr++) {
+            Line line(*lineItr);
+            int startNode = findOrAddNode(line.getStartPoint(), thresholds.joinDistThreshold);
+            int endNode = findOrAddNode(line.getEndPoint(), thresholds.joinDistThreshold);
+            if (startNode == endNode) {
+                // Shorter than the join distance, so it would only join a node to itself
+                continue;
+            }
+
+            lines_.push_back(line);
+            lineNodes_.push_back({startNode, endNode});
+        }
+
+        // Rebuild the lines at each node by counting them first, then filling in the lines
+        nodeLinesBegin_.assign(nodes_.size() + 1, 0);
+        for (auto nodesItr = lineNodes_.cbegin(); nodesItr != lineNodes_.cend(); nodesItr++) {
+            nodeLinesBegin_[(*nodesItr)[0] + 1]++;
+            nodeLinesBegin_[(*nodesItr)[1] + 1]++;
+        }
+        partial_sum(nodeLinesBegin_.begin(), nodeLinesBegin_.end(), nodeLinesBegin_.begin());
+
+        nodeLines_.assign(2 * lines_.size(), 0);
+        pmr::vector<int> nextLine(nodeLinesBegin_.cbegin(), nodeLinesBegin_.cend() - 1, resource_);
+        for (int line = 0; line < lineNodes_.size(); line++) {
+            nodeLines_[nextLine[lineNodes_[line][0]]++] = line;
+            nodeLines_[nextLine[lineNodes_[line][1]]++] = line;
+        }
+
+        return LM_STATUS_OK;
+    }
+
+    LmStatus LineGraph::clear() {
+        lines_.clear();
+        lineNodes_.clear();
+        nodes_.clear();
+        nodeLinesBegin_.assign(1, 0);
+        nodeLines_.clear();
+        nodeCells_.clear();
+        return LM_STATUS_OK;
+    }
+
+    LmStatus LineGraph::matchSegments(const Segments& segments, std::vector<SegmentMatch>& matches, const MatchThresholds& thresholds) const {
+        const float likenessThreshold = SEGMENT_LIKENESS_THRESHOLD;
+        const int numLines = lines_.size();
+
+        pmr::vector<char> isLike(resource_);
+        pmr::vector<int> path(resource_);
+        Segment pathSegment(resource_);
+        for (auto segmentItr = segments.data().cbegin(); segmentItr != segments.data().cend(); segmentItr++) {
+            const Segment& segment = **segmentItr;
+            const int segmentSize = segment.data().size();
+            if (segmentSize < SEGMENT_MIN_MATCH_LENGTH) {
+                continue;
+            }
+
+            // isLike[i*segmentSize + j] is true if line i of the graph is like line j of the segment. Same likeness as Segment::compareWith().
+            isLike.assign(numLines * segmentSize, false);
+            for (int line = 0; line < numLines; line++) {
+                int index = 0;
+                for (auto segmentLineItr = segment.data().cbegin(); segmentLineItr != segment.data().cend(); segmentLineItr++) {
+                    isLike[line*segmentSize + index] = compareLines(lines_[line], *segmentLineItr, true, thresholds.lengthThreshold) >= likenessThreshold;
+                    index++;
+                }
+            }
+
+            // True if a line other than line at node is like line index of the segment
+            auto hasLikeLineAt = [&](int node, int line, int index) {
+                for (int i = nodeLinesBegin_[node]; i < nodeLinesBegin_[node + 1]; i++) {
+                    if (nodeLines_[i] != line && isLike[nodeLines_[i]*segmentSize + index]) {
+                        return true;
+                    }
+                }
+                return false;
+            };
+
+            // Start a path from every line like each line of the segment, entering the line from either end
+            for (int index = 0; index + SEGMENT_MIN_MATCH_LENGTH <= segmentSize; index++) {
+                for (int line = 0; line < numLines; line++) {
+                    if (!isLike[line*segmentSize + index]) {
+                        continue;
+                    }
+
+                    for (int end = 0; end < 2; end++) {
+                        int entryNode = lineNodes_[line][end];
+
+                        // A path which could start one line earlier is found when starting from that line instead
+                        if (index > 0 && hasLikeLineAt(entryNode, line, index - 1)) {
+                            continue;
+                        }
+
+                        path.assign(1, line);
+                        pathSegment.data_.assign(1, lines_[line]);
+                        walkPath(path, pathSegment, otherNode(line, entryNode), index + 1, isLike, segment, thresholds, matches);
+                    }
+                }
+            }
+        }
+
+        return LM_STATUS_OK;
+    }
+
+    void LineGraph::walkPath(pmr::vector<int>& path, Segment& pathSegment, int node, int index, const pmr::vector<char>& isLike, const Segment& segment, const MatchThresholds& thresholds, vector<SegmentMatch>& matches) const {
+        const int segmentSize = segment.data().size();
+
+        bool isExtended = false;
+        if (index < segmentSize) {
+            for (int i = nodeLinesBegin_[node]; i < nodeLinesBegin_[node + 1]; i++) {
+                int line = nodeLines_[i];
+
+                // Each line is used once per path so that loops of walls end
+                if (!isLike[line*segmentSize + index] || find(path.cbegin(), path.cend(), line) != path.cend()) {
+                    continue;
+                }
+
+                path.push_back(line);
+                pathSegment.data_.push_back(lines_[line]);
+                walkPath(path, pathSegment, otherNode(line, node), index + 1, isLike, segment, thresholds, matches);
+                pathSegment.data_.pop_back();
+                path.pop_back();
+                isExtended = true;
+            }
+        }
+
+        if (isExtended || path.size() < SEGMENT_MIN_MATCH_LENGTH) {
+            return;
+        }
+
+        const int pathLength = path.size();
+        const SegmentRun run = {0, pathLength - 1, index - pathLength, index - 1};
+        float angleOffset;
+        Point2f positionOffset;
+        if (SegmentMatch::computeOffsets(pathSegment, segment, run, thresholds, angleOffset, positionOffset) != LM_STATUS_OK) {
+            return;
+        }
+
+        matches.push_back(SegmentMatch(pathSegment, run.startIndex1, run.endIndex1, segment, run.startIndex2, run.endIndex2, resource_));
+        matches.back().angleOffset = angleOffset;
+        matches.back().positionOffset = positionOffset;
+    }
+
+    const pmr::vector<Line>& LineGraph::lines() const {
+        return lines_;
+    }
+
+    const pmr::vector<Point2f>& LineGraph::nodes() const {
+        return nodes_;
+    }
+
+    int LineGraph::degree(int node) const {
+        return nodeLinesBegin_[node + 1] - nodeLinesBegin_[node];
+    }
+
+    int64_t LineGraph::cellKey(int x, int y) {
+        return ((int64_t)x << 32) | (uint32_t)y;
+    }
+
+    int LineGraph::findOrAddNode(Point2f pt, float distThreshold) {
+        // Rebucket the nodes if the threshold changed since they were added, so that any node within distThreshold of pt is in a neighbouring cell
+        const float cellSize = max(distThreshold, 1e-3f);
+        if (cellSize != nodeCellSize_) {
+            nodeCellSize_ = cellSize;
+            nodeCells_.clear();
+            for (int node = 0; node < nodes_.size(); node++) {
+                nodeCells_.emplace(cellKey((int)floor(nodes_[node].x / cellSize), (int)floor(nodes_[node].y / cellSize)), node);
+            }
+        }
+
+        const int cellX = (int)floor(pt.x / cellSize);
+        const int cellY = (int)floor(pt.y / cellSize);
+        int nearestNode = -1;
+        float nearestDist = distThreshold;
+        for (int y = cellY - 1; y <= cellY + 1; y++) {
+            for (int x = cellX - 1; x <= cellX + 1; x++) {
+                auto cellRange = nodeCells_.equal_range(cellKey(x, y));
+                for (auto cellItr = cellRange.first; cellItr != cellRange.second; cellItr++) {
+                    // Of nodes at the same distance the one added last is kept, whatever order the cells are visited in
+                    int node = cellItr->second;
+                    float nodeDist = dist(pt, nodes_[node]);
+                    if (nodeDist < nearestDist || (nodeDist == nearestDist && node > nearestNode)) {
+                        nearestNode = node;
+                        nearestDist = nodeDist;
+                    }
+                }
+            }
+        }
+
+        if (nearestNode < 0) {
+            nearestNode = nodes_.size();
+            nodes_.push_back(pt);
+            nodeCells_.emplace(cellKey(cellX, cellY), nearestNode);
+        }
+        return nearestNode;
+    }
+
+    int LineGraph::otherNode(int line, int node) const {
+        return lineNodes_[line][0] == node ? lineNodes_[line][1] : lineNodes_[line][0];
+    }
+}
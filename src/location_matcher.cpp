@@ -6,7 +6,23 @@ using namespace cv::line_descriptor;
 
 namespace lm {
 
-    LocationMatcher::LocationMatcher() {
+    BlueprintStats::BlueprintStats() : numQueries(0), numHits(0), numTimed(0), averageSeconds(0) {
+
+    }
+
+    double BlueprintStats::expectedHitRate() const {
+        return (numHits + 1.0) / (numQueries + 2.0);
+    }
+
+    LocationMatcher::LocationMatcher() : minCertainty_(0), maxMatches_(0), mapRepresentation_(MAP_REPRESENTATION_SEGMENTS) {
+        // Metric equivalents of the pixel defaults at 5cm per pixel
+        thresholds_.positionThreshold = 0.25;
+        thresholds_.lengthThreshold = 0.55;
+        thresholds_.joinDistThreshold = 0.25;
+        thresholds_.directionDistThreshold = 0.5;
+    }
+
+    MatchContext::MatchContext(const LineDetector& lineDetector) : lineDetector(lineDetector) {
 
     }
 
@@ -14,39 +30,574 @@ namespace lm {
 
     }
 
-    LmStatus LocationMatcher::findMatch(const cv::Mat& imageIn, std::vector<LocationMatch>& matchesOut) {
-        // Extract the segments from the image
-        KeyLines lines;
-        lineDetector_.detect(imageIn, lines);
-        Segments imageSegments;
-        imageSegments.addLines(lines);
+    LmStatus LocationMatcher::findMatch(const cv::Mat& imageIn, std::vector<LocationMatch>& matchesOut) const {
+        return findMatch(imageIn, 0, matchesOut);
+    }
+
+    LmStatus LocationMatcher::findMatch(const cv::Mat& imageIn, std::vector<LocationMatch>& matchesOut, MatchContext& context) const {
+        return findMatch(imageIn, 0, matchesOut, context);
+    }
+
+    LmStatus LocationMatcher::findMatch(const cv::Mat& imageIn, float mapScale, std::vector<LocationMatch>& matchesOut) const {
+        unique_ptr<MatchContext> context = acquireContext();
+        LmStatus status = findMatch(imageIn, mapScale, matchesOut, *context);
+        releaseContext(std::move(context));
+        return status;
+    }
+
+    LmStatus LocationMatcher::findMatch(const cv::Mat& imageIn, float mapScale, std::vector<LocationMatch>& matchesOut, MatchContext& context) const {
+        return findMatch(imageIn, mapScale, [&](const BlueprintMatch& match) {
+            matchesOut.push_back(toLocationMatch(match));
+            return true;
+        }, context);
+    }
+
+    LmStatus LocationMatcher::findMatch(const cv::Mat& imageIn, float mapScale, const MatchCallback& callback) const {
+        unique_ptr<MatchContext> context = acquireContext();
+        LmStatus status = findMatch(imageIn, mapScale, callback, *context);
+        releaseContext(std::move(context));
+        return status;
+    }
+
+    void LocationMatcher::prepareContext(const cv::Mat& imageIn, MatchContext& context) const {
+        // Everything allocated from the arena during the previous call is released here, after the buffers referring to it are emptied
+        context.segmentMatches.clear();
+        context.lines.clear();
+        context.arena.reset();
+
+        // Extract the lines from the image. The mask is only reallocated when the image size changes.
+        context.detectMask.create(imageIn.size(), CV_8UC1);
+        context.detectMask.setTo(Scalar(1));
+        context.lineDetector.detect(imageIn, context.lines, context.detectMask, context.detectedLines);
 
-        // Compare each segment extracted from the blueprints to the segments from the image
+        // Computed once and shared by the verification of every match
+        computeDistanceMap(imageIn, context.distanceMap, context.freeSpace);
+    }
+
+    // Lines of the image of one findMatch() call in metres, as segments and, in MAP_REPRESENTATION_LINE_GRAPH, as a graph. Each is only rebuilt when the scale changes, which can only happen between blueprints if mapScale is not given.
+    struct LocationMatcher::ImageLines {
+        ImageLines(pmr::memory_resource* resource) :
+            segments(resource),
+            graph(resource),
+            segmentsScale(0),
+            graphScale(0),
+            useIndex(false),
+            candidates(resource),
+            fingerprints(resource),
+            candidateRuns(resource) {
+
+        }
+
+        Segments segments;
+        LineGraph graph;
+        float segmentsScale;
+        float graphScale;
+
+        // Candidates of every blueprint from blueprintIndex_, sorted by blueprint id, if useIndex
+        bool useIndex;
+        pmr::vector<IndexCandidate> candidates;
+        pmr::vector<uint64_t> fingerprints;
+        pmr::vector<SegmentRun> candidateRuns;
+    };
+
+    void LocationMatcher::prepareImageLines(float mapScale, ImageLines& image, MatchContext& context) const {
+        // When every blueprint is compared with the image at the same scale, the image segments are built once and looked up in the shared index of all blueprint segments, instead of being compared with each blueprint in turn
+        image.useIndex = mapRepresentation_ == MAP_REPRESENTATION_SEGMENTS && !blueprints_.empty();
+        for (auto blueprintItr = blueprints_.cbegin(); image.useIndex && mapScale <= 0 && blueprintItr != blueprints_.cend(); blueprintItr++) {
+            image.useIndex = blueprintItr->second.scale == blueprints_.cbegin()->second.scale;
+        }
+        if (!image.useIndex) {
+            return;
+        }
+
+        finalizeIndex();
+        updateImageSegments(mapScale > 0 ? mapScale : blueprints_.cbegin()->second.scale, image, context);
+        blueprintIndex_.findCandidates(image.segments, thresholds_.lengthThreshold, image.candidates);
+        blueprintIndex_.fingerprint(image.segments, image.fingerprints);
+        blueprintIndex_.findRuns(image.segments, image.fingerprints, image.candidates.data(), image.candidates.data() + image.candidates.size(), thresholds_.lengthThreshold, context.matchCache, context.trieScratch, image.candidateRuns);
+    }
+
+    void LocationMatcher::updateImageSegments(float imageScale, ImageLines& image, MatchContext& context) const {
+        if (imageScale != image.segmentsScale) {
+            scaleKeyLines(context.lines, imageScale, context.metricLines);
+            image.segments.clear();
+            image.segments.addLines(context.metricLines, thresholds_);
+            image.segmentsScale = imageScale;
+        }
+    }
+
+    LmStatus LocationMatcher::matchBlueprint(
+        const string& name,
+        float mapScale,
+        chrono::steady_clock::time_point deadline,
+        const MatchCallback& callback,
+        ImageLines& image,
+        MatchContext& context,
+        int& numMatches,
+        bool& isStopped,
+        pmr::vector<BlueprintSample>& samples) const {
+
+        const Blueprint& blueprint = blueprints_.at(name);
+        const CompiledBlueprint& compiled = compiledBlueprints_.at(name);
+        const float imageScale = mapScale > 0 ? mapScale : blueprint.scale;
+        const bool hasDeadline = deadline != chrono::steady_clock::time_point::max();
+        auto blueprintStart = chrono::steady_clock::now();
+        const int numMatchesBefore = numMatches;
+        LmStatus status = LM_STATUS_OK;
+
+        // Extract matches between the image and the blueprint
+        vector<SegmentMatch>& matches = context.segmentMatches;
+        matches.clear();
+        if (mapRepresentation_ == MAP_REPRESENTATION_LINE_GRAPH) {
+            if (imageScale != image.graphScale) {
+                scaleKeyLines(context.lines, imageScale, context.metricLines);
+                image.graph.clear();
+                image.graph.addLines(context.metricLines, thresholds_);
+                image.graphScale = imageScale;
+            }
+            image.graph.matchSegments(compiled.segments, matches, thresholds_);
+        } else if (image.useIndex) {
+            // Candidates are sorted by blueprint id, so this blueprint's are a contiguous range
+            IndexCandidate key = {compiled.id, 0, 0, 0, 0};
+            auto blueprintCandidates = equal_range(image.candidates.cbegin(), image.candidates.cend(), key, [](const IndexCandidate& candidate1, const IndexCandidate& candidate2) {
+                return candidate1.blueprint < candidate2.blueprint;
+            });
+            blueprintIndex_.matchCandidates(image.segments, image.candidates.data() + (blueprintCandidates.first - image.candidates.cbegin()),
+                image.candidates.data() + (blueprintCandidates.second - image.candidates.cbegin()), image.candidateRuns, matches, thresholds_);
+        } else {
+            // Segments which have not changed since the last call with this context are looked up in the cache. The longest segments of the blueprint are compared first.
+            updateImageSegments(imageScale, image, context);
+            status = image.segments.matchSegments(compiled.segments, compiled.segmentOrder, matches, thresholds_, context.matchCache, deadline);
+        }
+
+        // Matches found before the deadline are verified until it passes
+        bool isComplete = status == LM_STATUS_OK;
+        for (auto matchItr = matches.begin(); matchItr != matches.end() && isComplete; matchItr++) {
+            if (hasDeadline && chrono::steady_clock::now() >= deadline) {
+                status = LM_STATUS_DEADLINE_EXCEEDED;
+                isComplete = false;
+                break;
+            }
+            if (matchItr->computeConfidence(context.distanceMap, compiled.chamfer, minCertainty_, 1 / imageScale) != LM_STATUS_OK) {
+                continue;
+            }
+
+            numMatches++;
+            isStopped = !callback(toBlueprintMatch(compiled.id, blueprint, *matchItr, blueprint.scale, 1 / imageScale));
+            if (isStopped || (maxMatches_ > 0 && numMatches >= maxMatches_)) {
+                isComplete = matchItr + 1 == matches.end();
+                break;
+            }
+        }
+
+        // A blueprint which was cut short only counts if it matched, and its cost is unknown
+        bool isHit = numMatches > numMatchesBefore;
+        if (isComplete || isHit) {
+            samples.push_back({&name, isHit, isComplete ? chrono::duration<double>(chrono::steady_clock::now() - blueprintStart).count() : -1});
+        }
+        return status;
+    }
+
+    LmStatus LocationMatcher::findMatch(const cv::Mat& imageIn, float mapScale, const MatchCallback& callback, MatchContext& context) const {
+        // The same ranked search as with a deadline, with a deadline which never passes
+        return findMatch(imageIn, mapScale, chrono::steady_clock::time_point::max(), callback, context);
+    }
+
+    LmStatus LocationMatcher::findMatch(const cv::Mat& imageIn, float mapScale, chrono::steady_clock::time_point deadline, std::vector<LocationMatch>& matchesOut) const {
+        unique_ptr<MatchContext> context = acquireContext();
+        LmStatus status = findMatch(imageIn, mapScale, deadline, matchesOut, *context);
+        releaseContext(std::move(context));
+        return status;
+    }
+
+    LmStatus LocationMatcher::findMatch(const cv::Mat& imageIn, float mapScale, chrono::steady_clock::time_point deadline, std::vector<LocationMatch>& matchesOut, MatchContext& context) const {
+        return findMatch(imageIn, mapScale, deadline, [&](const BlueprintMatch& match) {
+            matchesOut.push_back(toLocationMatch(match));
+            return true;
+        }, context);
+    }
+
+    LmStatus LocationMatcher::findMatch(const cv::Mat& imageIn, float mapScale, chrono::steady_clock::time_point deadline, const MatchCallback& callback) const {
+        unique_ptr<MatchContext> context = acquireContext();
+        LmStatus status = findMatch(imageIn, mapScale, deadline, callback, *context);
+        releaseContext(std::move(context));
+        return status;
+    }
+
+    LmStatus LocationMatcher::findMatch(const cv::Mat& imageIn, float mapScale, chrono::steady_clock::time_point deadline, const MatchCallback& callback, MatchContext& context) const {
+        prepareContext(imageIn, context);
+        ImageLines image(context.arena.resource());
+        prepareImageLines(mapScale, image, context);
+
+        // Rank the blueprints by expected matches per second: the fraction of their length which may match the image, times how often they have matched before, over how long they have taken to match. Only the summaries of the segments are compared, which is cheap next to matching.
+        // Segments are needed to rank the blueprints in either representation. Building them at a new scale is not cheap, so the deadline is also checked while ranking.
+        LmStatus status = LM_STATUS_OK;
+        pmr::vector<pair<double, double>> stats(context.arena.resource());
+        readStats(stats);
+        pmr::vector<pair<double, const string*>> ranking(context.arena.resource());
+        pmr::vector<BlueprintSample> samples(context.arena.resource());
         for (auto blueprintItr = blueprints_.cbegin(); blueprintItr != blueprints_.cend(); blueprintItr++) {
-            Segments blueprintSegments;
-            KeyLines blueprintLines;
+            if (chrono::steady_clock::now() >= deadline) {
+                status = LM_STATUS_DEADLINE_EXCEEDED;
+                break;
+            }
+
+            const CompiledBlueprint& compiled = compiledBlueprints_.at(blueprintItr->first);
+            updateImageSegments(mapScale > 0 ? mapScale : blueprintItr->second.scale, image, context);
+
+            float totalLength = 0;
+            for (auto segmentItr = compiled.segments.data().cbegin(); segmentItr != compiled.segments.data().cend(); segmentItr++) {
+                totalLength += (*segmentItr)->length();
+            }
+            float matchableLength = image.segments.matchableLength(compiled.segments, thresholds_.lengthThreshold);
+
+            // Segments cannot match a blueprint with nothing which may match. LineGraph can also match through junctions, so nothing is skipped for it.
+            if (matchableLength > 0 || mapRepresentation_ == MAP_REPRESENTATION_LINE_GRAPH) {
+                const pair<double, double>& blueprintStats = stats[compiled.id];
+                double matchableFraction = totalLength > 0 ? matchableLength / totalLength : 0;
+                ranking.push_back({matchableFraction * blueprintStats.first / (blueprintStats.second + BLUEPRINT_MIN_SECONDS), &blueprintItr->first});
+            } else {
+                samples.push_back({&blueprintItr->first, false, -1});
+            }
+        }
+        stable_sort(ranking.begin(), ranking.end(), [](const pair<double, const string*>& rank1, const pair<double, const string*>& rank2) {
+            return rank1.first > rank2.first;
+        });
+
+        int numMatches = 0;
+        bool isStopped = false;
+        for (auto rankItr = ranking.cbegin(); rankItr != ranking.cend() && status == LM_STATUS_OK && !isStopped && !(maxMatches_ > 0 && numMatches >= maxMatches_); rankItr++) {
+            if (chrono::steady_clock::now() >= deadline) {
+                status = LM_STATUS_DEADLINE_EXCEEDED;
+                break;
+            }
+            status = matchBlueprint(*rankItr->second, mapScale, deadline, callback, image, context, numMatches, isStopped, samples);
+        }
+
+        recordStats(samples);
+        return status;
+    }
+
+    map<string, BlueprintStats> LocationMatcher::blueprintStats() const {
+        lock_guard<mutex> lock(statsMutex_);
+        return stats_;
+    }
+
+    void LocationMatcher::resetStats() {
+        lock_guard<mutex> lock(statsMutex_);
+        stats_.clear();
+    }
+
+    void LocationMatcher::readStats(pmr::vector<pair<double, double>>& statsOut) const {
+        // Blueprints which have not been matched yet rank as a new BlueprintStats
+        const BlueprintStats newStats;
+        statsOut.assign(blueprintNames_.size(), {newStats.expectedHitRate(), newStats.averageSeconds});
+
+        lock_guard<mutex> lock(statsMutex_);
+        for (auto compiledItr = compiledBlueprints_.cbegin(); compiledItr != compiledBlueprints_.cend(); compiledItr++) {
+            auto statsItr = stats_.find(compiledItr->first);
+            if (statsItr != stats_.cend()) {
+                statsOut[compiledItr->second.id] = {statsItr->second.expectedHitRate(), statsItr->second.averageSeconds};
+            }
+        }
+    }
+
+    void LocationMatcher::recordStats(const pmr::vector<BlueprintSample>& samples) const {
+        lock_guard<mutex> lock(statsMutex_);
+        for (auto sampleItr = samples.cbegin(); sampleItr != samples.cend(); sampleItr++) {
+            BlueprintStats& blueprintStats = stats_[*sampleItr->name];
+            blueprintStats.numQueries++;
+            blueprintStats.numHits += sampleItr->isHit;
+            if (sampleItr->seconds >= 0) {
+                // The first sample is taken as is so the average does not start from 0
+                blueprintStats.averageSeconds = blueprintStats.numTimed == 0 ? sampleItr->seconds :
+                    blueprintStats.averageSeconds + BLUEPRINT_COST_SMOOTHING * (sampleItr->seconds - blueprintStats.averageSeconds);
+                blueprintStats.numTimed++;
+            }
+        }
+    }
+
+    LmStatus LocationMatcher::findMatch(const cv::Mat& imageIn, float mapScale, const std::vector<PosePrior>& priors, std::vector<LocationMatch>& matchesOut) const {
+        unique_ptr<MatchContext> context = acquireContext();
+        LmStatus status = findMatch(imageIn, mapScale, priors, matchesOut, *context);
+        releaseContext(std::move(context));
+        return status;
+    }
 
+    LmStatus LocationMatcher::findMatch(const cv::Mat& imageIn, float mapScale, const std::vector<PosePrior>& priors, std::vector<LocationMatch>& matchesOut, MatchContext& context) const {
+        return findMatch(imageIn, mapScale, priors, [&](const BlueprintMatch& match) {
+            matchesOut.push_back(toLocationMatch(match));
+            return true;
+        }, context);
+    }
+
+    LmStatus LocationMatcher::findMatch(const cv::Mat& imageIn, float mapScale, const std::vector<PosePrior>& priors, const MatchCallback& callback) const {
+        unique_ptr<MatchContext> context = acquireContext();
+        LmStatus status = findMatch(imageIn, mapScale, priors, callback, *context);
+        releaseContext(std::move(context));
+        return status;
+    }
+
+    LmStatus LocationMatcher::findMatch(const cv::Mat& imageIn, float mapScale, const std::vector<PosePrior>& priors, const MatchCallback& callback, MatchContext& context) const {
+        prepareContext(imageIn, context);
+
+        // Segments of the whole image and a grid of them, rebuilt only when the scale changes
+        Segments imageSegments(context.arena.resource());
+        SegmentGrid imageGrid(context.arena.resource());
+        float imageLinesScale = 0;
+
+        pmr::vector<int> nearbyIndexes(context.arena.resource());
+        pmr::vector<BlueprintSample> samples(context.arena.resource());
+        bool isStopped = false;
+        for (auto priorItr = priors.cbegin(); priorItr != priors.cend() && !isStopped; priorItr++) {
+            auto blueprintItr = blueprints_.find(priorItr->name);
+            if (blueprintItr == blueprints_.end()) {
+                continue;
+            }
             const Blueprint& blueprint = blueprintItr->second;
+            const CompiledBlueprint& compiled = compiledBlueprints_.at(blueprintItr->first);
+            auto blueprintStart = chrono::steady_clock::now();
+            int numMatches = 0;
+            bool isComplete = true;
 
-            lineDetector_.detect(blueprint.blueprintImg, blueprintLines);
-            blueprintSegments.addLines(blueprintLines);
+            float imageScale = mapScale > 0 ? mapScale : blueprint.scale;
+            if (imageScale != imageLinesScale) {
+                scaleKeyLines(context.lines, imageScale, context.metricLines);
+                imageSegments.clear();
+                imageSegments.addLines(context.metricLines, thresholds_);
+                imageGrid.build(imageSegments, PRIOR_GRID_CELL_SIZE);
+                imageLinesScale = imageScale;
+            }
 
-            // Extract matches between the two segments
-            vector<SegmentMatch> matches;
-            imageSegments.matchSegments(blueprintSegments, matches);
+            // The blueprint can be at any angle, so its footprint is the circle of its radius around any centroid within the uncertainty
+            Point2f priorPosition = priorItr->position * imageScale;
+            float reach = compiled.radius + priorItr->uncertainty;
+            nearbyIndexes.clear();
+            imageGrid.query(Rect2f(priorPosition.x - reach, priorPosition.y - reach, 2*reach, 2*reach), nearbyIndexes);
 
-            for (auto matchItr = matches.cbegin(); matchItr != matches.cend(); matchItr++) {
-                // Convert SegmentMatch format to LocationMatch format.
-                LocationMatch locationMatch = segmentMatchToLocationMatch(blueprint, *matchItr);
-                
-                matchesOut.push_back(locationMatch);
+            Segments nearbySegments(context.arena.resource());
+            imageSegments.subset(nearbyIndexes, nearbySegments);
+
+            vector<SegmentMatch>& matches = context.segmentMatches;
+            matches.clear();
+            if (mapRepresentation_ == MAP_REPRESENTATION_LINE_GRAPH) {
+                // The graph is built from the nearby lines only, so it may miss junctions with lines outside the footprint, which could not be part of a match anyway
+                KeyLines& nearbyLines = context.nearbyLines;
+                nearbyLines.clear();
+                for (auto segmentItr = nearbySegments.data().cbegin(); segmentItr != nearbySegments.data().cend(); segmentItr++) {
+                    for (auto lineItr = (*segmentItr)->data().cbegin(); lineItr != (*segmentItr)->data().cend(); lineItr++) {
+                        nearbyLines.push_back(lineItr->toKeyLine());
+                    }
+                }
+                LineGraph nearbyGraph(context.arena.resource());
+                nearbyGraph.addLines(nearbyLines, thresholds_);
+                nearbyGraph.matchSegments(compiled.segments, matches, thresholds_);
+            } else {
+                nearbySegments.matchSegments(compiled.segments, matches, thresholds_, context.matchCache);
             }
+
+            for (auto matchItr = matches.begin(); matchItr != matches.end(); matchItr++) {
+                if (matchItr->computeConfidence(context.distanceMap, compiled.chamfer, minCertainty_, 1 / imageScale) != LM_STATUS_OK) {
+                    continue;
+                }
+
+                BlueprintMatch blueprintMatch = toBlueprintMatch(compiled.id, blueprint, *matchItr, blueprint.scale, 1 / imageScale);
+                if (dist(blueprintMatch.position, priorItr->position) * imageScale > priorItr->uncertainty) {
+                    continue;
+                }
+                numMatches++;
+                if (!callback(blueprintMatch)) {
+                    isStopped = true;
+                    isComplete = matchItr + 1 == matches.end();
+                    break;
+                }
+            }
+
+            samples.push_back({&blueprintItr->first, numMatches > 0, isComplete ? chrono::duration<double>(chrono::steady_clock::now() - blueprintStart).count() : -1});
         }
+
+        recordStats(samples);
+        return LM_STATUS_OK;
+    }
+
+    unique_ptr<MatchContext> LocationMatcher::acquireContext() const {
+        {
+            lock_guard<mutex> lock(contextsMutex_);
+            if (!contexts_.empty()) {
+                unique_ptr<MatchContext> context = std::move(contexts_.back());
+                contexts_.pop_back();
+                return context;
+            }
+        }
+        return createContext();
+    }
+
+    void LocationMatcher::releaseContext(unique_ptr<MatchContext> context) const {
+        lock_guard<mutex> lock(contextsMutex_);
+        contexts_.push_back(std::move(context));
+    }
+
+    unique_ptr<MatchContext> LocationMatcher::createContext() const {
+        return unique_ptr<MatchContext>(new MatchContext(lineDetector_));
+    }
+
+    LmStatus LocationMatcher::filterMatches(const cv::Mat& mask, std::vector<LocationMatch>& matchesInOut) const {
+        return filterMatches(mask, 0, matchesInOut);
+    }
+
+    LmStatus LocationMatcher::filterMatches(const cv::Mat& mask, float mapScale, std::vector<LocationMatch>& matchesInOut) const {
+        // Explored pixels, packed once and shared by every match
+        OccupancyBitmap explored;
+        if (explored.fromMat(mask, 127) != LM_STATUS_OK) {
+            return LM_STATUS_ERROR_GENERIC;
+        }
+        return filterMatches(explored, mapScale, matchesInOut);
+    }
+
+    LmStatus LocationMatcher::filterMatches(const OccupancyBitmap& explored, float mapScale, std::vector<LocationMatch>& matchesInOut) const {
+        if (explored.empty()) {
+            return LM_STATUS_ERROR_GENERIC;
+        }
+
+        const int wallTolerance = 3;        // Half width in pixels of the box checked around each wall sample
+        const float maxFreeRatio = 0.2;     // Fraction of wall samples allowed to lie in explored space before a match is rejected
+        const int boxSize = 2*wallTolerance + 1;
+
+        auto isMatchValid = [&](const LocationMatch& match) {
+            auto blueprintItr = blueprints_.find(match.name);
+            if (blueprintItr == blueprints_.end()) {
+                // Nothing to check the match against
+                return true;
+            }
+            const Blueprint& blueprint = blueprintItr->second;
+            const KeyLines& lines = compiledBlueprints_.at(match.name).lines;
+
+            int numSamples = 0;
+            int numFree = 0;
+            for (auto lineItr = lines.cbegin(); lineItr != lines.cend(); lineItr++) {
+                Point2f start = blueprintToImage(blueprint, match, lineItr->getStartPoint(), mapScale);
+                Point2f end = blueprintToImage(blueprint, match, lineItr->getEndPoint(), mapScale);
+
+                // Sample the wall at intervals of one box so that each wall pixel is only checked once
+                int lineSamples = max(1, (int)ceil(dist(start, end) / boxSize));
+                for (int i = 0; i <= lineSamples; i++) {
+                    Point2f pt = start + (end - start) * ((float)i / lineSamples);
+                    Rect box(cvRound(pt.x) - wallTolerance, cvRound(pt.y) - wallTolerance, boxSize, boxSize);
+                    numSamples++;
+
+                    // Anything outside the image is unexplored, so a box which is not fully inside cannot be all free
+                    if (explored.isAllSet(box)) {
+                        numFree++;
+                    }
+                }
+            }
+
+            return numSamples == 0 || (float)numFree / numSamples <= maxFreeRatio;
+        };
+
+        auto newEnd = remove_if(matchesInOut.begin(), matchesInOut.end(), [&](const LocationMatch& match) {
+            return !isMatchValid(match);
+        });
+        matchesInOut.erase(newEnd, matchesInOut.end());
+
         return LM_STATUS_OK;
     }
 
     LmStatus LocationMatcher::addBlueprint(const Blueprint& blueprint) {
+        if (blueprint.scale <= 0) {
+            return LM_STATUS_ERROR_GENERIC;
+        }
+
+        CompiledBlueprint compiled;
+        compiled.id = blueprintId(blueprint.name);
+        if (compiled.id == -1) {
+            compiled.id = blueprintNames_.size();
+            blueprintNames_.push_back(blueprint.name);
+        }
+        lineDetector_.detect(blueprint.blueprintImg, compiled.lines);
+
+        KeyLines metricLines;
+        scaleKeyLines(compiled.lines, blueprint.scale, metricLines);
+        buildChamferModel(metricLines, CHAMFER_SAMPLE_STEP * blueprint.scale, compiled.chamfer);
+        compiled.segments.addLines(metricLines, thresholds_);
+        compiled.segments.findSymmetries(thresholds_);
+        compiled.segmentOrder = compiled.segments.orderByLength();
+
+        compiled.radius = 0;
+        Point2f metricCentroid = blueprint.centroid * blueprint.scale;
+        for (auto lineItr = metricLines.cbegin(); lineItr != metricLines.cend(); lineItr++) {
+            compiled.radius = max(compiled.radius, max(dist(metricCentroid, lineItr->getStartPoint()), dist(metricCentroid, lineItr->getEndPoint())));
+        }
+
+        // A new blueprint has the largest id so far, so it is appended to the index. A replaced one keeps its id, and its old segments must leave the index.
+        bool isReplaced = compiledBlueprints_.count(blueprint.name) > 0;
         blueprints_[blueprint.name] = blueprint;
+        compiledBlueprints_[blueprint.name] = compiled;
+        if (isReplaced) {
+            rebuildIndex();
+        } else {
+            lock_guard<mutex> lock(indexMutex_);
+            blueprintIndex_.add(compiled.id, compiledBlueprints_[blueprint.name].segments, thresholds_);
+        }
+
+        // Statistics of a blueprint which is replaced no longer apply
+        lock_guard<mutex> lock(statsMutex_);
+        stats_.erase(blueprint.name);
+        return LM_STATUS_OK;
+    }
+
+    int LocationMatcher::blueprintId(const std::string& name) const {
+        auto compiledItr = compiledBlueprints_.find(name);
+        return compiledItr == compiledBlueprints_.end() ? -1 : compiledItr->second.id;
+    }
+
+    const std::string& LocationMatcher::blueprintName(int blueprintId) const {
+        return blueprintNames_.at(blueprintId);
+    }
+
+    void LocationMatcher::setMinCertainty(double minCertainty) {
+        minCertainty_ = minCertainty;
+    }
+
+    void LocationMatcher::setThresholds(const MatchThresholds& thresholds) {
+        thresholds_ = thresholds;
+
+        // Blueprint segments are joined using the thresholds
+        for (auto compiledItr = compiledBlueprints_.begin(); compiledItr != compiledBlueprints_.end(); compiledItr++) {
+            KeyLines metricLines;
+            scaleKeyLines(compiledItr->second.lines, blueprints_.at(compiledItr->first).scale, metricLines);
+            compiledItr->second.segments.clear();
+            compiledItr->second.segments.addLines(metricLines, thresholds_);
+            compiledItr->second.segments.findSymmetries(thresholds_);
+            compiledItr->second.segmentOrder = compiledItr->second.segments.orderByLength();
+        }
+        rebuildIndex();
+    }
+
+    void LocationMatcher::rebuildIndex() {
+        // Index ids are the blueprintId() of the blueprints, added in ascending order
+        lock_guard<mutex> lock(indexMutex_);
+        blueprintIndex_.clear();
+        for (auto nameItr = blueprintNames_.cbegin(); nameItr != blueprintNames_.cend(); nameItr++) {
+            const CompiledBlueprint& compiled = compiledBlueprints_.at(*nameItr);
+            blueprintIndex_.add(compiled.id, compiled.segments, thresholds_);
+        }
+        blueprintIndex_.finalize();
+    }
+
+    void LocationMatcher::finalizeIndex() const {
+        lock_guard<mutex> lock(indexMutex_);
+        if (!blueprintIndex_.isFinalized()) {
+            blueprintIndex_.finalize();
+        }
+    }
+
+    void LocationMatcher::setMaxMatches(int maxMatches) {
+        maxMatches_ = maxMatches;
+    }
+
+    void LocationMatcher::setMapRepresentation(MapRepresentation mapRepresentation) {
+        mapRepresentation_ = mapRepresentation;
     }
 
     void LocationMatcher::drawMatch(cv::Mat img, const LocationMatch& match) const {
@@ -67,20 +618,40 @@ namespace lm {
     }
 
     LocationMatch LocationMatcher::segmentMatchToLocationMatch(const Blueprint& blueprint, const SegmentMatch& match) const {
-        // Convert SegmentMatch format to LocationMatch format.
-        LocationMatch locationMatch;
-        locationMatch.name = blueprint.name;
-        locationMatch.certainty = match.confidence;
-        locationMatch.angle = match.angleOffset;
+        BlueprintMatch blueprintMatch = toBlueprintMatch(-1, blueprint, match, 1, 1);
+        return {blueprint.name, blueprintMatch.position, blueprintMatch.angle, blueprintMatch.certainty};
+    }
+
+    LocationMatch LocationMatcher::segmentMatchToLocationMatch(const Blueprint& blueprint, const SegmentMatch& match, float mapScale) const {
+        BlueprintMatch blueprintMatch = toBlueprintMatch(-1, blueprint, match, blueprint.scale, 1 / mapScale);
+        return {blueprint.name, blueprintMatch.position, blueprintMatch.angle, blueprintMatch.certainty};
+    }
+
+    LocationMatch LocationMatcher::toLocationMatch(const BlueprintMatch& match) const {
+        return {blueprintName(match.blueprintId), match.position, match.angle, match.certainty};
+    }
+
+    BlueprintMatch LocationMatcher::toBlueprintMatch(int blueprintId, const Blueprint& blueprint, const SegmentMatch& match, float unitsPerBlueprintPixel, float imagePixelsPerUnit) const {
+        // Convert SegmentMatch format to BlueprintMatch format.
+        BlueprintMatch blueprintMatch;
+        blueprintMatch.blueprintId = blueprintId;
+        blueprintMatch.certainty = match.confidence;
+        // angleOffset rotates the image segment on to the blueprint segment; the blueprint is rotated the opposite way. angleDiff() keeps the result in (-pi, pi].
+        blueprintMatch.angle = angleDiff(0, match.angleOffset);
 
         // Get position of centroid in image from blueprint match position and blueprint centroid
-        KeyLine blueprintStartLine = match.segment2.data().front();
-        KeyLine imageStartLine = match.segment1.data().front();
-        Point2f lineToCentroid = blueprint.centroid - blueprintStartLine.pt;
-        lineToCentroid = rotateVector(lineToCentroid, locationMatch.angle);
+        const Line& blueprintStartLine = match.segment2.data().front();
+        const Line& imageStartLine = match.segment1.data().front();
+        Point2f lineToCentroid = blueprint.centroid * unitsPerBlueprintPixel - blueprintStartLine.pt;
+        lineToCentroid = rotateVector(lineToCentroid, blueprintMatch.angle);
         Point2f centroid = imageStartLine.pt + lineToCentroid;
-        locationMatch.position = centroid;
+        blueprintMatch.position = centroid * imagePixelsPerUnit;
+
+        return blueprintMatch;
+    }
 
-        return locationMatch;
+    cv::Point2f LocationMatcher::blueprintToImage(const Blueprint& blueprint, const LocationMatch& match, cv::Point2f pt, float mapScale) const {
+        float imagePixelsPerBlueprintPixel = mapScale > 0 ? blueprint.scale / mapScale : 1;
+        return match.position + rotateVector(pt - blueprint.centroid, match.angle) * imagePixelsPerBlueprintPixel;
     }
 }
@@ -0,0 +1,70 @@
+#include "location_matcher/match_cache.hpp"
+
+using namespace std;
+
+namespace lm {
+
+    MatchCache::MatchCache(size_t capacity) : capacity_(max<size_t>(capacity, 1)), numHits_(0), numMisses_(0) {
+
+    }
+
+    const pmr::vector<SegmentRun>* MatchCache::find(uint64_t mapFingerprint, uint64_t blueprintFingerprint) {
+        auto indexItr = index_.find({mapFingerprint, blueprintFingerprint});
+        if (indexItr == index_.end()) {
+            numMisses_++;
+            return nullptr;
+        }
+
+        numHits_++;
+        entries_.splice(entries_.begin(), entries_, indexItr->second);
+        return &indexItr->second->runs;
+    }
+
+    const pmr::vector<SegmentRun>& MatchCache::insert(uint64_t mapFingerprint, uint64_t blueprintFingerprint, const pmr::vector<SegmentRun>& runs) {
+        Key key = {mapFingerprint, blueprintFingerprint};
+        auto indexItr = index_.find(key);
+        if (indexItr != index_.end()) {
+            indexItr->second->runs.assign(runs.cbegin(), runs.cend());
+            entries_.splice(entries_.begin(), entries_, indexItr->second);
+            return entries_.front().runs;
+        }
+
+        if (entries_.size() >= capacity_) {
+            index_.erase(entries_.back().key);
+            entries_.pop_back();
+        }
+
+        entries_.push_front({key, pmr::vector<SegmentRun>(runs.cbegin(), runs.cend(), pmr::get_default_resource())});
+        index_[key] = entries_.begin();
+        return entries_.front().runs;
+    }
+
+    void MatchCache::clear() {
+        entries_.clear();
+        index_.clear();
+    }
+
+    size_t MatchCache::size() const {
+        return entries_.size();
+    }
+
+    size_t MatchCache::capacity() const {
+        return capacity_;
+    }
+
+    size_t MatchCache::numHits() const {
+        return numHits_;
+    }
+
+    size_t MatchCache::numMisses() const {
+        return numMisses_;
+    }
+
+    bool MatchCache::Key::operator==(const Key& other) const {
+        return mapFingerprint == other.mapFingerprint && blueprintFingerprint == other.blueprintFingerprint;
+    }
+
+    size_t MatchCache::KeyHash::operator()(const Key& key) const {
+        return key.mapFingerprint ^ (key.blueprintFingerprint * 0x9e3779b97f4a7c15ull);
+    }
+}
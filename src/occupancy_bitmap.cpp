@@ -0,0 +1,215 @@
+#include <cfloat>
+#include <cmath>
+
+#include "location_matcher/occupancy_bitmap.hpp"
+
+using namespace std;
+using namespace cv;
+
+namespace lm {
+
+    // Bits from to to inclusive of a word
+    static inline uint64_t rangeMask(int from, int to) {
+        return (~0ull << from) & (~0ull >> (63 - to));
+    }
+
+    // Narrows [xMin, xMax] to the x for which minValue <= a*x + b <= maxValue. Returns false if no x is left.
+    static inline bool clipToSlab(float a, float b, float minValue, float maxValue, float& xMin, float& xMax) {
+        if (abs(a) < 1e-6) {
+            return b >= minValue && b <= maxValue;
+        }
+        float x1 = (minValue - b) / a;
+        float x2 = (maxValue - b) / a;
+        xMin = max(xMin, min(x1, x2));
+        xMax = min(xMax, max(x1, x2));
+        return xMin <= xMax;
+    }
+
+    OccupancyBitmap::OccupancyBitmap() : rows_(0), cols_(0), wordsPerRow_(0) {
+
+    }
+
+    OccupancyBitmap::OccupancyBitmap(int rows, int cols) {
+        create(rows, cols);
+    }
+
+    void OccupancyBitmap::create(int rows, int cols) {
+        rows_ = max(rows, 0);
+        cols_ = max(cols, 0);
+        wordsPerRow_ = (cols_ + 63) / 64;
+        words_.assign(rows_ * wordsPerRow_, 0);
+    }
+
+    LmStatus OccupancyBitmap::fromMat(const Mat& img, int threshold, bool isInverted) {
+        if (img.empty() || img.type() != CV_8UC1) {
+            return LM_STATUS_ERROR_GENERIC;
+        }
+
+        create(img.rows, img.cols);
+        for (int y = 0; y < rows_; y++) {
+            const uchar* pixels = img.ptr<uchar>(y);
+            uint64_t* words = row(y);
+            for (int x = 0; x < cols_; x++) {
+                words[x / 64] |= (uint64_t)((pixels[x] > threshold) != isInverted) << (x % 64);
+            }
+        }
+        return LM_STATUS_OK;
+    }
+
+    LmStatus OccupancyBitmap::fromGrid(const int8_t* grid, int rows, int cols, int8_t minValue) {
+        if (grid == nullptr || rows <= 0 || cols <= 0) {
+            return LM_STATUS_ERROR_GENERIC;
+        }
+
+        create(rows, cols);
+        for (int y = 0; y < rows_; y++) {
+            const int8_t* cells = grid + y * cols_;
+            uint64_t* words = row(y);
+            for (int x = 0; x < cols_; x++) {
+                words[x / 64] |= (uint64_t)(cells[x] >= minValue) << (x % 64);
+            }
+        }
+        return LM_STATUS_OK;
+    }
+
+    void OccupancyBitmap::toMat(Mat& imgOut) const {
+        imgOut = Mat(rows_, cols_, CV_8UC1);
+        for (int y = 0; y < rows_; y++) {
+            uchar* pixels = imgOut.ptr<uchar>(y);
+            const uint64_t* words = row(y);
+            for (int x = 0; x < cols_; x++) {
+                pixels[x] = (words[x / 64] >> (x % 64)) & 1 ? 255 : 0;
+            }
+        }
+    }
+
+    int OccupancyBitmap::rows() const {
+        return rows_;
+    }
+
+    int OccupancyBitmap::cols() const {
+        return cols_;
+    }
+
+    bool OccupancyBitmap::empty() const {
+        return rows_ == 0 || cols_ == 0;
+    }
+
+    bool OccupancyBitmap::get(int x, int y) const {
+        return (row(y)[x / 64] >> (x % 64)) & 1;
+    }
+
+    void OccupancyBitmap::set(int x, int y) {
+        row(y)[x / 64] |= 1ull << (x % 64);
+    }
+
+    void OccupancyBitmap::setRange(int y, int xStart, int xEnd) {
+        xStart = max(xStart, 0);
+        xEnd = min(xEnd, cols_ - 1);
+        if (y < 0 || y >= rows_ || xStart > xEnd) {
+            return;
+        }
+
+        uint64_t* words = row(y);
+        const int wordStart = xStart / 64;
+        const int wordEnd = xEnd / 64;
+        for (int w = wordStart; w <= wordEnd; w++) {
+            words[w] |= rangeMask(w == wordStart ? xStart % 64 : 0, w == wordEnd ? xEnd % 64 : 63);
+        }
+    }
+
+    void OccupancyBitmap::fillLine(Point2f pt1, Point2f pt2, float radius) {
+        Point2f dir = pt2 - pt1;
+        float length = dist(pt1, pt2);
+        if (length > 0) {
+            dir /= length;
+        }
+        const Point2f normal(-dir.y, dir.x);
+
+        const int yStart = max((int)ceil(min(pt1.y, pt2.y) - radius), 0);
+        const int yEnd = min((int)floor(max(pt1.y, pt2.y) + radius), rows_ - 1);
+        for (int y = yStart; y <= yEnd; y++) {
+            // The shape is convex, so each row crosses it in one interval: the union of the intervals of the round ends and the band between them
+            float xMin = FLT_MAX;
+            float xMax = -FLT_MAX;
+            const Point2f ends[] = {pt1, pt2};
+            for (int i = 0; i < 2; i++) {
+                float dy = y - ends[i].y;
+                if (abs(dy) <= radius) {
+                    float dx = sqrt(radius*radius - dy*dy);
+                    xMin = min(xMin, ends[i].x - dx);
+                    xMax = max(xMax, ends[i].x + dx);
+                }
+            }
+
+            float bandMin = -FLT_MAX;
+            float bandMax = FLT_MAX;
+            if (length > 0 &&
+                clipToSlab(dir.x, dir.y * (y - pt1.y) - dir.x * pt1.x, 0, length, bandMin, bandMax) &&
+                clipToSlab(normal.x, normal.y * (y - pt1.y) - normal.x * pt1.x, -radius, radius, bandMin, bandMax)) {
+                xMin = min(xMin, bandMin);
+                xMax = max(xMax, bandMax);
+            }
+
+            if (xMin <= xMax) {
+                setRange(y, (int)ceil(max(xMin, -1.0f)), (int)floor(min(xMax, (float)cols_)));
+            }
+        }
+    }
+
+    LmStatus OccupancyBitmap::andWith(const OccupancyBitmap& other) {
+        if (other.rows_ != rows_ || other.cols_ != cols_) {
+            return LM_STATUS_SIZE_MISMATCH;
+        }
+        for (int i = 0; i < words_.size(); i++) {
+            words_[i] &= other.words_[i];
+        }
+        return LM_STATUS_OK;
+    }
+
+    LmStatus OccupancyBitmap::orWith(const OccupancyBitmap& other) {
+        if (other.rows_ != rows_ || other.cols_ != cols_) {
+            return LM_STATUS_SIZE_MISMATCH;
+        }
+        for (int i = 0; i < words_.size(); i++) {
+            words_[i] |= other.words_[i];
+        }
+        return LM_STATUS_OK;
+    }
+
+    int OccupancyBitmap::count() const {
+        int numSet = 0;
+        for (int i = 0; i < words_.size(); i++) {
+            numSet += __builtin_popcountll(words_[i]);
+        }
+        return numSet;
+    }
+
+    bool OccupancyBitmap::isAllSet(const Rect& box) const {
+        if (box.width <= 0 || box.height <= 0 || box.x < 0 || box.y < 0 || box.x + box.width > cols_ || box.y + box.height > rows_) {
+            return false;
+        }
+
+        const int xEnd = box.x + box.width - 1;
+        const int wordStart = box.x / 64;
+        const int wordEnd = xEnd / 64;
+        for (int y = box.y; y < box.y + box.height; y++) {
+            const uint64_t* words = row(y);
+            for (int w = wordStart; w <= wordEnd; w++) {
+                uint64_t mask = rangeMask(w == wordStart ? box.x % 64 : 0, w == wordEnd ? xEnd % 64 : 63);
+                if ((words[w] & mask) != mask) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    uint64_t* OccupancyBitmap::row(int y) {
+        return words_.data() + y * wordsPerRow_;
+    }
+
+    const uint64_t* OccupancyBitmap::row(int y) const {
+        return words_.data() + y * wordsPerRow_;
+    }
+}
@@ -1,4 +1,5 @@
 #include "location_matcher/segment.hpp"
+#include "location_matcher/match_cache.hpp"
 
 using namespace std;
 using namespace cv;
@@ -6,200 +7,281 @@ using namespace cv::line_descriptor;
 
 namespace lm {
 
-    float compareLines(const cv::line_descriptor::KeyLine& line1, const cv::line_descriptor::KeyLine& line2, bool angleInvariant) {
-        const float lengthThreshold = 11;
+    float compareLines(const Line& line1, const Line& line2, bool angleInvariant, float lengthThreshold) {
         const float angleThreshold = M_PI * 10/180;
 
-        float angleWeight = angleInvariant ? 1.0f : max(0.0f, 1 - abs(angleDiff(line1.angle, line2.angle))/angleThreshold);
+        float angleWeight = angleInvariant ? 1.0f : max(0.0f, 1 - abs(fastAngleDiff(line1.angle, line2.angle))/angleThreshold);
 
-        float lengthWeight = max(0.0f, 1 - abs(line1.lineLength - line2.lineLength)/lengthThreshold);
+        float lengthWeight = compareLengths(line1.lineLength, line2.lineLength, lengthThreshold);
 
         return angleWeight * lengthWeight;
     }
 
+    MatchThresholds::MatchThresholds() : 
+        angleThreshold(M_PI * 5/180), 
+        positionThreshold(5), 
+        lengthThreshold(11), 
+        joinDistThreshold(5), 
+        directionDistThreshold(10) {
+
+    }
+
     // ######### SegmentMatch ############
-    float SegmentMatch::angleThreshold = M_PI * 5/180;
-    float SegmentMatch::positionThreshold = 5;
 
-    SegmentMatch::SegmentMatch() {
+    SegmentMatch::SegmentMatch() : confidence(0) {
         
     }
 
-    SegmentMatch::SegmentMatch(Segment seg1, int startIndex1, int endIndex1, Segment seg2, int startIndex2, int endIndex2) {
+    SegmentMatch::SegmentMatch(const Segment& seg1, int startIndex1, int endIndex1, const Segment& seg2, int startIndex2, int endIndex2, pmr::memory_resource* resource) : 
+        segment1(seg1, startIndex1, endIndex1, resource ? resource : seg1.data().get_allocator().resource()), 
+        segment2(seg2, startIndex2, endIndex2, resource ? resource : seg2.data().get_allocator().resource()), 
+        confidence(0) {
         
-        segment1 = Segment(seg1, startIndex1, endIndex1);
         segment1Index[0] = min(startIndex1, endIndex1);
         segment1Index[1] = max(startIndex1, endIndex1);
-        segment2 = Segment(seg2, startIndex2, endIndex2);
         segment2Index[0] = min(startIndex2, endIndex2);
         segment2Index[1] = max(startIndex2, endIndex2);
     }
 
-    LmStatus SegmentMatch::computeOffsets() {
-        if (segment1.data_.size() != segment2.data_.size()) {
-            return LM_STATUS_SIZE_MISMATCH;
+    // Pointers to the lines of data from startIndex to endIndex inclusive, in that order, which is backwards if endIndex < startIndex. The same lines as Segment(segment, startIndex, endIndex) without copying them.
+    static void gatherLines(const pmr::list<Line>& data, int startIndex, int endIndex, pmr::vector<const Line*>& linesOut) {
+        int beginIndex = min(startIndex, endIndex);
+        auto lineItr = next(data.cbegin(), beginIndex);
+        for (int i = beginIndex; i <= max(startIndex, endIndex); i++, lineItr++) {
+            linesOut.push_back(&*lineItr);
         }
+        if (endIndex < startIndex) {
+            reverse(linesOut.begin(), linesOut.end());
+        }
+    }
 
-        LmStatus status = LM_STATUS_OK;
-        int segmentSize = segment1.data_.size();
+    // Body of SegmentMatch::computeOffsets() on the lines of the two segments. lines1 and lines2 must be the same size.
+    // If stopEarly is set, returns LM_STATUS_ERROR_MATCH_FAILED as soon as the result is known to fail, and the offsets are only complete when LM_STATUS_OK is returned. Otherwise the offsets are always computed.
+    static LmStatus estimateOffsets(const pmr::vector<const Line*>& lines1, const pmr::vector<const Line*>& lines2, const MatchThresholds& thresholds, bool stopEarly, float& angleOffsetOut, Point2f& positionOffsetOut) {
+        const float angleThreshold = thresholds.angleThreshold;
+        const float positionThreshold = thresholds.positionThreshold;
 
-        auto pLine1 = segment1.data_.cbegin();
-        auto pLine2 = segment2.data_.cbegin();
+        LmStatus status = LM_STATUS_OK;
+        int segmentSize = lines1.size();
+        pmr::memory_resource* resource = lines1.get_allocator().resource();
 
         // ### Angle calculations ###
-        // Mean angle by turning angles to vectors on the unit circle
-        vector<Point2f> angles;
-        Point2f prevPt1 = (pLine1++)->pt;
-        Point2f prevPt2 = (pLine2++)->pt;
-        while (pLine1 != segment1.data_.cend()) {
+        // The angles are gathered into arrays and computed in batches with the approximations from angle_math.hpp
+        const int numTurns = segmentSize - 1;
+        pmr::vector<float> vec1X(numTurns, resource), vec1Y(numTurns, resource);
+        pmr::vector<float> vec2X(numTurns, resource), vec2Y(numTurns, resource);
+        for (int i = 0; i < numTurns; i++) {
             // Get the vector from previous point to this point
-            Point2f vec1 = (pLine1++)->pt - prevPt1;
-            Point2f vec2 = (pLine2++)->pt - prevPt2;
-
-            // Normalize vectors
-            float angle1 = atan2(vec1.y, vec1.x);
-            float angle2 = atan2(vec2.y, vec2.x);
-            float angleDiff = angle2 - angle1;
-
-            Point2f angleVec(cos(angleDiff), sin(angleDiff));
-
-            angles.push_back(angleVec);
+            Point2f vec1 = lines1[i + 1]->pt - lines1[i]->pt;
+            Point2f vec2 = lines2[i + 1]->pt - lines2[i]->pt;
+            vec1X[i] = vec1.x;
+            vec1Y[i] = vec1.y;
+            vec2X[i] = vec2.x;
+            vec2Y[i] = vec2.y;
         }
 
-        Point2f meanAngleVec = accumulate(angles.begin(), angles.end(), Point2f(0.0,0.0))/(segmentSize-1);
+        // Angle between each pair of vectors, wrapped to [-pi, pi)
+        pmr::vector<float> vecAngles1(numTurns, resource), vecAngles2(numTurns, resource), angleDiffs(numTurns, resource);
+        atan2Batch(vec1Y.data(), vec1X.data(), vecAngles1.data(), numTurns);
+        atan2Batch(vec2Y.data(), vec2X.data(), vecAngles2.data(), numTurns);
+        angleDiffBatch(vecAngles2.data(), vecAngles1.data(), angleDiffs.data(), numTurns);
+
+        // Mean angle by turning angles to vectors on the unit circle
+        pmr::vector<float> angleSins(numTurns, resource), angleCoss(numTurns, resource);
+        sinCosBatch(angleDiffs.data(), angleSins.data(), angleCoss.data(), numTurns);
+        Point2f meanAngleVec(accumulate(angleCoss.begin(), angleCoss.end(), 0.0f), accumulate(angleSins.begin(), angleSins.end(), 0.0f));
+        meanAngleVec /= numTurns;
 
         float meanAngle;
         // Check for whether the meanAngleVec is significant
         if (dist(meanAngleVec, Point2f(0,0)) < 0.1) {
             meanAngle = 0;
         } else {
-            meanAngle = atan2(meanAngleVec.y, meanAngleVec.x);
+            meanAngle = fastAtan2(meanAngleVec.y, meanAngleVec.x);
         }
-        angleOffset = meanAngle;
+        angleOffsetOut = meanAngle;
+
+        // Make an extra check to catch the edge case that we are looking at a segment which is symmetrical and flipped. Check that the 360deg angle of line 2 and line 1 matches the calculated angle offset
+        // Returns the angle of the line from the the previous point to the point connected to the next line
+        auto getLineAngle = [&thresholds] (const Line& line1, const Line& line2) {
+            LineJoint lj = isJoinedTo(line1, line2, thresholds.directionDistThreshold);
+            
+            float angle1;
+            Point2f lineVec;
+            if (lj & (1<<LINE_JOINT_1)) {
+                // End of line1 is joined to line2
+                lineVec = line1.getEndPoint() - line1.getStartPoint();
+            } else {
+                // Start of line1 is joined to line2
+                lineVec = line1.getStartPoint() - line1.getEndPoint();
+            }
+            angle1 = fastAtan2(lineVec.y, lineVec.x);
 
-        // Variance and std deviation
-        auto angleVarianceFunc = [meanAngle] (float accumulator, Point2f angleVec){
-            float angle = atan2(angleVec.y, angleVec.x);
-            float x = angleDiff(angle, meanAngle, M_PI);
-            return accumulator + x*x;
+            return angle1;
         };
 
-        float varianceSum = accumulate(angles.begin(), angles.end(), 0.0f, angleVarianceFunc);
+        // It only needs the first two lines, so it is the cheapest check to fail on
+        if (segmentSize >= 2) {
+            float angle1 = getLineAngle(*lines1[0], *lines1[1]);
+            float angle2 = getLineAngle(*lines2[0], *lines2[1]);
+            if (abs(fastAngleDiff(angle2-angle1, angleOffsetOut)) > angleThreshold) {
+                status = LM_STATUS_ERROR_MATCH_FAILED;
+                if (stopEarly) {
+                    return status;
+                }
+            }
+        }
+
+        // Variance and std deviation. The sum only grows, so the match has failed once the std deviation of the turns so far reaches the threshold.
+        float varianceSum = 0;
+        for (int i = 0; i < numTurns; i++) {
+            float x = fastAngleDiff(angleDiffs[i], meanAngle, M_PI);
+            varianceSum += x*x;
+            if (stopEarly && sqrt(varianceSum/(segmentSize - 1)) >= angleThreshold) {
+                return LM_STATUS_ERROR_MATCH_FAILED;
+            }
+        }
 
         float angleVariance = varianceSum/(segmentSize - 1);
         float angleStdDev = sqrt(angleVariance);
 
         // Also check the std deviation of the raw angles separately because the above won't catch symmetrical cases.
-        pLine1 = segment1.data_.cbegin();
-        pLine2 = segment2.data_.cbegin();
-        float angleSum = 0;
-        while (pLine1 != segment1.data_.cend()) {
-            float angle1 = wrappi((pLine1++)->angle);
-            float angle2 = wrappi((pLine2++)->angle);
-            angleSum += angleDiff(angle2, angle1, M_PI);
+        pmr::vector<float> lineAngles1(resource), lineAngles2(resource), lineAngleDiffs(segmentSize, resource);
+        lineAngles1.reserve(segmentSize);
+        lineAngles2.reserve(segmentSize);
+        for (int i = 0; i < segmentSize; i++) {
+            lineAngles1.push_back(lines1[i]->angle);
+            lineAngles2.push_back(lines2[i]->angle);
         }
+        // Lines have no direction here, so angles are compared modulo pi
+        angleDiffBatch(lineAngles2.data(), lineAngles1.data(), lineAngleDiffs.data(), segmentSize, M_PI);
+
+        float angleSum = accumulate(lineAngleDiffs.begin(), lineAngleDiffs.end(), 0.0f);
         float meanAngleCheck = angleSum/segmentSize;
 
-        pLine1 = segment1.data_.cbegin();
-        pLine2 = segment2.data_.cbegin();
         float varianceCheckSum = 0;
-        while (pLine1 != segment1.data_.cend()) {
-            float angle1 = wrappi((pLine1++)->angle);
-            float angle2 = wrappi((pLine2++)->angle);
-            varianceCheckSum += angleDiff(angle2 - angle1, meanAngleCheck, M_PI);
+        for (int i = 0; i < segmentSize; i++) {
+            varianceCheckSum += fastAngleDiff(lineAngleDiffs[i], meanAngleCheck, M_PI);
         }
         float varianceCheck = varianceCheckSum/(segmentSize-1);
         float angleStdDevCheck = sqrt(varianceCheck);
 
         angleStdDev = max(angleStdDev, angleStdDevCheck);
+        if (stopEarly && angleStdDev >= angleThreshold) {
+            return LM_STATUS_ERROR_MATCH_FAILED;
+        }
 
         // Get the position offset (naive aprproach)
         // 1. Normalize the position vector of each line by doing it WRT the first line in the segment. This makes it translation invariant.
-        vector<Point2f> displacements;
-
-        pLine1 = segment1.data_.cbegin();
-        pLine2 = segment2.data_.cbegin();
-        Point2f line1Pos = pLine1->pt;
-        Point2f line2Pos = pLine2->pt;
-        pLine1++;
-        pLine2++;
-        while (pLine1 != segment1.data_.cend()) {
-            Point2f d1 = (pLine1->pt - line1Pos);
-            Point2f d2 = (pLine2->pt - line2Pos);
+        pmr::vector<Point2f> displacements(resource);
 
-            // 2. Use the angle offset to rotate each position vector so that their rotations should match. This makes it rotation invariant.
-            d1 = Point2f(  d1.x*cos(angleOffset) + d1.y*-sin(angleOffset),
-                            d1.x*sin(angleOffset) + d1.y*cos(angleOffset));
-            displacements.push_back(d2 - d1);
+        float sinOffset, cosOffset;
+        fastSinCos(angleOffsetOut, sinOffset, cosOffset);
 
-            // Get mirrored displacements by mirroring one segment, ie switching y = x and rotating 180deg
-            d2 = Point2f(-d2.y, -d2.x);
+        Point2f line1Pos = lines1[0]->pt;
+        Point2f line2Pos = lines2[0]->pt;
+        float totalPositionVariance = 0;
+        for (int i = 1; i < segmentSize; i++) {
+            Point2f d1 = (lines1[i]->pt - line1Pos);
+            Point2f d2 = (lines2[i]->pt - line2Pos);
 
-            pLine1++;
-            pLine2++;
+            // 2. Use the angle offset to rotate each position vector so that their rotations should match. This makes it rotation invariant.
+            d1 = Point2f(  d1.x*cosOffset + d1.y*-sinOffset,
+                            d1.x*sinOffset + d1.y*cosOffset);
+            Point2f displacement = d2 - d1;
+            displacements.push_back(displacement);
+
+            // 4. validity check based on std dev of displacements, which like the angle sum only grows
+            totalPositionVariance = totalPositionVariance + displacement.x*displacement.x + displacement.y*displacement.y;
+            if (stopEarly && sqrt(totalPositionVariance/(segmentSize-1)) >= positionThreshold) {
+                return LM_STATUS_ERROR_MATCH_FAILED;
+            }
         }
 
         // 3. Take an average of the displacement vector from each line in segment1 to the corresponding line in segment2
         Point2f avgDisplacement = accumulate(displacements.begin(), displacements.end(), Point2f(0, 0))/(segmentSize-1);
-        // 4. validity check based on std dev of displacements
-        // Calculate variance
-        float totalPositionVariance = accumulate(displacements.begin(), displacements.end(), 0.0f, [](float accumulator, Point2f pt) {
-            return accumulator + pt.x*pt.x + pt.y*pt.y;
-        });
 
         float positionVariance = totalPositionVariance/(segmentSize-1);
 
         float positionStdDev = sqrt(positionVariance);
 
-        positionOffset = avgDisplacement + line2Pos - line1Pos;
+        positionOffsetOut = avgDisplacement + line2Pos - line1Pos;
 
         if (angleStdDev >= angleThreshold || positionStdDev >= positionThreshold) {
             status = LM_STATUS_ERROR_MATCH_FAILED;
         }
 
-        // Make an extra check to catch the edge case that we are looking at a segment which is symmetrical and flipped. Check that the 360deg angle of line 2 and line 1 matches the calculated angle offset
-        // Returns the angle of the line from the the previous point to the point connected to the next line
-        auto getLineAngle = [] (Segment::segment_t::const_iterator pLine) {
-            const KeyLine line1 = *(pLine++);
-            const KeyLine line2 = *(pLine++);
-            LineJoint lj = isJoinedTo(line1, line2, 10);
-            
-            float angle1;
-            Point2f lineVec;
-            if (lj & (1<<LINE_JOINT_1)) {
-                // End of line1 is joined to line2
-                lineVec = line1.getEndPoint() - line1.getStartPoint();
-            } else {
-                // Start of line1 is joined to line2
-                lineVec = line1.getStartPoint() - line1.getEndPoint();
-            }
-            angle1 = atan2(lineVec.y, lineVec.x);
+        return status;
+    }
 
-            return angle1;
-        };
+    LmStatus SegmentMatch::computeOffsets(const MatchThresholds& thresholds) {
+        if (segment1.data_.size() != segment2.data_.size() || segment1.data_.empty()) {
+            return LM_STATUS_SIZE_MISMATCH;
+        }
 
-        auto pLine = segment1.data().cbegin();
-        float angle1 = getLineAngle(pLine);
-        pLine = segment2.data().cbegin();
-        float angle2 = getLineAngle(pLine);
-        if (abs(angleDiff(angle2-angle1, angleOffset)) > angleThreshold) {
-            status = LM_STATUS_ERROR_MATCH_FAILED;
+        pmr::memory_resource* resource = segment1.data_.get_allocator().resource();
+        pmr::vector<const Line*> lines1(resource), lines2(resource);
+        gatherLines(segment1.data_, 0, segment1.data_.size() - 1, lines1);
+        gatherLines(segment2.data_, 0, segment2.data_.size() - 1, lines2);
+        return estimateOffsets(lines1, lines2, thresholds, false, angleOffset, positionOffset);
+    }
+
+    LmStatus SegmentMatch::computeOffsets(const Segment& segment1, const Segment& segment2, const SegmentRun& run, const MatchThresholds& thresholds, float& angleOffsetOut, Point2f& positionOffsetOut) {
+        if (abs(run.endIndex1 - run.startIndex1) != abs(run.endIndex2 - run.startIndex2)) {
+            return LM_STATUS_SIZE_MISMATCH;
         }
 
-        return status;
+        pmr::memory_resource* resource = segment1.data_.get_allocator().resource();
+        pmr::vector<const Line*> lines1(resource), lines2(resource);
+        gatherLines(segment1.data_, run.startIndex1, run.endIndex1, lines1);
+        gatherLines(segment2.data_, run.startIndex2, run.endIndex2, lines2);
+        return estimateOffsets(lines1, lines2, thresholds, true, angleOffsetOut, positionOffsetOut);
+    }
+
+    LmStatus SegmentMatch::computeConfidence(const cv::Mat& distanceMap, const ChamferModel& blueprintModel, float minConfidence, float pixelsPerUnit) {
+        if (segment1.data_.empty() || segment2.data_.empty()) {
+            return LM_STATUS_ERROR_GENERIC;
+        }
+
+        // angleOffset rotates segment1 on to segment2, so the blueprint is rotated by -angleOffset to be placed in the map
+        Point2f blueprintOrigin = segment2.data_.front().pt;
+        Point2f mapOrigin = segment1.data_.front().pt;
+        confidence = chamferScore(blueprintModel, distanceMap, blueprintOrigin, mapOrigin, -angleOffset, CHAMFER_MAX_DISTANCE, minConfidence, pixelsPerUnit);
+
+        return confidence >= minConfidence ? LM_STATUS_OK : LM_STATUS_ERROR_MATCH_FAILED;
+    }
+
+    void SegmentMatch::setSymmetricOffsets(const SegmentMatch& match, Point2f symmetryCentre) {
+        // match maps p to R*p + t. Turning its result by half a turn about the centre c maps p to -R*p + 2c - t, and positionOffset is t + R*l - l for the first line l of segment1, which both matches share.
+        angleOffset = fastWrap(match.angleOffset + M_PI);
+        positionOffset = 2 * (symmetryCentre - segment1.data_.front().pt) - match.positionOffset;
     }
 
     // ################### SEGMENT ###################
 
-    Segment::Segment() {
+    Segment::Segment(pmr::memory_resource* resource) : data_(resource), sortedLengths_(resource), sortedIndexes_(resource), isSummarised_(false), isSymmetric_(false) {
         
     }
 
-    Segment::Segment(const cv::line_descriptor::KeyLine& line) {
+    Segment::Segment(const Line& line, pmr::memory_resource* resource) : data_(resource), sortedLengths_(resource), sortedIndexes_(resource), isSummarised_(false), isSymmetric_(false) {
         data_.push_back(line);
     }
 
-    Segment::Segment(const Segment& segment, int beginIndex, int endIndex) {
+    Segment::Segment(const Segment& other) : 
+        data_(other.data_, other.data_.get_allocator()), 
+        sortedLengths_(other.sortedLengths_, other.sortedLengths_.get_allocator()),
+        sortedIndexes_(other.sortedIndexes_, other.sortedIndexes_.get_allocator()),
+        isSummarised_(other.isSummarised_),
+        isSymmetric_(other.isSymmetric_),
+        symmetryCentre_(other.symmetryCentre_) {
+
+    }
+
+    Segment::Segment(const Segment& segment, int beginIndex, int endIndex) : Segment(segment, beginIndex, endIndex, segment.data_.get_allocator().resource()) {
+
+    }
+
+    Segment::Segment(const Segment& segment, int beginIndex, int endIndex, pmr::memory_resource* resource) : data_(resource), sortedLengths_(resource), sortedIndexes_(resource), isSummarised_(false), isSymmetric_(false) {
         bool reverse = false;
         if (endIndex < beginIndex) {
             int temp = beginIndex;
@@ -223,12 +305,15 @@ namespace lm {
         }
     }
 
-    LmStatus Segment::join(Segment& other) {
-        SegmentJoint jointType = isJoinedTo(other);
+    LmStatus Segment::join(Segment& other, float connectionDistThresh) {
+        SegmentJoint jointType = isJoinedTo(other, connectionDistThresh);
 
         if (jointType == SEGMENT_JOINT_NONE) {
             return LM_STATUS_ERROR_LINES_UNCONNECTED;
         }
+        isSymmetric_ = false;
+        isSummarised_ = false;
+        other.isSummarised_ = false;
 
         // We want to append the start of the other segment to the end of this one. We force this by reversing the lists.
         if (!(jointType & 1 << SEGMENT_JOINT_1)) {
@@ -240,19 +325,22 @@ namespace lm {
             other.data_.reverse();
         }
 
-        // other.data_ is moved to this->data_ and other.data_ is emptied
-        data_.splice(data_.end(), other.data_);
+        // other.data_ is moved to this->data_ and other.data_ is emptied. Nodes can only be spliced between lists sharing a memory resource.
+        if (data_.get_allocator() == other.data_.get_allocator()) {
+            data_.splice(data_.end(), other.data_);
+        } else {
+            data_.insert(data_.end(), other.data_.cbegin(), other.data_.cend());
+            other.data_.clear();
+        }
         return LM_STATUS_OK;
     }
 
-    SegmentJoint Segment::isJoinedTo(const Segment& other) const {
+    SegmentJoint Segment::isJoinedTo(const Segment& other, float connectionDistThresh) const {
         bool reverseSelf = false;
         bool reverseOther = false;
 
-        const float connectionDistThresh = 5;
-
-        const KeyLine thisSegmentEnds[2] = {data_.front(), data_.back()};
-        const KeyLine otherSegmentEnds[2] = {other.data_.front(), (other.data_.back())};
+        const Line thisSegmentEnds[2] = {data_.front(), data_.back()};
+        const Line otherSegmentEnds[2] = {other.data_.front(), (other.data_.back())};
 
         for (int i = 0; i < 2; i++) {
             for (int j = 0; j < 2; j++) {
@@ -269,93 +357,131 @@ namespace lm {
     }
 
     template <typename Iterator>
-    void getMatchIndexes(Iterator thisBegin, Iterator thisEnd, Iterator otherBegin, Iterator otherEnd, Mat likenessMatrix, bool angleInvariant=false) {
+    void getMatchIndexes(Iterator thisBegin, Iterator thisEnd, Iterator otherBegin, Iterator otherEnd, Mat likenessMatrix, float lengthThreshold, bool angleInvariant=false) {
         int i = 0;
         int j = 0;
         for (auto thisLineItr = thisBegin; thisLineItr != thisEnd; thisLineItr++) {
             j = 0;
             for (auto otherLineItr = otherBegin; otherLineItr != otherEnd; otherLineItr++) {
-                likenessMatrix.at<float>(i, j) = compareLines(*thisLineItr, *otherLineItr, angleInvariant);
+                likenessMatrix.at<float>(i, j) = compareLines(*thisLineItr, *otherLineItr, angleInvariant, lengthThreshold);
                 j++;
             }
             i++;
         }
     }
 
-    void Segment::findMatchesInDiag(Mat likenessMatrix, Point2i startIndex, Point2i incrementIndex, float likenessThreshold, const Segment& other, vector<SegmentMatch>& matches) const {
-        Point2i prevMatch, currIndex, prevIndex;
-        int numRows = likenessMatrix.rows;
-        int numCols = likenessMatrix.cols;
-        int matchLength = 0;
-        int minMatchLength = 2;
+    cv::Mat Segment::likenessMatrix(const Segment& other, float lengthThreshold) const {
+        Mat likeness(data_.size(), other.data_.size(), CV_32FC1);
+        getMatchIndexes(data_.cbegin(), data_.cend(), other.data_.cbegin(), other.data_.cend(), likeness, lengthThreshold, true);
+        return likeness;
+    }
 
-        currIndex = startIndex;
-        while ( currIndex.y >= 0 && currIndex.y < numCols && 
-            currIndex.x >= 0 && currIndex.x < numRows) {
-            if (likenessMatrix.at<float>(currIndex) >= likenessThreshold) {
-                if (matchLength == 0) {
-                    prevMatch = currIndex;
-                }
-                matchLength++;
-            } else {
-                if (matchLength >= minMatchLength) {
-                    // Matches for current segment ended. Create a segment from prevMatch to prevIndex
-                    SegmentMatch newMatch(*this, prevMatch.x, prevIndex.x, other, prevMatch.y, prevIndex.y);
-                    if (newMatch.computeOffsets() == LM_STATUS_OK) {
-                        matches.push_back(newMatch);
-                    }
-                }
-                matchLength = 0;
-            }
-            prevIndex = currIndex;
-            currIndex += incrementIndex;
-        }
+    // Word w of a row of bits shifted by numBits, 1 to 63, towards bit 0, so that bit j holds bit j+numBits
+    static inline uint64_t shiftDown(const uint64_t* row, int w, int numWords, int numBits = 1) {
+        return (row[w] >> numBits) | (w + 1 < numWords ? row[w + 1] << (64 - numBits) : 0);
+    }
 
-        if (matchLength >= minMatchLength) {
-            // Matches for current segment ended. Create a segment from prevMatch to prevIndex
-            SegmentMatch newMatch(*this, prevMatch.x, prevIndex.x, other, prevMatch.y, prevIndex.y);
-            if (newMatch.computeOffsets() == LM_STATUS_OK) {
-                matches.push_back(newMatch);
-            }
-        }
+    // Word w of a row of bits shifted by numBits, 1 to 63, away from bit 0, so that bit j holds bit j-numBits
+    static inline uint64_t shiftUp(const uint64_t* row, int w, int numBits = 1) {
+        return (row[w] << numBits) | (w > 0 ? row[w - 1] >> (64 - numBits) : 0);
     }
 
-    LmStatus Segment::compareWith(const Segment& other, std::vector<SegmentMatch>& matches) const {
-        // First compare each line in this with each line in other to find starting point matches.
-        // Contains a float from 0->1 which represents the likeness between the line i of this segment at row i of the matrix, to the line j of the other segment at col j of the matrix
+    static inline bool testBit(const uint64_t* row, int j) {
+        return (row[j / 64] >> (j % 64)) & 1;
+    }
 
-        Mat likenessMatrix = Mat(data_.size(), other.data_.size(), CV_32FC1);;
-        getMatchIndexes(data_.cbegin(), data_.cend(), other.data_.cbegin(), other.data_.cend(), likenessMatrix, true);
+    void sortRuns(pmr::vector<SegmentRun>::iterator runsBegin, pmr::vector<SegmentRun>::iterator runsEnd, int numCols) {
+        // The order of a sweep along each diagonal in turn: top left to bottom right diagonals starting from the top row then the left column, then top right to bottom left diagonals starting from the top row then the right column
+        auto sweepOrder = [numCols](const SegmentRun& run) {
+            bool isReversed = run.endIndex2 < run.startIndex2;
+            int diagonal;
+            if (isReversed) {
+                diagonal = run.startIndex1 + run.startIndex2;
+            } else {
+                int offset = run.startIndex2 - run.startIndex1;
+                diagonal = offset >= 0 ? offset : numCols - 1 - offset;
+            }
+            return make_tuple(isReversed, diagonal, run.startIndex1);
+        };
+        sort(runsBegin, runsEnd, [&sweepOrder](const SegmentRun& run1, const SegmentRun& run2) {
+            return sweepOrder(run1) < sweepOrder(run2);
+        });
+    }
 
-        cout << "Likeness Matrix" << endl;
-        cout << likenessMatrix << endl;
+    LmStatus Segment::compareWith(const Segment& other, std::vector<SegmentMatch>& matches, const MatchThresholds& thresholds) const {
+        pmr::vector<SegmentRun> runs(data_.get_allocator().resource());
+        findRuns(other, runs, thresholds.lengthThreshold);
+        return matchRuns(other, runs, matches, thresholds);
+    }
 
-        int numRows = likenessMatrix.rows;
-        int numCols = likenessMatrix.cols;
+    LmStatus Segment::findRuns(const Segment& other, pmr::vector<SegmentRun>& runs, float lengthThreshold) const {
+        LM_TRACE(LM_TRACE_LEVEL_DEBUG, TRACE_SEGMENT, "Likeness Matrix\n" << likenessMatrix(other, lengthThreshold));
+
+        // Compare each line in this with each line in other. Bit j of row i is set if line i of this segment is like line j of the other segment, i.e. likeness >= SEGMENT_LIKENESS_THRESHOLD.
+        // Rows are padded with an empty row before the first and after the last so the rows next to any row can be read without checks.
+        const int numRows = data_.size();
+        const int numCols = other.data_.size();
+        const int numWords = (numCols + 63) / 64;
+        pmr::vector<uint64_t> bits((numRows + 2) * numWords, 0, data_.get_allocator().resource());
+        auto row = [&bits, numWords](int i) {
+            return bits.data() + (i + 1) * numWords;
+        };
 
-        // Search through diagonials of the matrix for adjacent groups
-        // Top left to bottom right diagonals
-        for (int i = 0; i < numCols; i++) {
-            findMatchesInDiag(likenessMatrix, Point2i(0, i), Point2i(1, 1), 0.4, other, matches);
+        // Lines whose lengths differ by more than lengthThreshold have a likeness of 0, so each line is only compared with the band of lines of other within lengthThreshold of its length, found by binary search of other's lengths in ascending order.
+        pmr::vector<float> localLengths(data_.get_allocator().resource());
+        pmr::vector<int> localIndexes(data_.get_allocator().resource());
+        const pmr::vector<float>* otherLengths = &other.sortedLengths_;
+        const pmr::vector<int>* otherIndexes = &other.sortedIndexes_;
+        if (!other.isSummarised()) {
+            other.sortLengths(localLengths, localIndexes);
+            otherLengths = &localLengths;
+            otherIndexes = &localIndexes;
         }
 
-        // Catch edge case of a 1x1 matrix
-        if (numRows == 1 && numCols == 1) {
-            return LM_STATUS_OK;
+        int i = 0;
+        for (auto thisLineItr = data_.cbegin(); thisLineItr != data_.cend(); thisLineItr++, i++) {
+            uint64_t* thisRow = row(i);
+            auto bandBegin = lower_bound(otherLengths->cbegin(), otherLengths->cend(), thisLineItr->lineLength - lengthThreshold);
+            for (auto lengthItr = bandBegin; lengthItr != otherLengths->cend() && *lengthItr <= thisLineItr->lineLength + lengthThreshold; lengthItr++) {
+                if (compareLengths(thisLineItr->lineLength, *lengthItr, lengthThreshold) >= SEGMENT_LIKENESS_THRESHOLD) {
+                    int j = (*otherIndexes)[lengthItr - otherLengths->cbegin()];
+                    thisRow[j / 64] |= 1ull << (j % 64);
+                }
+            }
         }
 
-        for (int i = 1; i < numRows; i++) {
-            findMatchesInDiag(likenessMatrix, Point2i(i, 0), Point2i(1, 1), 0.4, other, matches);
-        }
+        // Search the diagonals of the matrix for runs of adjacent likes, top left to bottom right (increment 1) then top right to bottom left (increment -1).
+        // A run starts at (i, j) when (i, j) and the next SEGMENT_MIN_MATCH_LENGTH - 1 elements along the diagonal are set but the previous one is not, which is found for 64 columns at a time by AND-ing the rows below shifted along the diagonal.
+        static_assert(SEGMENT_MIN_MATCH_LENGTH >= 1 && SEGMENT_MIN_MATCH_LENGTH <= 64, "Rows are shifted by up to SEGMENT_MIN_MATCH_LENGTH - 1 bits within a word");
+        const int firstRun = runs.size();
+        for (int increment = 1; increment >= -1; increment -= 2) {
+            for (i = 0; i + SEGMENT_MIN_MATCH_LENGTH <= numRows; i++) {
+                const uint64_t* prevRow = row(i - 1);
+                const uint64_t* thisRow = row(i);
+                for (int w = 0; w < numWords; w++) {
+                    uint64_t prev = increment > 0 ? shiftUp(prevRow, w) : shiftDown(prevRow, w, numWords);
+                    uint64_t starts = thisRow[w] & ~prev;
+                    for (int k = 1; k < SEGMENT_MIN_MATCH_LENGTH && starts != 0; k++) {
+                        starts &= increment > 0 ? shiftDown(row(i + k), w, numWords, k) : shiftUp(row(i + k), w, k);
+                    }
 
-        // Top right to bottom left diagonals
-        for (int i = 0; i < numCols; i++) {
-            findMatchesInDiag(likenessMatrix, Point2i(0, i), Point2i(1, -1), 0.4, other, matches);
-        }
-        for (int i = 1; i < numRows; i++) {
-            findMatchesInDiag(likenessMatrix, Point2i(i, numCols-1), Point2i(1, -1), 0.4, other, matches);
+                    while (starts != 0) {
+                        int j = w * 64 + __builtin_ctzll(starts);
+                        starts &= starts - 1;
+
+                        // Follow the run to its end
+                        int length = SEGMENT_MIN_MATCH_LENGTH;
+                        while (i + length < numRows && j + length*increment >= 0 && j + length*increment < numCols &&
+                            testBit(row(i + length), j + length*increment)) {
+                            length++;
+                        }
+                        runs.push_back({i, i + length - 1, j, j + (length - 1)*increment});
+                    }
+                }
+            }
         }
 
+        sortRuns(runs.begin() + firstRun, runs.end(), numCols);
         return LM_STATUS_OK;
 
         /*
@@ -391,9 +517,177 @@ namespace lm {
         */
     }
 
+    LmStatus Segment::matchRuns(const Segment& other, const pmr::vector<SegmentRun>& runs, std::vector<SegmentMatch>& matches, const MatchThresholds& thresholds) const {
+        const int size1 = data_.size();
+        const int size2 = other.data_.size();
+
+        // For a symmetric other, the match of each forward run, or -1 if it failed, so that the backward run over the same lines of other reversed can be derived from it.
+        // They are sorted by run when the first backward run looks one up, and looked up by binary search.
+        pmr::vector<pair<SegmentRun, int>> forwardMatches(data_.get_allocator().resource());
+        bool isForwardSorted = true;
+        auto isBefore = [](const pair<SegmentRun, int>& forwardMatch1, const pair<SegmentRun, int>& forwardMatch2) {
+            return make_tuple(forwardMatch1.first.startIndex1, forwardMatch1.first.endIndex1, forwardMatch1.first.startIndex2) <
+                make_tuple(forwardMatch2.first.startIndex1, forwardMatch2.first.endIndex1, forwardMatch2.first.startIndex2);
+        };
+
+        for (auto runItr = runs.cbegin(); runItr != runs.cend(); runItr++) {
+            // Runs from a cache may have been found for different segments with the same fingerprint
+            if (max(runItr->startIndex1, runItr->endIndex1) >= size1 || max(runItr->startIndex2, runItr->endIndex2) >= size2) {
+                continue;
+            }
+
+            // Backward runs come after the forward runs. Rotating other by half a turn about its symmetry centre maps the backward run on to a forward run, so the pose is that run's turned by half a turn.
+            bool isReversed = runItr->endIndex2 < runItr->startIndex2;
+            if (other.isSymmetric_ && isReversed) {
+                if (!isForwardSorted) {
+                    sort(forwardMatches.begin(), forwardMatches.end(), isBefore);
+                    isForwardSorted = true;
+                }
+                const pair<SegmentRun, int> key = {{runItr->startIndex1, runItr->endIndex1, size2 - 1 - runItr->startIndex2, 0}, 0};
+                auto forwardItr = lower_bound(forwardMatches.cbegin(), forwardMatches.cend(), key, isBefore);
+                if (forwardItr != forwardMatches.cend() && !isBefore(key, *forwardItr)) {
+                    if (forwardItr->second >= 0) {
+                        matches.push_back(SegmentMatch(*this, runItr->startIndex1, runItr->endIndex1, other, runItr->startIndex2, runItr->endIndex2, forwardMatches.get_allocator().resource()));
+                        matches.back().setSymmetricOffsets(matches[forwardItr->second], other.symmetryCentre_);
+                    }
+                    continue;
+                }
+            }
+
+            // The run is validated on the lines of the two segments, and only copied into a SegmentMatch once it is accepted
+            float angleOffset;
+            Point2f positionOffset;
+            bool isMatch = SegmentMatch::computeOffsets(*this, other, *runItr, thresholds, angleOffset, positionOffset) == LM_STATUS_OK;
+            if (other.isSymmetric_ && !isReversed) {
+                forwardMatches.push_back({*runItr, isMatch ? (int)matches.size() : -1});
+                isForwardSorted = false;
+            }
+            if (isMatch) {
+                matches.push_back(SegmentMatch(*this, runItr->startIndex1, runItr->endIndex1, other, runItr->startIndex2, runItr->endIndex2, forwardMatches.get_allocator().resource()));
+                matches.back().angleOffset = angleOffset;
+                matches.back().positionOffset = positionOffset;
+            }
+        }
+        return LM_STATUS_OK;
+    }
+
+    uint64_t Segment::fingerprint(float lengthQuantum) const {
+        // FNV-1a over the number of lines and each quantized length in order
+        const uint64_t prime = 1099511628211ull;
+        uint64_t hash = 14695981039346656037ull;
+        auto addToHash = [&hash, prime](int64_t value) {
+            for (int i = 0; i < 8; i++) {
+                hash = (hash ^ ((value >> (8*i)) & 0xff)) * prime;
+            }
+        };
+
+        addToHash(data_.size());
+        for (auto lineItr = data_.cbegin(); lineItr != data_.cend(); lineItr++) {
+            addToHash(llround(lineItr->lineLength / lengthQuantum));
+        }
+        return hash;
+    }
+
+    // Number of lengths in lengths1 which have a length in lengths2 with a likeness of at least SEGMENT_LIKENESS_THRESHOLD. Both must be sorted in ascending order. Stops counting at maxCount.
+    static int countLikeLengths(const pmr::vector<float>& lengths1, const pmr::vector<float>& lengths2, float lengthThreshold, int maxCount) {
+        int count = 0;
+        auto length2Itr = lengths2.cbegin();
+        for (auto length1Itr = lengths1.cbegin(); length1Itr != lengths1.cend() && count < maxCount; length1Itr++) {
+            // Lengths which are too short for this length are too short for every length after it
+            while (length2Itr != lengths2.cend() && *length2Itr < *length1Itr && 
+                compareLengths(*length1Itr, *length2Itr, lengthThreshold) < SEGMENT_LIKENESS_THRESHOLD) {
+                length2Itr++;
+            }
+            if (length2Itr != lengths2.cend() && compareLengths(*length1Itr, *length2Itr, lengthThreshold) >= SEGMENT_LIKENESS_THRESHOLD) {
+                count++;
+            }
+        }
+        return count;
+    }
+
+    bool Segment::mayMatch(const Segment& other, float lengthThreshold) const {
+        if (data_.size() < SEGMENT_MIN_MATCH_LENGTH || other.data_.size() < SEGMENT_MIN_MATCH_LENGTH) {
+            return false;
+        }
+        if (!isSummarised() || !other.isSummarised()) {
+            return true;
+        }
+
+        // compareWith() ignores angles, so a run of matching lines needs at least SEGMENT_MIN_MATCH_LENGTH different lines in each segment with a line of similar length in the other
+        return countLikeLengths(sortedLengths_, other.sortedLengths_, lengthThreshold, SEGMENT_MIN_MATCH_LENGTH) >= SEGMENT_MIN_MATCH_LENGTH &&
+            countLikeLengths(other.sortedLengths_, sortedLengths_, lengthThreshold, SEGMENT_MIN_MATCH_LENGTH) >= SEGMENT_MIN_MATCH_LENGTH;
+    }
+
+    void Segment::summarise() {
+        sortLengths(sortedLengths_, sortedIndexes_);
+        isSummarised_ = true;
+    }
+
+    bool Segment::findSymmetry(const MatchThresholds& thresholds) {
+        isSymmetric_ = false;
+        if (data_.size() < SEGMENT_MIN_MATCH_LENGTH) {
+            return false;
+        }
+
+        // The centre of a half turn symmetry is the mean of the line midpoints, and each line must map on to the line the same distance from the other end
+        symmetryCentre_ = Point2f(0, 0);
+        for (auto lineItr = data_.cbegin(); lineItr != data_.cend(); lineItr++) {
+            symmetryCentre_ += lineItr->pt;
+        }
+        symmetryCentre_ /= (float)data_.size();
+
+        // Lengths are alike by the same test as findRuns(), at the tighter tolerance
+        const float positionTolerance = SEGMENT_SYMMETRY_TOLERANCE * thresholds.positionThreshold;
+        const float lengthTolerance = SEGMENT_SYMMETRY_TOLERANCE * thresholds.lengthThreshold;
+        const float angleTolerance = SEGMENT_SYMMETRY_TOLERANCE * thresholds.angleThreshold;
+        auto frontItr = data_.cbegin();
+        auto backItr = data_.crbegin();
+        for (int i = 0; i < (data_.size() + 1) / 2; i++, frontItr++, backItr++) {
+            if (dist(frontItr->pt + backItr->pt, 2 * symmetryCentre_) > 2 * positionTolerance ||
+                compareLengths(frontItr->lineLength, backItr->lineLength, lengthTolerance) < SEGMENT_LIKENESS_THRESHOLD ||
+                abs(fastAngleDiff(frontItr->angle, backItr->angle, M_PI)) > angleTolerance) {
+                return false;
+            }
+        }
+
+        isSymmetric_ = true;
+        return true;
+    }
+
+    bool Segment::isSymmetric() const {
+        return isSymmetric_;
+    }
+
+    cv::Point2f Segment::symmetryCentre() const {
+        return symmetryCentre_;
+    }
+
+    bool Segment::isSummarised() const {
+        return isSummarised_;
+    }
+
+    void Segment::sortLengths(pmr::vector<float>& lengths, pmr::vector<int>& indexes) const {
+        indexes.resize(data_.size());
+        iota(indexes.begin(), indexes.end(), 0);
+
+        pmr::vector<float> unsortedLengths(data_.get_allocator().resource());
+        unsortedLengths.reserve(data_.size());
+        for (auto lineItr = data_.cbegin(); lineItr != data_.cend(); lineItr++) {
+            unsortedLengths.push_back(lineItr->lineLength);
+        }
+        stable_sort(indexes.begin(), indexes.end(), [&unsortedLengths](int index1, int index2) {
+            return unsortedLengths[index1] < unsortedLengths[index2];
+        });
+
+        lengths.clear();
+        for (auto indexItr = indexes.cbegin(); indexItr != indexes.cend(); indexItr++) {
+            lengths.push_back(unsortedLengths[*indexItr]);
+        }
+    }
+
     void Segment::draw(InputOutputArray imgIn, Scalar color, string label) const {
         for (auto lineItr = data_.cbegin(); lineItr != data_.cend(); lineItr++) {
-            const KeyLine& line = *lineItr;
+            const Line& line = *lineItr;
 
             cv::line(imgIn, line.getStartPoint(), line.getEndPoint(), color);
             putText(imgIn, label, line.pt, FONT_HERSHEY_SIMPLEX , 1.0, color);
@@ -406,29 +700,57 @@ namespace lm {
         return data_;
     }
 
+    cv::Rect2f Segment::boundingBox() const {
+        if (data_.empty()) {
+            return Rect2f();
+        }
+
+        Point2f minPt = data_.front().pt;
+        Point2f maxPt = data_.front().pt;
+        for (auto lineItr = data_.cbegin(); lineItr != data_.cend(); lineItr++) {
+            // The ends of a line are its midpoint +/- halfVec
+            Point2f extent(abs(lineItr->halfVec.x), abs(lineItr->halfVec.y));
+            minPt = Point2f(min(minPt.x, lineItr->pt.x - extent.x), min(minPt.y, lineItr->pt.y - extent.y));
+            maxPt = Point2f(max(maxPt.x, lineItr->pt.x + extent.x), max(maxPt.y, lineItr->pt.y + extent.y));
+        }
+        return Rect2f(minPt.x, minPt.y, maxPt.x - minPt.x, maxPt.y - minPt.y);
+    }
+
+    float Segment::length() const {
+        return accumulate(data_.cbegin(), data_.cend(), 0.0f, [](float length, const Line& line) {
+            return length + line.lineLength;
+        });
+    }
+
     // ############ SEGMENTS ############
 
+    Segments::Segments(pmr::memory_resource* resource) : resource_(resource), data_(resource) {
+
+    }
+
     LmStatus Segments::addSegment(const Segment& segment) {
-        shared_ptr<Segment> newSegment(new Segment(segment));
+        shared_ptr<Segment> newSegment = allocate_shared<Segment>(pmr::polymorphic_allocator<Segment>(resource_), resource_);
+        newSegment->data_.assign(segment.data_.cbegin(), segment.data_.cend());
+        newSegment->summarise();
         data_.push_back(newSegment);
         return LM_STATUS_OK;
     }
 
-    LmStatus Segments::addLines(const KeyLines& lines) {
+    LmStatus Segments::addLines(const KeyLines& lines, const MatchThresholds& thresholds) {
         // Create a segment from each line and compare with existing segments to see if they match. Join if they do, else create new segment
         
         // True if the segment is unique, false if segment has been merged elsewhere
-        vector<bool> isUnique(data_.size(), true);
+        pmr::vector<bool> isUnique(data_.size(), true, resource_);
 
         for (auto lineItr = lines.cbegin(); lineItr != lines.cend(); lineItr++) {
-            shared_ptr<Segment> lineSegment(new Segment(*lineItr));
+            shared_ptr<Segment> lineSegment = allocate_shared<Segment>(pmr::polymorphic_allocator<Segment>(resource_), *lineItr, resource_);
             bool joinedToExistingSegment = false;
 
             int segmentCount = 0;
             for (auto segmentItr = data_.begin(); segmentItr != data_.end(); segmentItr++) {
                 if (isUnique[segmentCount]) {
                     shared_ptr<Segment>& pSegment = *segmentItr;
-                    if (lineSegment->join(*pSegment) == LM_STATUS_OK) {
+                    if (lineSegment->join(*pSegment, thresholds.joinDistThreshold) == LM_STATUS_OK) {
                         // Successful join operation; update pSegment to the new segment and continue because it is possible for a single line to connect to two segments
                         pSegment = lineSegment;
                         joinedToExistingSegment = true;
@@ -443,6 +765,10 @@ namespace lm {
         }
         pruneSegments(isUnique);
 
+        for (auto segmentItr = data_.begin(); segmentItr != data_.end(); segmentItr++) {
+            (*segmentItr)->summarise();
+        }
+
         return LM_STATUS_OK;
     }
 
@@ -451,20 +777,112 @@ namespace lm {
         return LM_STATUS_OK;
     }
 
-    LmStatus Segments::matchSegments(const Segments& segments, std::vector<SegmentMatch>& matches) {
+    LmStatus Segments::matchSegments(const Segments& segments, std::vector<SegmentMatch>& matches, const MatchThresholds& thresholds) const {
         for (auto otherSegmentItr = segments.data().cbegin(); otherSegmentItr != segments.data().cend(); otherSegmentItr++) {
             Segment& otherSegment = **otherSegmentItr;
 
             for (auto thisSegmentItr = data_.cbegin(); thisSegmentItr != data_.cend(); thisSegmentItr++) {
                 Segment& thisSegment = **thisSegmentItr;
 
-                thisSegment.compareWith(otherSegment, matches);
+                // Most pairs can be ruled out without building a likeness matrix
+                if (!thisSegment.mayMatch(otherSegment, thresholds.lengthThreshold)) {
+                    continue;
+                }
+
+                thisSegment.compareWith(otherSegment, matches, thresholds);
+            }
+        }
+
+        return LM_STATUS_OK;
+    }
+
+    LmStatus Segments::matchSegments(const Segments& segments, std::vector<SegmentMatch>& matches, const MatchThresholds& thresholds, MatchCache& cache) const {
+        return matchSegments(segments, {}, matches, thresholds, cache, chrono::steady_clock::time_point::max());
+    }
+
+    LmStatus Segments::matchSegments(const Segments& segments, const std::vector<int>& order, std::vector<SegmentMatch>& matches, const MatchThresholds& thresholds, MatchCache& cache, chrono::steady_clock::time_point deadline) const {
+        const float lengthQuantum = thresholds.lengthThreshold * MATCH_CACHE_LENGTH_QUANTUM;
+        const bool hasDeadline = deadline != chrono::steady_clock::time_point::max();
+
+        pmr::vector<uint64_t> fingerprints(resource_);
+        for (auto thisSegmentItr = data_.cbegin(); thisSegmentItr != data_.cend(); thisSegmentItr++) {
+            fingerprints.push_back((*thisSegmentItr)->fingerprint(lengthQuantum));
+        }
+
+        pmr::vector<SegmentRun> runs(resource_);
+        const int numSegments = order.empty() ? segments.data().size() : order.size();
+        for (int k = 0; k < numSegments; k++) {
+            if (hasDeadline && chrono::steady_clock::now() >= deadline) {
+                return LM_STATUS_DEADLINE_EXCEEDED;
+            }
+
+            Segment& otherSegment = *segments.data()[order.empty() ? k : order[k]];
+            uint64_t otherFingerprint = otherSegment.fingerprint(lengthQuantum);
+
+            for (int i = 0; i < data_.size(); i++) {
+                Segment& thisSegment = *data_[i];
+
+                // Most pairs can be ruled out without building a likeness matrix
+                if (!thisSegment.mayMatch(otherSegment, thresholds.lengthThreshold)) {
+                    continue;
+                }
+
+                const pmr::vector<SegmentRun>* cachedRuns = cache.find(fingerprints[i], otherFingerprint);
+                if (cachedRuns == nullptr) {
+                    runs.clear();
+                    thisSegment.findRuns(otherSegment, runs, thresholds.lengthThreshold);
+                    cachedRuns = &cache.insert(fingerprints[i], otherFingerprint, runs);
+                }
+
+                thisSegment.matchRuns(otherSegment, *cachedRuns, matches, thresholds);
             }
         }
 
         return LM_STATUS_OK;
     }
 
+    void Segments::subset(const pmr::vector<int>& indexes, Segments& subsetOut) const {
+        for (auto indexItr = indexes.cbegin(); indexItr != indexes.cend(); indexItr++) {
+            subsetOut.data_.push_back(data_[*indexItr]);
+        }
+    }
+
+    std::vector<int> Segments::orderByLength() const {
+        std::vector<float> lengths;
+        for (auto segmentItr = data_.cbegin(); segmentItr != data_.cend(); segmentItr++) {
+            lengths.push_back((*segmentItr)->length());
+        }
+
+        std::vector<int> order(data_.size());
+        iota(order.begin(), order.end(), 0);
+        stable_sort(order.begin(), order.end(), [&lengths](int index1, int index2) {
+            return lengths[index1] > lengths[index2];
+        });
+        return order;
+    }
+
+    int Segments::findSymmetries(const MatchThresholds& thresholds) {
+        int numSymmetric = 0;
+        for (auto segmentItr = data_.begin(); segmentItr != data_.end(); segmentItr++) {
+            numSymmetric += (*segmentItr)->findSymmetry(thresholds);
+        }
+        return numSymmetric;
+    }
+
+    float Segments::matchableLength(const Segments& segments, float lengthThreshold) const {
+        float length = 0;
+        for (auto otherSegmentItr = segments.data().cbegin(); otherSegmentItr != segments.data().cend(); otherSegmentItr++) {
+            const Segment& otherSegment = **otherSegmentItr;
+            auto matchableItr = find_if(data_.cbegin(), data_.cend(), [&](const shared_ptr<Segment>& thisSegment) {
+                return thisSegment->mayMatch(otherSegment, lengthThreshold);
+            });
+            if (matchableItr != data_.cend()) {
+                length += otherSegment.length();
+            }
+        }
+        return length;
+    }
+
     void Segments::draw(cv::InputOutputArray imgIn) const {
         srand(time(NULL));
 
@@ -489,8 +907,8 @@ namespace lm {
         return data_;
     }
 
-    void Segments::pruneSegments(std::vector<bool> keepList) {
-        std::vector<std::shared_ptr<Segment>> prunedSegments;
+    void Segments::pruneSegments(const std::pmr::vector<bool>& keepList) {
+        data_t prunedSegments(resource_);
         auto pSegmentItr = data_.cbegin();
         auto keepItr = keepList.cbegin();
 
@@ -501,6 +919,6 @@ namespace lm {
             pSegmentItr++;
             keepItr++;
         }
-        data_ = prunedSegments;
+        data_ = std::move(prunedSegments);
     }
 }
\ No newline at end of file
@@ -0,0 +1,123 @@
+#include <cfloat>
+
+#include "location_matcher/segment_grid.hpp"
+
+using namespace std;
+using namespace cv;
+
+namespace lm {
+
+    static inline bool intersects(const Rect2f& box1, const Rect2f& box2) {
+        return box1.x <= box2.x + box2.width && box2.x <= box1.x + box1.width &&
+            box1.y <= box2.y + box2.height && box2.y <= box1.y + box1.height;
+    }
+
+    SegmentGrid::SegmentGrid(pmr::memory_resource* resource) :
+        cellSize_(1),
+        cols_(0),
+        rows_(0),
+        boxes_(resource),
+        cellBegin_(resource),
+        cellSegments_(resource) {
+
+    }
+
+    LmStatus SegmentGrid::build(const Segments& segments, float cellSize) {
+        clear();
+        if (cellSize <= 0) {
+            return LM_STATUS_ERROR_GENERIC;
+        }
+        cellSize_ = cellSize;
+
+        if (segments.data().empty()) {
+            return LM_STATUS_OK;
+        }
+
+        // The grid covers the bounding box of every segment
+        Point2f minPt(FLT_MAX, FLT_MAX);
+        Point2f maxPt(-FLT_MAX, -FLT_MAX);
+        for (auto segmentItr = segments.data().cbegin(); segmentItr != segments.data().cend(); segmentItr++) {
+            Rect2f box = (*segmentItr)->boundingBox();
+            boxes_.push_back(box);
+            minPt = Point2f(min(minPt.x, box.x), min(minPt.y, box.y));
+            maxPt = Point2f(max(maxPt.x, box.x + box.width), max(maxPt.y, box.y + box.height));
+        }
+        origin_ = minPt;
+        cols_ = (int)((maxPt.x - minPt.x) / cellSize_) + 1;
+        rows_ = (int)((maxPt.y - minPt.y) / cellSize_) + 1;
+
+        // Count the segments in each cell, then fill the cells in a second pass so every cell is stored contiguously
+        cellBegin_.assign(cols_ * rows_ + 1, 0);
+        int firstCol, firstRow, lastCol, lastRow;
+        for (auto boxItr = boxes_.cbegin(); boxItr != boxes_.cend(); boxItr++) {
+            cellRange(*boxItr, firstCol, firstRow, lastCol, lastRow);
+            for (int row = firstRow; row <= lastRow; row++) {
+                for (int col = firstCol; col <= lastCol; col++) {
+                    cellBegin_[row * cols_ + col + 1]++;
+                }
+            }
+        }
+        for (int i = 0; i < cols_ * rows_; i++) {
+            cellBegin_[i + 1] += cellBegin_[i];
+        }
+
+        cellSegments_.resize(cellBegin_.back());
+        pmr::vector<int> cellEnd(cellBegin_.cbegin(), cellBegin_.cend() - 1, cellBegin_.get_allocator().resource());
+        for (int i = 0; i < boxes_.size(); i++) {
+            cellRange(boxes_[i], firstCol, firstRow, lastCol, lastRow);
+            for (int row = firstRow; row <= lastRow; row++) {
+                for (int col = firstCol; col <= lastCol; col++) {
+                    cellSegments_[cellEnd[row * cols_ + col]++] = i;
+                }
+            }
+        }
+
+        return LM_STATUS_OK;
+    }
+
+    LmStatus SegmentGrid::clear() {
+        cols_ = 0;
+        rows_ = 0;
+        boxes_.clear();
+        cellBegin_.clear();
+        cellSegments_.clear();
+        return LM_STATUS_OK;
+    }
+
+    void SegmentGrid::query(const Rect2f& box, pmr::vector<int>& indexesOut) const {
+        const int firstIndex = indexesOut.size();
+
+        int firstCol, firstRow, lastCol, lastRow;
+        cellRange(box, firstCol, firstRow, lastCol, lastRow);
+        for (int row = firstRow; row <= lastRow; row++) {
+            for (int col = firstCol; col <= lastCol; col++) {
+                int cell = row * cols_ + col;
+                for (int i = cellBegin_[cell]; i < cellBegin_[cell + 1]; i++) {
+                    if (intersects(box, boxes_[cellSegments_[i]])) {
+                        indexesOut.push_back(cellSegments_[i]);
+                    }
+                }
+            }
+        }
+
+        // A segment which spans several cells is found once in each of them
+        sort(indexesOut.begin() + firstIndex, indexesOut.end());
+        indexesOut.erase(unique(indexesOut.begin() + firstIndex, indexesOut.end()), indexesOut.end());
+    }
+
+    int SegmentGrid::numCells() const {
+        return cols_ * rows_;
+    }
+
+    // Index of the cell containing coordinate x of a grid starting at origin, clamped to [-1, numCells] before it is converted so that boxes far outside the grid cannot overflow
+    static inline int cellIndex(float x, float origin, float cellSize, int numCells) {
+        return (int)min(max(floor((x - origin) / cellSize), -1.0f), (float)numCells);
+    }
+
+    void SegmentGrid::cellRange(const Rect2f& box, int& firstCol, int& firstRow, int& lastCol, int& lastRow) const {
+        firstCol = max(0, cellIndex(box.x, origin_.x, cellSize_, cols_));
+        firstRow = max(0, cellIndex(box.y, origin_.y, cellSize_, rows_));
+        lastCol = min(cols_ - 1, cellIndex(box.x + box.width, origin_.x, cellSize_, cols_));
+        lastRow = min(rows_ - 1, cellIndex(box.y + box.height, origin_.y, cellSize_, rows_));
+    }
+}
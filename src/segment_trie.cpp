@@ -0,0 +1,210 @@
+#include "location_matcher/segment_trie.hpp"
+
+using namespace std;
+using namespace cv;
+
+namespace lm {
+
+    SegmentTrie::SegmentTrie() : lengthQuantum_(MatchThresholds().lengthThreshold * SEGMENT_TRIE_LENGTH_QUANTUM) {
+        clear();
+    }
+
+    LmStatus SegmentTrie::setLengthQuantum(float lengthQuantum) {
+        if (lengthQuantum <= 0 || nodes_.size() > 1) {
+            return LM_STATUS_ERROR_GENERIC;
+        }
+        lengthQuantum_ = lengthQuantum;
+        return LM_STATUS_OK;
+    }
+
+    void SegmentTrie::add(int id, const Segment& segment) {
+        vector<int64_t> quantizedLengths;
+        for (auto lineItr = segment.data().cbegin(); lineItr != segment.data().cend(); lineItr++) {
+            quantizedLengths.push_back(llround(lineItr->lineLength / lengthQuantum_));
+        }
+
+        // Segments are joined from either end, so each is stored in whichever direction has the smaller sequence of lengths. Then a segment and its reverse share nodes.
+        vector<int64_t> reversedLengths(quantizedLengths.rbegin(), quantizedLengths.rend());
+        bool isReversed = reversedLengths < quantizedLengths;
+        if (isReversed) {
+            quantizedLengths.swap(reversedLengths);
+        }
+
+        int nodeIndex = 0;
+        for (auto lengthItr = quantizedLengths.cbegin(); lengthItr != quantizedLengths.cend(); lengthItr++) {
+            int64_t quantizedLength = *lengthItr;
+
+            int childIndex = nodes_[nodeIndex].firstChild;
+            while (childIndex != -1 && nodes_[childIndex].quantizedLength != quantizedLength) {
+                childIndex = nodes_[childIndex].nextSibling;
+            }
+
+            if (childIndex == -1) {
+                childIndex = nodes_.size();
+                nodes_.push_back({quantizedLength, nodes_[nodeIndex].depth + 1, nodeIndex, -1, nodes_[nodeIndex].firstChild});
+                nodes_[nodeIndex].firstChild = childIndex;
+                maxDepth_ = max(maxDepth_, nodes_[childIndex].depth);
+            }
+            nodeIndex = childIndex;
+        }
+
+        if (id >= idNodes_.size()) {
+            idNodes_.resize(id + 1, -1);
+            idIsReversed_.resize(id + 1, false);
+        }
+        idNodes_[id] = nodeIndex;
+        idIsReversed_[id] = isReversed;
+    }
+
+    void SegmentTrie::clear() {
+        nodes_.clear();
+        nodes_.push_back({0, -1, -1, -1, -1});
+        idNodes_.clear();
+        idIsReversed_.clear();
+        maxDepth_ = -1;
+    }
+
+    void SegmentTrie::findRuns(const Segment& mapSegment, const pmr::vector<int>& ids, float lengthThreshold, pmr::vector<SegmentRun>& runsOut, pmr::vector<int>& offsetsOut) const {
+        TrieScratch scratch;
+        findRuns(mapSegment, ids, lengthThreshold, runsOut, offsetsOut, scratch);
+    }
+
+    void SegmentTrie::findRuns(const Segment& mapSegment, const pmr::vector<int>& ids, float lengthThreshold, pmr::vector<SegmentRun>& runsOut, pmr::vector<int>& offsetsOut, TrieScratch& scratch) const {
+        pmr::memory_resource* resource = runsOut.get_allocator().resource();
+        const int numLines = mapSegment.data().size();
+        pmr::vector<float> mapLengths(resource);
+        for (auto lineItr = mapSegment.data().cbegin(); lineItr != mapSegment.data().cend(); lineItr++) {
+            mapLengths.push_back(lineItr->lineLength);
+        }
+
+        // Only the nodes on the paths to the wanted ids are visited. The ids ending at each node are linked in the order of ids.
+        // The scratch only grows with the trie, and the nodes marked here are cleared again at the end, so a call never touches the other nodes.
+        if (scratch.isWanted.size() < nodes_.size()) {
+            scratch.isWanted.resize(nodes_.size(), 0);
+            scratch.firstId.resize(nodes_.size(), -1);
+        }
+        char* isWanted = scratch.isWanted.data();
+        int* firstId = scratch.firstId.data();
+        pmr::vector<int> wantedNodes(resource);
+        pmr::vector<int> nextId(ids.size(), -1, resource);
+        for (int k = ids.size() - 1; k >= 0; k--) {
+            int nodeIndex = idNodes_[ids[k]];
+            nextId[k] = firstId[nodeIndex];
+            firstId[nodeIndex] = k;
+            for (; nodeIndex != -1 && !isWanted[nodeIndex]; nodeIndex = nodes_[nodeIndex].parent) {
+                isWanted[nodeIndex] = 1;
+                wantedNodes.push_back(nodeIndex);
+            }
+        }
+
+        // Length of the run of like lines ending at each map line and the current node, forwards and backwards along the map segment, for each node on the current path.
+        // Level 0 is the root, which has no runs, and a node of depth d is at level d + 1.
+        const int numLevels = maxDepth_ + 2;
+        pmr::vector<int> forward(numLevels * numLines, 0, resource);
+        pmr::vector<int> backward(numLevels * numLines, 0, resource);
+        pmr::vector<char> isLike(numLines, 0, resource);
+
+        // Runs which ended above the current node, shared by every segment below it. closedEnd[level] is the number of them up to the node at that level.
+        pmr::vector<SegmentRun> closed(resource);
+        pmr::vector<int> closedEnd(numLevels, 0, resource);
+
+        // Runs of each id in the order they are found, copied out in the order of ids at the end
+        pmr::vector<SegmentRun> found(resource);
+        pmr::vector<pair<int, int>> foundRanges(ids.size(), {0, 0}, resource);
+
+        pmr::vector<int> stack(resource);
+        stack.push_back(0);
+        while (!stack.empty()) {
+            const int nodeIndex = stack.back();
+            stack.pop_back();
+            const Node& node = nodes_[nodeIndex];
+            const int level = node.depth + 1;
+            const int j = node.depth;
+
+            if (level > 0) {
+                const int* parentForward = forward.data() + (level - 1) * numLines;
+                const int* parentBackward = backward.data() + (level - 1) * numLines;
+                int* thisForward = forward.data() + level * numLines;
+                int* thisBackward = backward.data() + level * numLines;
+
+                const float length = node.quantizedLength * lengthQuantum_;
+                for (int i = 0; i < numLines; i++) {
+                    isLike[i] = compareLengths(mapLengths[i], length, lengthThreshold) >= SEGMENT_LIKENESS_THRESHOLD;
+                }
+
+                // Runs of the parent which do not continue on to this node end at the parent
+                closed.resize(closedEnd[level - 1]);
+                for (int i = 0; i < numLines; i++) {
+                    int forwardLength = parentForward[i];
+                    if (forwardLength >= SEGMENT_MIN_MATCH_LENGTH && !(i + 1 < numLines && isLike[i + 1])) {
+                        closed.push_back({i - forwardLength + 1, i, j - forwardLength, j - 1});
+                    }
+                    int backwardLength = parentBackward[i];
+                    if (backwardLength >= SEGMENT_MIN_MATCH_LENGTH && !(i > 0 && isLike[i - 1])) {
+                        closed.push_back({i, i + backwardLength - 1, j - 1, j - backwardLength});
+                    }
+                }
+                closedEnd[level] = closed.size();
+
+                for (int i = 0; i < numLines; i++) {
+                    thisForward[i] = isLike[i] ? (i > 0 ? parentForward[i - 1] : 0) + 1 : 0;
+                    thisBackward[i] = isLike[i] ? (i + 1 < numLines ? parentBackward[i + 1] : 0) + 1 : 0;
+                }
+            }
+
+            // Segments ending here have the runs which ended above and the runs still open at this node
+            const int* thisForward = forward.data() + level * numLines;
+            const int* thisBackward = backward.data() + level * numLines;
+            int firstFound = -1;
+            for (int k = firstId[nodeIndex]; k != -1; k = nextId[k]) {
+                if (firstFound == -1) {
+                    firstFound = found.size();
+                    found.insert(found.end(), closed.cbegin(), closed.cend());
+                    for (int i = 0; i < numLines; i++) {
+                        if (thisForward[i] >= SEGMENT_MIN_MATCH_LENGTH) {
+                            found.push_back({i - thisForward[i] + 1, i, j - thisForward[i] + 1, j});
+                        }
+                        if (thisBackward[i] >= SEGMENT_MIN_MATCH_LENGTH) {
+                            found.push_back({i, i + thisBackward[i] - 1, j, j - thisBackward[i] + 1});
+                        }
+                    }
+                    sortRuns(found.begin() + firstFound, found.end(), node.depth + 1);
+                }
+                foundRanges[k] = {firstFound, (int)found.size() - firstFound};
+            }
+
+            for (int childIndex = node.firstChild; childIndex != -1; childIndex = nodes_[childIndex].nextSibling) {
+                if (isWanted[childIndex]) {
+                    stack.push_back(childIndex);
+                }
+            }
+        }
+
+        for (int k = 0; k < ids.size(); k++) {
+            const int firstRun = runsOut.size();
+            offsetsOut.push_back(firstRun);
+            runsOut.insert(runsOut.end(), found.cbegin() + foundRanges[k].first, found.cbegin() + foundRanges[k].first + foundRanges[k].second);
+
+            // Runs along a segment stored reversed are mirrored back to the segment's own line indexes
+            if (idIsReversed_[ids[k]]) {
+                const int numCols = nodes_[idNodes_[ids[k]]].depth + 1;
+                for (auto runItr = runsOut.begin() + firstRun; runItr != runsOut.end(); runItr++) {
+                    runItr->startIndex2 = numCols - 1 - runItr->startIndex2;
+                    runItr->endIndex2 = numCols - 1 - runItr->endIndex2;
+                }
+                sortRuns(runsOut.begin() + firstRun, runsOut.end(), numCols);
+            }
+        }
+        offsetsOut.push_back(runsOut.size());
+
+        // Every id ends at a wanted node, so this clears everything set above
+        for (auto nodeItr = wantedNodes.cbegin(); nodeItr != wantedNodes.cend(); nodeItr++) {
+            isWanted[*nodeItr] = 0;
+            firstId[*nodeItr] = -1;
+        }
+    }
+
+    int SegmentTrie::numNodes() const {
+        return nodes_.size() - 1;
+    }
+}
@@ -1,8 +1,327 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
 #include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+#include "location_matcher/location_matcher.hpp"
+
+using namespace std;
+using namespace cv;
+using namespace lm;
+
+/*
+    lm_match: matches a set of maps against a directory of blueprints on a pool of threads, writes the matches as JSON lines and reports throughput and latency percentiles.
+    Latency is the time spent in findMatch(); the time to read and decode each map is reported separately, and maps which cannot be decoded are left out of the percentiles.
+    Each JSON line is written as soon as its map has been matched, so lines are in the order the maps finish rather than the order they were given.
+
+    Usage:
+        lm_match --blueprints <dir> [options] <map or directory or @list>...
+        lm_match --benchmark-detectors <map or directory or @list>...
+
+    Every image in the blueprint directory becomes a blueprint named after its file name without the extension, with its centroid at the centre of the image. Two images with the same name, e.g. a.png and a.jpg, are an error.
+    Maps are image files, directories of image files, or @file for a file listing one map path per line.
+
+    Options:
+        --blueprint-scale <m>   Metres per pixel of the blueprints. Defaults to 0.05.
+        --map-scale <m>         Metres per pixel of the maps. Defaults to the scale of each blueprint.
+        --threads <n>           Worker threads. Defaults to the number of hardware threads.
+        --min-certainty <c>     Matches below this certainty are not reported. Defaults to 0.
+        --output <file>         JSON lines are written here instead of stdout.
+        --benchmark-detectors   Runs every line detector backend over the maps and prints its speed and agreement with LSD instead of matching.
+                                No blueprints are needed.
+*/
+
+namespace lm {
+    struct MatchOptions {
+        MatchOptions() : blueprintScale(0.05), mapScale(0), numThreads(thread::hardware_concurrency()), minCertainty(0), isBenchmarkingDetectors(false) {}
+
+        string blueprintDir;
+        float blueprintScale;
+        float mapScale;
+        int numThreads;
+        double minCertainty;
+        string outputPath;
+        bool isBenchmarkingDetectors;
+        vector<string> maps;
+    };
+
+    // Result of matching one map
+    struct MapResult {
+        LmStatus status;
+        bool isDecoded;
+        double decodeSeconds;   // Reading and decoding the image
+        double seconds;         // findMatch() only, so latencies are not skewed by the image format
+        vector<LocationMatch> matches;
+    };
+
+    static bool isImage(const filesystem::path& path) {
+        string extension = path.extension().string();
+        transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+        const char* imageExtensions[] = {".png", ".jpg", ".jpeg", ".bmp", ".pgm", ".tif", ".tiff"};
+        return find(begin(imageExtensions), end(imageExtensions), extension) != end(imageExtensions);
+    }
+
+    // Image files in dir, sorted by path so runs are repeatable
+    static vector<string> listImages(const string& dir) {
+        vector<string> paths;
+        for (auto entryItr = filesystem::directory_iterator(dir); entryItr != filesystem::directory_iterator(); entryItr++) {
+            if (entryItr->is_regular_file() && isImage(entryItr->path())) {
+                paths.push_back(entryItr->path().string());
+            }
+        }
+        sort(paths.begin(), paths.end());
+        return paths;
+    }
+
+    static void printUsage() {
+        cerr << "Usage: lm_match --blueprints <dir> [--blueprint-scale <m>] [--map-scale <m>] [--threads <n>] [--min-certainty <c>] [--output <file>] <map or directory or @list>..." << endl;
+        cerr << "       lm_match --benchmark-detectors <map or directory or @list>..." << endl;
+    }
+
+    static LmStatus parseArgs(int argc, char* argv[], MatchOptions& options) {
+        for (int i = 1; i < argc; i++) {
+            string arg = argv[i];
+            bool hasValue = i + 1 < argc;
+            if (arg == "--blueprints" && hasValue) {
+                options.blueprintDir = argv[++i];
+            } else if (arg == "--blueprint-scale" && hasValue) {
+                options.blueprintScale = atof(argv[++i]);
+            } else if (arg == "--map-scale" && hasValue) {
+                options.mapScale = atof(argv[++i]);
+            } else if (arg == "--threads" && hasValue) {
+                options.numThreads = atoi(argv[++i]);
+            } else if (arg == "--min-certainty" && hasValue) {
+                options.minCertainty = atof(argv[++i]);
+            } else if (arg == "--output" && hasValue) {
+                options.outputPath = argv[++i];
+            } else if (arg == "--benchmark-detectors") {
+                options.isBenchmarkingDetectors = true;
+            } else if (arg.compare(0, 2, "--") == 0) {
+                cerr << "Unknown or incomplete option " << arg << endl;
+                return LM_STATUS_ERROR_GENERIC;
+            } else if (arg[0] == '@') {
+                ifstream list(arg.substr(1));
+                if (!list) {
+                    cerr << "Cannot read map list " << arg.substr(1) << endl;
+                    return LM_STATUS_ERROR_GENERIC;
+                }
+                string line;
+                while (getline(list, line)) {
+                    if (!line.empty()) {
+                        options.maps.push_back(line);
+                    }
+                }
+            } else if (filesystem::is_directory(arg)) {
+                vector<string> dirMaps = listImages(arg);
+                options.maps.insert(options.maps.end(), dirMaps.begin(), dirMaps.end());
+            } else {
+                options.maps.push_back(arg);
+            }
+        }
+
+        if ((options.blueprintDir.empty() && !options.isBenchmarkingDetectors) || options.maps.empty() || options.blueprintScale <= 0) {
+            return LM_STATUS_ERROR_GENERIC;
+        }
+        options.numThreads = max(1, options.numThreads);
+        return LM_STATUS_OK;
+    }
+
+    static LmStatus loadBlueprints(const MatchOptions& options, LocationMatcher& matcher) {
+        if (!filesystem::is_directory(options.blueprintDir)) {
+            cerr << "Blueprint directory " << options.blueprintDir << " does not exist" << endl;
+            return LM_STATUS_ERROR_GENERIC;
+        }
+
+        // addBlueprint() replaces a blueprint of the same name, so a second image with the same name would silently hide the first
+        vector<string> paths = listImages(options.blueprintDir);
+        map<string, string> namePaths;
+        for (auto pathItr = paths.cbegin(); pathItr != paths.cend(); pathItr++) {
+            string name = filesystem::path(*pathItr).stem().string();
+            auto inserted = namePaths.insert({name, *pathItr});
+            if (!inserted.second) {
+                cerr << "Blueprints " << inserted.first->second << " and " << *pathItr << " have the same name " << name << endl;
+                return LM_STATUS_ERROR_GENERIC;
+            }
+        }
+
+        for (auto pathItr = paths.cbegin(); pathItr != paths.cend(); pathItr++) {
+            Blueprint blueprint;
+            blueprint.name = filesystem::path(*pathItr).stem().string();
+            blueprint.blueprintImg = imread(*pathItr, IMREAD_GRAYSCALE);
+            if (blueprint.blueprintImg.empty()) {
+                cerr << "Cannot read blueprint " << *pathItr << endl;
+                continue;
+            }
+            blueprint.centroid = Point2f(blueprint.blueprintImg.cols / 2.0f, blueprint.blueprintImg.rows / 2.0f);
+            blueprint.scale = options.blueprintScale;
+            matcher.addBlueprint(blueprint);
+        }
+
+        if (matcher.blueprints_.empty()) {
+            cerr << "No blueprints found in " << options.blueprintDir << endl;
+            return LM_STATUS_ERROR_GENERIC;
+        }
+        return LM_STATUS_OK;
+    }
+
+    static string jsonEscape(const string& str) {
+        string escaped;
+        for (auto charItr = str.cbegin(); charItr != str.cend(); charItr++) {
+            switch (*charItr) {
+                case '"': escaped += "\\\""; break;
+                case '\\': escaped += "\\\\"; break;
+                case '\n': escaped += "\\n"; break;
+                case '\t': escaped += "\\t"; break;
+                default:
+                    if ((unsigned char)*charItr < 0x20) {
+                        char code[8];
+                        snprintf(code, sizeof(code), "\\u%04x", *charItr);
+                        escaped += code;
+                    } else {
+                        escaped += *charItr;
+                    }
+            }
+        }
+        return escaped;
+    }
+
+    static void writeResult(ostream& out, const string& mapPath, const MapResult& result) {
+        out << "{\"map\":\"" << jsonEscape(mapPath) << "\",\"status\":" << result.status << ",\"decode_ms\":" << result.decodeSeconds * 1000 << ",\"latency_ms\":" << result.seconds * 1000 << ",\"matches\":[";
+        for (int i = 0; i < result.matches.size(); i++) {
+            const LocationMatch& match = result.matches[i];
+            out << (i > 0 ? "," : "") << "{\"name\":\"" << jsonEscape(match.name) << "\",\"x\":" << match.position.x << ",\"y\":" << match.position.y
+                << ",\"angle\":" << match.angle << ",\"certainty\":" << match.certainty << "}";
+        }
+        out << "]}\n";
+    }
+
+    // Prints the speed of every line detector backend on the maps and how many of its lines LSD also found
+    static int benchmarkDetectors(const MatchOptions& options) {
+        vector<Mat> images;
+        for (auto mapItr = options.maps.cbegin(); mapItr != options.maps.cend(); mapItr++) {
+            Mat map = imread(*mapItr, IMREAD_GRAYSCALE);
+            if (map.empty()) {
+                cerr << "Cannot read map " << *mapItr << endl;
+                return EXIT_FAILURE;
+            }
+            images.push_back(map);
+        }
+
+        vector<LineDetectorBenchmark> results;
+        if (LineDetector::benchmark(images, results) != LM_STATUS_OK) {
+            cerr << "Line detector benchmark failed" << endl;
+            return EXIT_FAILURE;
+        }
+
+        printf("%-12s %10s %12s %12s %10s\n", "detector", "lines", "seconds", "lines/s", "agreement");
+        for (auto resultItr = results.cbegin(); resultItr != results.cend(); resultItr++) {
+            printf("%-12s %10zu %12.4f %12.0f %10.3f\n", resultItr->name.c_str(), resultItr->numLines, resultItr->seconds,
+                resultItr->linesPerSecond, resultItr->agreement);
+        }
+        return EXIT_SUCCESS;
+    }
+
+    // Latency below which fraction of the sorted latencies lie
+    static double percentile(const vector<double>& sortedSeconds, double fraction) {
+        int index = min((int)sortedSeconds.size() - 1, (int)(fraction * sortedSeconds.size()));
+        return sortedSeconds[index];
+    }
+}
 
 int main(int argc, char* argv[]) {
+    MatchOptions options;
+    if (parseArgs(argc, argv, options) != LM_STATUS_OK) {
+        printUsage();
+        return EXIT_FAILURE;
+    }
+    if (options.isBenchmarkingDetectors) {
+        return benchmarkDetectors(options);
+    }
+
+    LocationMatcher matcher;
+    matcher.setMinCertainty(options.minCertainty);
+    if (loadBlueprints(options, matcher) != LM_STATUS_OK) {
+        return EXIT_FAILURE;
+    }
+
+    ofstream outputFile;
+    if (!options.outputPath.empty()) {
+        outputFile.open(options.outputPath);
+        if (!outputFile) {
+            cerr << "Cannot write " << options.outputPath << endl;
+            return EXIT_FAILURE;
+        }
+    }
+    ostream& out = options.outputPath.empty() ? cout : outputFile;
+
+    // Each worker takes the next map until none are left, using its own context so nothing is shared between calls.
+    // Results are written as each map finishes, so a long run can be followed as it goes and nothing is lost if it is stopped early.
+    vector<MapResult> results(options.maps.size());
+    atomic<int> nextMap(0);
+    mutex outMutex;
+    auto worker = [&]() {
+        unique_ptr<MatchContext> context = matcher.createContext();
+        for (int i = nextMap++; i < options.maps.size(); i = nextMap++) {
+            MapResult& result = results[i];
+            auto decodeStart = chrono::steady_clock::now();
+            Mat map = imread(options.maps[i], IMREAD_GRAYSCALE);
+            auto start = chrono::steady_clock::now();
+            result.decodeSeconds = chrono::duration<double>(start - decodeStart).count();
+            result.isDecoded = !map.empty();
+            if (!result.isDecoded) {
+                result.status = LM_STATUS_ERROR_GENERIC;
+            } else {
+                result.status = matcher.findMatch(map, options.mapScale, result.matches, *context);
+            }
+            result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+            lock_guard<mutex> lock(outMutex);
+            writeResult(out, options.maps[i], result);
+            out.flush();
+        }
+    };
+
+    auto start = chrono::steady_clock::now();
+    vector<thread> threads;
+    for (int i = 0; i < options.numThreads; i++) {
+        threads.push_back(thread(worker));
+    }
+    for (auto threadItr = threads.begin(); threadItr != threads.end(); threadItr++) {
+        threadItr->join();
+    }
+    double totalSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    // Maps which could not be decoded never reached findMatch(), so their near zero latencies would drag the percentiles down
+    int numFailed = 0;
+    vector<double> latencies;
+    double decodeSeconds = 0;
+    for (int i = 0; i < results.size(); i++) {
+        numFailed += results[i].status != LM_STATUS_OK;
+        if (results[i].isDecoded) {
+            latencies.push_back(results[i].seconds);
+        }
+        decodeSeconds += results[i].decodeSeconds;
+    }
+    sort(latencies.begin(), latencies.end());
 
-    
+    fprintf(stderr, "%zu maps against %zu blueprints on %d threads in %.3fs: %.2f maps/s, %d failed, %zu not decoded\n",
+        results.size(), matcher.blueprints_.size(), options.numThreads, totalSeconds, results.size() / totalSeconds, numFailed, results.size() - latencies.size());
+    if (!latencies.empty()) {
+        fprintf(stderr, "latency ms: p50 %.2f  p90 %.2f  p99 %.2f  max %.2f\n",
+            percentile(latencies, 0.5) * 1000, percentile(latencies, 0.9) * 1000, percentile(latencies, 0.99) * 1000, latencies.back() * 1000);
+    }
+    fprintf(stderr, "decode ms: mean %.2f\n", decodeSeconds / results.size() * 1000);
 
-    return EXIT_SUCCESS;
-}
\ No newline at end of file
+    return numFailed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,271 @@
+#include "location_matcher/trace.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+namespace lm {
+namespace trace {
+
+    const size_t RECORD_TEXT_SIZE = 240;
+    const size_t RING_SIZE = 1024;  // Records per thread. Must be a power of 2.
+    const size_t MAX_RECORDS = MAX_MESSAGE_SIZE / RECORD_TEXT_SIZE;    // A message has to fit in the ring all at once
+    static_assert(MAX_RECORDS * RECORD_TEXT_SIZE == MAX_MESSAGE_SIZE, "MAX_MESSAGE_SIZE must be a whole number of records");
+
+    // A message longer than RECORD_TEXT_SIZE is split over up to MAX_RECORDS consecutive records
+    struct Record {
+        int level;
+        int category;
+        bool continued;     // The message continues in the next record
+        uint16_t length;
+        char text[RECORD_TEXT_SIZE];
+    };
+
+    // Single producer (the thread which owns it), single consumer (whoever holds Sink::drainMutex_) ring buffer
+    class Ring {
+        public:
+        Ring() : ownerAlive(true), head_(0), tail_(0) {
+
+        }
+
+        // Pushes all of records, or none of them if there is not enough space
+        bool push(const Record* records, size_t numRecords) {
+            size_t head = head_.load(memory_order_relaxed);
+            size_t tail = tail_.load(memory_order_acquire);
+            if (RING_SIZE - (head - tail) < numRecords) {
+                return false;
+            }
+
+            for (size_t i = 0; i < numRecords; i++) {
+                records_[(head + i) & (RING_SIZE - 1)] = records[i];
+            }
+            head_.store(head + numRecords, memory_order_release);
+            return true;
+        }
+
+        bool pop(Record& record) {
+            size_t tail = tail_.load(memory_order_relaxed);
+            size_t head = head_.load(memory_order_acquire);
+            if (tail == head) {
+                return false;
+            }
+
+            record = records_[tail & (RING_SIZE - 1)];
+            tail_.store(tail + 1, memory_order_release);
+            return true;
+        }
+
+        bool empty() const {
+            return tail_.load(memory_order_acquire) == head_.load(memory_order_acquire);
+        }
+
+        atomic<bool> ownerAlive;
+
+        private:
+        array<Record, RING_SIZE> records_;
+        alignas(64) atomic<size_t> head_;
+        alignas(64) atomic<size_t> tail_;
+    };
+
+    const char* levelName(int level) {
+        switch (level) {
+            case LM_TRACE_LEVEL_ERROR:  return "ERROR";
+            case LM_TRACE_LEVEL_INFO:   return "INFO";
+            case LM_TRACE_LEVEL_DEBUG:  return "DEBUG";
+            default:                    return "TRACE";
+        }
+    }
+
+    const char* categoryName(int category) {
+        switch (category) {
+            case TRACE_DETECTOR:    return "detector";
+            case TRACE_SEGMENT:     return "segment";
+            case TRACE_MATCHER:     return "matcher";
+            case TRACE_VERIFY:      return "verify";
+            default:                return "general";
+        }
+    }
+
+    /*
+        Owns every thread's Ring and the background thread which drains them. Locks are only taken when a thread registers its Ring and on the consumer side, never when writing a message.
+    */
+    class Sink {
+        public:
+        static Sink& instance() {
+            static Sink sink;
+            return sink;
+        }
+
+        shared_ptr<Ring> registerThread() {
+            shared_ptr<Ring> ring = make_shared<Ring>();
+            lock_guard<mutex> lock(ringsMutex_);
+            rings_.push_back(ring);
+            return ring;
+        }
+
+        void setStream(ostream* stream) {
+            lock_guard<mutex> lock(drainMutex_);
+            stream_ = stream != nullptr ? stream : &clog;
+        }
+
+        void flush() {
+            drain();
+        }
+
+        void addDropped() {
+            numDropped_++;
+        }
+
+        uint64_t numDropped() const {
+            return numDropped_;
+        }
+
+        void addTruncated() {
+            numTruncated_++;
+        }
+
+        uint64_t numTruncated() const {
+            return numTruncated_;
+        }
+
+        private:
+        Sink() : stream_(&clog), running_(true), numDropped_(0), numTruncated_(0) {
+            thread_ = thread(&Sink::run, this);
+        }
+
+        ~Sink() {
+            running_ = false;
+            thread_.join();
+            drain();
+        }
+
+        void run() {
+            while (running_) {
+                drain();
+                this_thread::sleep_for(chrono::milliseconds(1));
+            }
+        }
+
+        void drain() {
+            lock_guard<mutex> drainLock(drainMutex_);
+
+            vector<shared_ptr<Ring>> rings;
+            {
+                lock_guard<mutex> lock(ringsMutex_);
+                rings = rings_;
+            }
+
+            bool wroteAny = false;
+            Record record;
+            for (auto ringItr = rings.cbegin(); ringItr != rings.cend(); ringItr++) {
+                bool messageStart = true;
+                while ((*ringItr)->pop(record)) {
+                    if (messageStart) {
+                        *stream_ << "[" << levelName(record.level) << "][" << categoryName(record.category) << "] ";
+                    }
+                    stream_->write(record.text, record.length);
+                    if (!record.continued) {
+                        *stream_ << '\n';
+                    }
+                    messageStart = !record.continued;
+                    wroteAny = true;
+                }
+            }
+            if (wroteAny) {
+                stream_->flush();
+            }
+
+            // Forget the rings of threads which have exited once they are empty
+            lock_guard<mutex> lock(ringsMutex_);
+            for (auto ringItr = rings_.begin(); ringItr != rings_.end();) {
+                if (!(*ringItr)->ownerAlive && (*ringItr)->empty()) {
+                    ringItr = rings_.erase(ringItr);
+                } else {
+                    ringItr++;
+                }
+            }
+        }
+
+        mutex ringsMutex_;      // Guards rings_
+        mutex drainMutex_;      // Makes whoever drains the only consumer of every Ring, and guards stream_
+        vector<shared_ptr<Ring>> rings_;
+        ostream* stream_;
+        atomic<bool> running_;
+        atomic<uint64_t> numDropped_;
+        atomic<uint64_t> numTruncated_;
+        thread thread_;
+    };
+
+    // Registers a Ring for the calling thread on its first message and marks it for removal when the thread exits
+    struct ThreadRing {
+        ThreadRing() : ring(Sink::instance().registerThread()) {
+
+        }
+
+        ~ThreadRing() {
+            ring->ownerAlive = false;
+        }
+
+        shared_ptr<Ring> ring;
+    };
+
+    void write(int level, int category, const std::string& message) {
+        thread_local ThreadRing threadRing;
+
+        // Anything longer than MAX_MESSAGE_SIZE is cut short to make room for the marker
+        const size_t markerSize = sizeof(TRUNCATION_MARKER) - 1;
+        const bool isTruncated = message.size() > MAX_MESSAGE_SIZE;
+        const size_t textSize = isTruncated ? MAX_MESSAGE_SIZE : message.size();
+        const size_t keptSize = isTruncated ? MAX_MESSAGE_SIZE - markerSize : message.size();
+        if (isTruncated) {
+            Sink::instance().addTruncated();
+        }
+
+        Record records[MAX_RECORDS];
+        size_t numRecords = 0;
+        size_t offset = 0;
+        do {
+            Record& record = records[numRecords++];
+            record.level = level;
+            record.category = category;
+            record.length = min(RECORD_TEXT_SIZE, textSize - offset);
+
+            // The marker follows the kept part of the message, possibly across the boundary of two records
+            for (size_t i = 0; i < record.length; i++) {
+                size_t textOffset = offset + i;
+                record.text[i] = textOffset < keptSize ? message[textOffset] : TRUNCATION_MARKER[textOffset - keptSize];
+            }
+            offset += record.length;
+            record.continued = offset < textSize;
+        } while (offset < textSize);
+
+        if (!threadRing.ring->push(records, numRecords)) {
+            Sink::instance().addDropped();
+        }
+    }
+
+    void setSink(std::ostream* stream) {
+        Sink::instance().setStream(stream);
+    }
+
+    void flush() {
+        Sink::instance().flush();
+    }
+
+    uint64_t numDropped() {
+        return Sink::instance().numDropped();
+    }
+
+    uint64_t numTruncated() {
+        return Sink::instance().numTruncated();
+    }
+}; // namespace trace
+}; // namespace lm
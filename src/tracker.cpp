@@ -0,0 +1,253 @@
+#include <cfloat>
+
+#include "location_matcher/tracker.hpp"
+
+using namespace std;
+using namespace cv;
+using namespace cv::line_descriptor;
+
+namespace lm {
+
+    TrackerThresholds::TrackerThresholds() :
+        searchRadius(0.5),
+        angleThreshold(M_PI * 10/180),
+        inlierThreshold(0.15),
+        minInlierRatio(0.5),
+        maxResidual(0.1),
+        maxIterations(10) {
+
+    }
+
+    Tracker::Tracker(const LocationMatcher& matcher, const TrackerThresholds& thresholds) :
+        matcher_(matcher),
+        thresholds_(thresholds),
+        lineDetector_(matcher.lineDetector_),
+        usedGlobalSearch_(false),
+        residual_(0) {
+
+    }
+
+    LmStatus Tracker::track(const cv::Mat& imageIn, float mapScale, LocationMatch& matchInOut) {
+        usedGlobalSearch_ = false;
+
+        auto blueprintItr = matcher_.blueprints_.find(matchInOut.name);
+        if (blueprintItr == matcher_.blueprints_.end()) {
+            return LM_STATUS_ERROR_GENERIC;
+        }
+        float imageScale = mapScale > 0 ? mapScale : blueprintItr->second.scale;
+
+        lines_.clear();
+        lineDetector_.detect(imageIn, lines_);
+        scaleKeyLines(lines_, imageScale, metricLines_);
+
+        if (refine(metricLines_, mapScale, matchInOut) == LM_STATUS_OK) {
+            return LM_STATUS_OK;
+        }
+
+        // Lost track, so search the whole map and continue from the best match of this blueprint
+        usedGlobalSearch_ = true;
+        vector<LocationMatch> matches;
+        matcher_.findMatch(imageIn, mapScale, matches);
+
+        const LocationMatch* bestMatch = nullptr;
+        for (auto matchItr = matches.cbegin(); matchItr != matches.cend(); matchItr++) {
+            if (matchItr->name == matchInOut.name && (bestMatch == nullptr || matchItr->certainty > bestMatch->certainty)) {
+                bestMatch = &*matchItr;
+            }
+        }
+        if (bestMatch == nullptr) {
+            return LM_STATUS_ERROR_MATCH_FAILED;
+        }
+
+        // The pose of a global match is only as accurate as the lines it was computed from, so it is refined too if possible
+        matchInOut = *bestMatch;
+        refine(metricLines_, mapScale, matchInOut);
+        return LM_STATUS_OK;
+    }
+
+    LmStatus Tracker::refine(const KeyLines& mapLines, float mapScale, LocationMatch& matchInOut) {
+        auto blueprintItr = matcher_.blueprints_.find(matchInOut.name);
+        if (blueprintItr == matcher_.blueprints_.end()) {
+            return LM_STATUS_ERROR_GENERIC;
+        }
+        const Blueprint& blueprint = blueprintItr->second;
+        const CompiledBlueprint& compiled = matcher_.compiledBlueprints_.at(blueprintItr->first);
+        float imageScale = mapScale > 0 ? mapScale : blueprint.scale;
+
+        // Index the map lines by the midpoints of their pieces
+        pieceMidpoints_.clear();
+        pieceLines_.clear();
+        for (int i = 0; i < mapLines.size(); i++) {
+            Point2f start = mapLines[i].getStartPoint();
+            Point2f end = mapLines[i].getEndPoint();
+            int numPieces = max(1, (int)ceil(dist(start, end) / TRACKER_PIECE_LENGTH));
+            for (int j = 0; j < numPieces; j++) {
+                pieceMidpoints_.push_back(start + (end - start) * ((j + 0.5f) / numPieces));
+                pieceLines_.push_back(i);
+            }
+        }
+        pieceTree_.build(pieceMidpoints_);
+
+        // Ends of each blueprint line relative to the centroid, in metres
+        vector<Point2f> blueprintEnds;
+        float totalLength = 0;
+        for (auto lineItr = compiled.lines.cbegin(); lineItr != compiled.lines.cend(); lineItr++) {
+            blueprintEnds.push_back((lineItr->getStartPoint() - blueprint.centroid) * blueprint.scale);
+            blueprintEnds.push_back((lineItr->getEndPoint() - blueprint.centroid) * blueprint.scale);
+            totalLength += dist(blueprintEnds[blueprintEnds.size() - 2], blueprintEnds.back());
+        }
+        if (totalLength <= 0) {
+            return LM_STATUS_ERROR_MATCH_FAILED;
+        }
+
+        // Gauss-Newton on the pose. Rotation is about the centroid, so the position and angle updates are nearly independent.
+        float angle = matchInOut.angle;
+        Point2f position = matchInOut.position * imageScale;
+        float inlierLength = 0;
+        float residual = 0;
+        for (int iteration = 0; ; iteration++) {
+            double hessian[3][3] = {};
+            double gradient[3] = {};
+            accumulate(mapLines, blueprintEnds, angle, position, hessian, gradient, inlierLength, residual);
+            if (iteration == thresholds_.maxIterations) {
+                break;
+            }
+
+            // Damping keeps the update bounded along directions the lines do not constrain, such as along a single straight wall
+            const double damping = 1e-6 * (hessian[0][0] + hessian[1][1] + hessian[2][2]) + 1e-12;
+            for (int i = 0; i < 3; i++) {
+                hessian[i][i] += damping;
+            }
+
+            // Solve hessian * delta = -gradient by Cramer's rule
+            auto det3 = [](const double m[3][3]) {
+                return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+                     - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+                     + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+            };
+            double det = det3(hessian);
+            if (det == 0) {
+                break;
+            }
+            double delta[3];
+            for (int k = 0; k < 3; k++) {
+                double replaced[3][3];
+                for (int i = 0; i < 3; i++) {
+                    for (int j = 0; j < 3; j++) {
+                        replaced[i][j] = j == k ? -gradient[i] : hessian[i][j];
+                    }
+                }
+                delta[k] = det3(replaced) / det;
+            }
+
+            angle += delta[0];
+            position += Point2f(delta[1], delta[2]);
+
+            const double minStep = 1e-5;
+            if (abs(delta[0]) < minStep && abs(delta[1]) < minStep && abs(delta[2]) < minStep) {
+                accumulate(mapLines, blueprintEnds, angle, position, hessian, gradient, inlierLength, residual);
+                break;
+            }
+        }
+        residual_ = residual;
+
+        float inlierRatio = inlierLength / totalLength;
+        if (inlierRatio < thresholds_.minInlierRatio || residual > thresholds_.maxResidual) {
+            return LM_STATUS_ERROR_MATCH_FAILED;
+        }
+
+        matchInOut.angle = angleDiff(angle, 0);
+        matchInOut.position = position / imageScale;
+        matchInOut.certainty = inlierRatio;
+        return LM_STATUS_OK;
+    }
+
+    void Tracker::accumulate(
+        const KeyLines& mapLines,
+        const vector<Point2f>& blueprintEnds,
+        float angle,
+        Point2f position,
+        double hessian[3][3],
+        double gradient[3],
+        float& inlierLengthOut,
+        float& residualOut) const {
+
+        inlierLengthOut = 0;
+        double inlierSquares = 0;
+        int numInlierEnds = 0;
+
+        pmr::vector<int> candidates;
+        for (int i = 0; i + 1 < blueprintEnds.size(); i += 2) {
+            Point2f ends[2] = {
+                position + rotateVector(blueprintEnds[i], angle),
+                position + rotateVector(blueprintEnds[i + 1], angle)
+            };
+            Point2f midpoint = (ends[0] + ends[1]) / 2;
+            float length = dist(ends[0], ends[1]);
+            if (length == 0) {
+                continue;
+            }
+            float lineAngle = atan2(ends[1].y - ends[0].y, ends[1].x - ends[0].x);
+
+            // The nearest parallel map line. A piece midpoint can be up to half a piece along the wall from the blueprint line midpoint.
+            candidates.clear();
+            pieceTree_.radiusSearch(midpoint, thresholds_.searchRadius + TRACKER_PIECE_LENGTH / 2, candidates);
+            int bestLine = -1;
+            Point2f bestNormal;
+            float bestOffset = 0;
+            float bestDist = thresholds_.searchRadius;
+            for (auto candidateItr = candidates.cbegin(); candidateItr != candidates.cend(); candidateItr++) {
+                const KeyLine& mapLine = mapLines[pieceLines_[*candidateItr]];
+                Point2f direction = mapLine.getEndPoint() - mapLine.getStartPoint();
+                float mapLength = sqrt(direction.dot(direction));
+                if (mapLength == 0 || abs(fastAngleDiff(lineAngle, atan2(direction.y, direction.x), M_PI)) > thresholds_.angleThreshold) {
+                    continue;
+                }
+                Point2f normal(-direction.y / mapLength, direction.x / mapLength);
+                float offset = normal.dot(mapLine.getStartPoint());
+                float lineDist = abs(normal.dot(midpoint) - offset);
+                if (lineDist <= bestDist) {
+                    bestLine = pieceLines_[*candidateItr];
+                    bestNormal = normal;
+                    bestOffset = offset;
+                    bestDist = lineDist;
+                }
+            }
+            if (bestLine < 0) {
+                continue;
+            }
+
+            // Residual of each end is its signed distance from the map line. Moving the position moves it along the normal, and rotating about the centroid moves it along the perpendicular of its offset from the centroid. Longer lines are weighted more.
+            bool isInlier = true;
+            double endSquares = 0;
+            for (int k = 0; k < 2; k++) {
+                Point2f fromCentroid = ends[k] - position;
+                double r = bestNormal.dot(ends[k]) - bestOffset;
+                double jacobian[3] = {bestNormal.dot(Point2f(-fromCentroid.y, fromCentroid.x)), bestNormal.x, bestNormal.y};
+                for (int a = 0; a < 3; a++) {
+                    gradient[a] += length * jacobian[a] * r;
+                    for (int b = 0; b < 3; b++) {
+                        hessian[a][b] += length * jacobian[a] * jacobian[b];
+                    }
+                }
+                isInlier = isInlier && abs(r) <= thresholds_.inlierThreshold;
+                endSquares += r * r;
+            }
+            if (isInlier) {
+                inlierLengthOut += length;
+                inlierSquares += endSquares;
+                numInlierEnds += 2;
+            }
+        }
+
+        residualOut = numInlierEnds > 0 ? sqrt(inlierSquares / numInlierEnds) : FLT_MAX;
+    }
+
+    bool Tracker::usedGlobalSearch() const {
+        return usedGlobalSearch_;
+    }
+
+    float Tracker::residual() const {
+        return residual_;
+    }
+}
@@ -20,18 +20,32 @@ namespace lm{
         return kl;
     }
 
+    void scaleKeyLines(KeyLinesIn linesIn, float scale, KeyLinesOut linesOut) {
+        linesOut.clear();
+        for (auto lineItr = linesIn.cbegin(); lineItr != linesIn.cend(); lineItr++) {
+            KeyLine kl = *lineItr;
+            kl.startPointX  *= scale;
+            kl.startPointY  *= scale;
+            kl.endPointX    *= scale;
+            kl.endPointY    *= scale;
+            kl.pt           *= scale;
+            kl.lineLength   *= scale;
+            linesOut.push_back(kl);
+        }
+    }
+
     cv::Point2f rotateVector(cv::Point2f vec, float angle) {
         return Point2f( vec.x*cos(angle) - vec.y*sin(angle),
                         vec.x*sin(angle) + vec.y*cos(angle));
     }
 
-    LineJoint isJoinedTo(const cv::line_descriptor::KeyLine& line1,
-                         const cv::line_descriptor::KeyLine& line2,
+    LineJoint isJoinedTo(const Line& line1,
+                         const Line& line2,
                          float distThreshold) {
-        Point2f start1(line1.startPointX, line1.startPointY);
-        Point2f start2(line2.startPointX, line2.startPointY);
-        Point2f end1(line1.endPointX, line1.endPointY);
-        Point2f end2(line2.endPointX, line2.endPointY);
+        Point2f start1 = line1.getStartPoint();
+        Point2f start2 = line2.getStartPoint();
+        Point2f end1 = line1.getEndPoint();
+        Point2f end2 = line2.getEndPoint();
         
         return dist(start1, start2) <= distThreshold ? LINE_JOINT_SS :
                dist(start1, end2)   <= distThreshold ? LINE_JOINT_SE :
@@ -0,0 +1,78 @@
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include "location_matcher/angle_math.hpp"
+#include "location_matcher/core.hpp"
+
+using namespace testing;
+using namespace std;
+
+namespace lm {
+
+    class AngleMathTest : public ::testing::Test {
+        public:
+        // Angles from -range to range
+        vector<float> getAngles(float range, int numAngles) {
+            vector<float> angles;
+            for (int i = 0; i < numAngles; i++) {
+                angles.push_back(-range + 2 * range * i / (numAngles - 1));
+            }
+            return angles;
+        }
+    };
+
+    TEST_F(AngleMathTest, atan2) {
+        vector<float> y, x;
+        for (int i = -50; i <= 50; i++) {
+            for (int j = -50; j <= 50; j++) {
+                y.push_back(i * 0.37f);
+                x.push_back(j * 0.29f);
+            }
+        }
+
+        vector<float> angles(y.size());
+        atan2Batch(y.data(), x.data(), angles.data(), y.size());
+        for (int i = 0; i < y.size(); i++) {
+            EXPECT_NEAR(atan2(y[i], x[i]), angles[i], FAST_ATAN2_MAX_ERROR);
+            EXPECT_EQ(fastAtan2(y[i], x[i]), angles[i]);
+        }
+
+        EXPECT_EQ(0, fastAtan2(0, 0));
+    }
+
+    TEST_F(AngleMathTest, sinCos) {
+        vector<float> angles = getAngles(FAST_SINCOS_MAX_ANGLE, 100001);
+        vector<float> sins(angles.size()), coss(angles.size());
+        sinCosBatch(angles.data(), sins.data(), coss.data(), angles.size());
+        for (int i = 0; i < angles.size(); i++) {
+            EXPECT_NEAR(sin(angles[i]), sins[i], FAST_SINCOS_MAX_ERROR);
+            EXPECT_NEAR(cos(angles[i]), coss[i], FAST_SINCOS_MAX_ERROR);
+        }
+    }
+
+    TEST_F(AngleMathTest, angleDiff) {
+        vector<float> angles1 = getAngles(3 * M_PI, 1001);
+        vector<float> angles2(angles1.rbegin(), angles1.rend());
+        vector<float> diffs(angles1.size());
+
+        const float periods[2] = {2*M_PI, M_PI};
+        for (int p = 0; p < 2; p++) {
+            float period = periods[p];
+            angleDiffBatch(angles1.data(), angles2.data(), diffs.data(), angles1.size(), period);
+            for (int i = 0; i < angles1.size(); i++) {
+                EXPECT_LE(-period/2 - 1e-5, diffs[i]);
+                EXPECT_GE(period/2 + 1e-5, diffs[i]);
+
+                // Equal to angleDiff() modulo the period, which only differs at +-period/2
+                float error = fastWrap(diffs[i] - angleDiff(angles1[i], angles2[i], period), period);
+                EXPECT_NEAR(0, error, 1e-5);
+            }
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,63 @@
+#include <gtest/gtest.h>
+
+#include <array>
+#include <list>
+#include <vector>
+
+#include "location_matcher/arena.hpp"
+
+using namespace testing;
+using namespace std;
+
+namespace lm {
+
+    class ArenaTest : public ::testing::Test {
+        public:
+        // Allocates roughly numElements * 64 bytes of list nodes from arena
+        void fill(Arena& arena, int numElements) {
+            pmr::list<array<char, 40>> data(arena.resource());
+            for (int i = 0; i < numElements; i++) {
+                data.emplace_back();
+            }
+        }
+    };
+
+    TEST_F(ArenaTest, fitsInBuffer) {
+        Arena arena(1 << 16);
+        fill(arena, 100);
+
+        EXPECT_EQ(0, arena.overflowBytes());
+        EXPECT_EQ(1 << 16, arena.capacity());
+    }
+
+    TEST_F(ArenaTest, resetReusesBuffer) {
+        Arena arena(1 << 16);
+        void* first = arena.resource()->allocate(128, 8);
+        arena.reset();
+        void* second = arena.resource()->allocate(128, 8);
+
+        EXPECT_EQ(first, second);
+        EXPECT_EQ(0, arena.overflowBytes());
+    }
+
+    TEST_F(ArenaTest, growsToHighWaterMark) {
+        Arena arena(1 << 10);
+
+        // The first call overflows the buffer
+        fill(arena, 1000);
+        EXPECT_LT(0, arena.overflowBytes());
+
+        // After reset the buffer is large enough for the same amount of work
+        arena.reset();
+        EXPECT_LT(1 << 10, arena.capacity());
+        EXPECT_EQ(0, arena.overflowBytes());
+
+        fill(arena, 1000);
+        EXPECT_EQ(0, arena.overflowBytes());
+    }
+}
+
+int main(int argc, char* argv[]) {
+    InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,152 @@
+#include <gtest/gtest.h>
+
+#include <deque>
+
+#include "test/test_datasets.hpp"
+#include "location_matcher/utils.hpp"
+#include "location_matcher/blueprint_index.hpp"
+
+using namespace testing;
+using namespace std;
+using namespace cv;
+using namespace cv::line_descriptor;
+
+namespace lm {
+    class BlueprintIndexTest : public BaseTest {
+        public:
+        void SetUp() override {
+            BaseTest::SetUp();
+
+            const KeyLines* blueprintLines[] = {&lines1_, &lines2_, &lines3_, &lines4_, &lines5_};
+            for (int i = 0; i < sizeof(blueprintLines) / sizeof(blueprintLines[0]); i++) {
+                blueprints_.emplace_back();
+                blueprints_.back().addLines(*blueprintLines[i]);
+                index_.add(i, blueprints_.back());
+            }
+            index_.finalize();
+
+            // The map contains two of the blueprints
+            KeyLines mapLines = lines4_;
+            mapLines.insert(mapLines.end(), lines2_.begin(), lines2_.end());
+            map_.addLines(mapLines);
+        }
+
+        // Length entries of index, in their stored order
+        static const auto& lengths(const BlueprintIndex& index) {
+            return index.lengths_;
+        }
+
+        deque<Segments> blueprints_;
+        Segments map_;
+        BlueprintIndex index_;
+    };
+
+    TEST_F(BlueprintIndexTest, findCandidates) {
+        const float lengthThreshold = MatchThresholds().lengthThreshold;
+        pmr::vector<IndexCandidate> candidates;
+        index_.findCandidates(map_, lengthThreshold, candidates);
+        EXPECT_FALSE(candidates.empty());
+
+        // Same pairs, in the same order, as checking every pair with mayMatch()
+        vector<tuple<int, int, int>> expected;
+        for (int b = 0; b < blueprints_.size(); b++) {
+            for (int j = 0; j < blueprints_[b].data().size(); j++) {
+                for (int i = 0; i < map_.data().size(); i++) {
+                    if (map_.data()[i]->mayMatch(*blueprints_[b].data()[j], lengthThreshold)) {
+                        expected.push_back(make_tuple(b, j, i));
+                    }
+                }
+            }
+        }
+
+        ASSERT_EQ(expected.size(), candidates.size());
+        for (int k = 0; k < candidates.size(); k++) {
+            EXPECT_EQ(expected[k], make_tuple(candidates[k].blueprint, candidates[k].blueprintSegment, candidates[k].mapSegment));
+        }
+    }
+
+    TEST_F(BlueprintIndexTest, finalizeIncrementally) {
+        // Adding the blueprints in several batches, finalizing after each, gives the same lengths as adding them all at once
+        BlueprintIndex incremental;
+        for (int b = 0; b < blueprints_.size(); b++) {
+            incremental.add(b, blueprints_[b]);
+            EXPECT_FALSE(incremental.isFinalized());
+            if (b % 2 == 0) {
+                incremental.finalize();
+                EXPECT_TRUE(incremental.isFinalized());
+            }
+        }
+        incremental.finalize();
+
+        ASSERT_EQ(lengths(index_).size(), lengths(incremental).size());
+        for (int k = 0; k < lengths(index_).size(); k++) {
+            EXPECT_EQ(lengths(index_)[k].length, lengths(incremental)[k].length);
+            EXPECT_EQ(lengths(index_)[k].segment, lengths(incremental)[k].segment);
+        }
+
+        pmr::vector<IndexCandidate> candidates, incrementalCandidates;
+        index_.findCandidates(map_, MatchThresholds().lengthThreshold, candidates);
+        incremental.findCandidates(map_, MatchThresholds().lengthThreshold, incrementalCandidates);
+        EXPECT_EQ(candidates.size(), incrementalCandidates.size());
+    }
+
+    TEST_F(BlueprintIndexTest, matchCandidates) {
+        const MatchThresholds thresholds;
+        pmr::vector<IndexCandidate> candidates;
+        pmr::vector<uint64_t> fingerprints;
+        index_.findCandidates(map_, thresholds.lengthThreshold, candidates);
+        index_.fingerprint(map_, fingerprints);
+        ASSERT_EQ(map_.data().size(), fingerprints.size());
+
+        // Runs of all the candidates are found at once, then looked up in the cache the second time
+        MatchCache cache;
+        TrieScratch trieScratch;
+        pmr::vector<SegmentRun> trieRuns;
+        index_.findRuns(map_, fingerprints, candidates.data(), candidates.data() + candidates.size(), thresholds.lengthThreshold, cache, trieScratch, trieRuns);
+        EXPECT_EQ(0, cache.numHits());
+        pmr::vector<SegmentRun> runs;
+        index_.findRuns(map_, fingerprints, candidates.data(), candidates.data() + candidates.size(), thresholds.lengthThreshold, cache, trieScratch, runs);
+        EXPECT_EQ(candidates.size(), cache.numHits());
+        EXPECT_EQ(trieRuns.size(), runs.size());
+
+        // Each blueprint's range of candidates gives the same matches as matching the blueprint on its own
+        const IndexCandidate* candidateItr = candidates.data();
+        const IndexCandidate* candidatesEnd = candidates.data() + candidates.size();
+        for (int b = 0; b < blueprints_.size(); b++) {
+            const IndexCandidate* blueprintCandidatesEnd = candidateItr;
+            while (blueprintCandidatesEnd != candidatesEnd && blueprintCandidatesEnd->blueprint == b) {
+                blueprintCandidatesEnd++;
+            }
+
+            vector<SegmentMatch> expected, matches;
+            MatchCache expectedCache;
+            map_.matchSegments(blueprints_[b], expected, thresholds, expectedCache);
+            EXPECT_EQ(LM_STATUS_OK, index_.matchCandidates(map_, candidateItr, blueprintCandidatesEnd, runs, matches, thresholds));
+            candidateItr = blueprintCandidatesEnd;
+
+            ASSERT_EQ(expected.size(), matches.size()) << "blueprint " << b;
+            for (int k = 0; k < matches.size(); k++) {
+                EXPECT_EQ(expected[k].segment1Index[0], matches[k].segment1Index[0]);
+                EXPECT_EQ(expected[k].segment1Index[1], matches[k].segment1Index[1]);
+                EXPECT_EQ(expected[k].segment2Index[0], matches[k].segment2Index[0]);
+                EXPECT_EQ(expected[k].segment2Index[1], matches[k].segment2Index[1]);
+            }
+        }
+        EXPECT_EQ(candidatesEnd, candidateItr);
+    }
+
+    TEST_F(BlueprintIndexTest, clear) {
+        EXPECT_LT(0, index_.size());
+        index_.clear();
+        EXPECT_EQ(0, index_.size());
+
+        pmr::vector<IndexCandidate> candidates;
+        index_.findCandidates(map_, MatchThresholds().lengthThreshold, candidates);
+        EXPECT_TRUE(candidates.empty());
+    }
+}
+
+int main(int argc, char* argv[]) {
+    InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
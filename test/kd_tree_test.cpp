@@ -0,0 +1,77 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cfloat>
+#include <random>
+
+#include "location_matcher/kd_tree.hpp"
+
+using namespace testing;
+using namespace std;
+using namespace cv;
+
+namespace lm {
+    class KdTreeTest : public Test {
+        public:
+        void SetUp() override {
+            mt19937 rng(1);
+            uniform_real_distribution<float> coord(-10, 10);
+            for (int i = 0; i < 500; i++) {
+                points_.push_back(Point2f(coord(rng), coord(rng)));
+            }
+            // Duplicates must not be lost
+            points_.push_back(points_[0]);
+        }
+
+        vector<Point2f> points_;
+    };
+
+    TEST_F(KdTreeTest, radiusSearch) {
+        KdTree tree;
+        tree.build(points_);
+        ASSERT_EQ(points_.size(), tree.size());
+
+        const Point2f queries[] = {Point2f(0, 0), points_[0], Point2f(9.5, -9.5), Point2f(100, 100)};
+        for (auto queryItr = begin(queries); queryItr != end(queries); queryItr++) {
+            pmr::vector<int> found;
+            tree.radiusSearch(*queryItr, 2, found);
+            sort(found.begin(), found.end());
+
+            vector<int> expected;
+            for (int i = 0; i < points_.size(); i++) {
+                Point2f diff = points_[i] - *queryItr;
+                if (diff.dot(diff) <= 4) {
+                    expected.push_back(i);
+                }
+            }
+            EXPECT_EQ(expected, vector<int>(found.begin(), found.end()));
+        }
+    }
+
+    TEST_F(KdTreeTest, nearest) {
+        KdTree tree;
+        EXPECT_EQ(-1, tree.nearest(Point2f(0, 0)));
+
+        tree.build(points_);
+        mt19937 rng(2);
+        uniform_real_distribution<float> coord(-12, 12);
+        for (int i = 0; i < 100; i++) {
+            Point2f query(coord(rng), coord(rng));
+            float bestDist = FLT_MAX;
+            for (int j = 0; j < points_.size(); j++) {
+                Point2f diff = points_[j] - query;
+                bestDist = min(bestDist, diff.dot(diff));
+            }
+
+            int nearest = tree.nearest(query);
+            ASSERT_GE(nearest, 0);
+            Point2f diff = points_[nearest] - query;
+            EXPECT_FLOAT_EQ(bestDist, diff.dot(diff));
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -91,6 +91,48 @@ namespace lm {
         EXPECT_EQ(true, imwriteSucess); 
     }
 
+    // Every backend reports the angle from the start point to the end point
+    static void expectAngleConvention(LineDetectorType type, const Mat& img) {
+        LineDetector detector(type);
+
+        KeyLines lines;
+        EXPECT_EQ(LM_STATUS_OK, detector.detect(img, lines));
+        EXPECT_FALSE(lines.empty());
+
+        for (auto lineItr = lines.cbegin(); lineItr != lines.cend(); lineItr++) {
+            Point2f lineVec = lineItr->getEndPoint() - lineItr->getStartPoint();
+            EXPECT_NEAR(atan2(lineVec.y, lineVec.x), lineItr->angle, 1e-5);
+        }
+    }
+
+    TEST_F(LineDetectorTest, angleConvention){
+        expectAngleConvention(LINE_DETECTOR_LSD, testImg2_);
+    }
+
+    // EDLines is unstable (see TODO), so the cases which run it are disabled. Run them with --gtest_also_run_disabled_tests.
+    TEST_F(LineDetectorTest, DISABLED_angleConventionEdLines){
+        expectAngleConvention(LINE_DETECTOR_EDLINES, testImg2_);
+    }
+
+    TEST_F(LineDetectorTest, DISABLED_benchmark){
+        vector<Mat> images = {testImg1_, testImg2_, testImg4_, testImg5_};
+        vector<LineDetectorBenchmark> results;
+
+        EXPECT_EQ(LM_STATUS_OK, LineDetector::benchmark(images, results));
+        ASSERT_EQ(LINE_DETECTOR_NUM_TYPES, results.size());
+
+        // The first backend is the reference, so it always agrees with itself
+        EXPECT_EQ("LSD", results[0].name);
+        EXPECT_EQ(1.0, results[0].agreement);
+
+        for (auto resultItr = results.cbegin(); resultItr != results.cend(); resultItr++) {
+            EXPECT_LT(0, resultItr->numLines);
+            EXPECT_LT(0, resultItr->linesPerSecond);
+            EXPECT_LE(0, resultItr->agreement);
+            EXPECT_GE(1, resultItr->agreement);
+        }
+    }
+
 }   // namespace lm
 
 int main(int argc, char* argv[]) {
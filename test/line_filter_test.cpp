@@ -108,6 +108,31 @@ namespace lm {
         EXPECT_EQ(false, isEqualToInput);
         EXPECT_EQ(LM_STATUS_OK, status);
     }
+
+    TEST_F(LineFilterTest, bitmapFilterByLine) {
+        // Every cell occupied, so only the cells of the lines which are kept remain
+        OccupancyBitmap occupied(100, 100);
+        for (int y = 0; y < occupied.rows(); y++) {
+            occupied.setRange(y, 0, occupied.cols() - 1);
+        }
+
+        OccupancyBitmap filtered;
+        EXPECT_EQ(LM_STATUS_OK, lf->filterByLine(occupied, filtered, lines2_, 5));
+
+        // Only the lines of lengths 36 and 39 are within the range of 30 to 40
+        OccupancyBitmap expected(occupied.rows(), occupied.cols());
+        expected.fillLine(lines2_[1].getStartPoint(), lines2_[1].getEndPoint(), 2.5);
+        expected.fillLine(lines2_[2].getStartPoint(), lines2_[2].getEndPoint(), 2.5);
+        ASSERT_LT(0, expected.count());
+        EXPECT_EQ(expected.count(), filtered.count());
+        EXPECT_EQ(LM_STATUS_OK, expected.andWith(filtered));
+        EXPECT_EQ(filtered.count(), expected.count());
+
+        // Free cells stay free
+        OccupancyBitmap free(100, 100);
+        EXPECT_EQ(LM_STATUS_OK, lf->filterByLine(free, filtered, lines2_, 5));
+        EXPECT_EQ(0, filtered.count());
+    }
 }
 
 int main(int argc, char* argv[]) {
@@ -0,0 +1,137 @@
+#include <gtest/gtest.h>
+
+#include "test/test_datasets.hpp"
+#include "location_matcher/utils.hpp"
+#include "location_matcher/line_graph.hpp"
+
+using namespace testing;
+using namespace std;
+using namespace cv;
+using namespace cv::line_descriptor;
+
+namespace lm {
+    class LineGraphTest : public BaseTest {
+        public:
+        void SetUp() override {
+            BaseTest::SetUp();
+
+            // A wall with a second wall branching off its middle
+            tLines_.push_back(getKeyLine(0, 0, 50, 0));
+            tLines_.push_back(getKeyLine(50, 0, 100, 0));
+            tLines_.push_back(getKeyLine(50, 0, 50, 40));
+        }
+
+        // Number of matches in matches whose segment1 consists of lines in order
+        int countMatches(const vector<SegmentMatch>& matches, const KeyLines& lines) {
+            int count = 0;
+            for (auto matchItr = matches.cbegin(); matchItr != matches.cend(); matchItr++) {
+                const auto& data = matchItr->segment1.data();
+                if (data.size() != lines.size()) {
+                    continue;
+                }
+
+                bool isEqual = true;
+                auto lineItr = lines.cbegin();
+                for (auto dataItr = data.cbegin(); dataItr != data.cend(); dataItr++, lineItr++) {
+                    isEqual = isEqual && dist(dataItr->pt, Line(*lineItr).pt) < 1;
+                }
+                count += isEqual;
+            }
+            return count;
+        }
+
+        KeyLines tLines_;
+    };
+
+    TEST_F(LineGraphTest, addLinesJunction) {
+        LineGraph graph;
+        EXPECT_EQ(LM_STATUS_OK, graph.addLines(tLines_));
+
+        EXPECT_EQ(3, graph.lines().size());
+        ASSERT_EQ(4, graph.nodes().size());
+
+        // Every line meets at (50, 0)
+        int junctionCount = 0;
+        for (int node = 0; node < graph.nodes().size(); node++) {
+            if (dist(graph.nodes()[node], Point2f(50, 0)) < 1) {
+                EXPECT_EQ(3, graph.degree(node));
+                junctionCount++;
+            } else {
+                EXPECT_EQ(1, graph.degree(node));
+            }
+        }
+        EXPECT_EQ(1, junctionCount);
+
+        EXPECT_EQ(LM_STATUS_OK, graph.clear());
+        EXPECT_EQ(0, graph.lines().size());
+        EXPECT_EQ(0, graph.nodes().size());
+    }
+
+    TEST_F(LineGraphTest, addLinesAcrossCells) {
+        // Nodes are bucketed in cells the size of the join distance. Ends either side of a cell boundary are still joined, to the nearest node.
+        MatchThresholds thresholds;
+        thresholds.joinDistThreshold = 5;
+        KeyLines lines;
+        lines.push_back(getKeyLine(-30, 4.9, 4.9, 4.9));
+        lines.push_back(getKeyLine(5.1, 5.1, 5.1, 40));
+        lines.push_back(getKeyLine(8, 6, 40, 6));
+
+        LineGraph graph;
+        EXPECT_EQ(LM_STATUS_OK, graph.addLines(lines, thresholds));
+        EXPECT_EQ(3, graph.lines().size());
+        ASSERT_EQ(4, graph.nodes().size());
+        EXPECT_EQ(3, graph.degree(1));
+
+        // A smaller join distance in a later call still finds the nodes added before it
+        thresholds.joinDistThreshold = 1;
+        EXPECT_EQ(LM_STATUS_OK, graph.addLines(KeyLines({getKeyLine(40.5, 6.5, 40.5, 30)}), thresholds));
+        EXPECT_EQ(5, graph.nodes().size());
+        EXPECT_EQ(2, graph.degree(3));
+    }
+
+    TEST_F(LineGraphTest, matchThroughJunction) {
+        LineGraph graph;
+        graph.addLines(tLines_);
+
+        // The corner between the left wall and the branch
+        Segments corner;
+        corner.addLines(KeyLines({tLines_[0], tLines_[2]}));
+
+        vector<SegmentMatch> matches;
+        EXPECT_EQ(LM_STATUS_OK, graph.matchSegments(corner, matches));
+
+        // The corner is found once, through the junction, whichever order its lines are stored in
+        EXPECT_EQ(1, countMatches(matches, KeyLines({tLines_[0], tLines_[2]})) + countMatches(matches, KeyLines({tLines_[2], tLines_[0]})));
+        for (auto matchItr = matches.cbegin(); matchItr != matches.cend(); matchItr++) {
+            EXPECT_EQ(2, matchItr->segment1.data().size());
+        }
+    }
+
+    TEST_F(LineGraphTest, matchWithoutJunctions) {
+        // Without junctions the graph finds the same matches as Segments
+        LineGraph graph;
+        graph.addLines(lines4_);
+        Segments wall, section;
+        wall.addLines(lines4_);
+        section.addLines(lines3_);
+
+        vector<SegmentMatch> graphMatches, segmentsMatches;
+        graph.matchSegments(section, graphMatches);
+        wall.matchSegments(section, segmentsMatches);
+
+        ASSERT_EQ(segmentsMatches.size(), graphMatches.size());
+        for (auto matchItr = segmentsMatches.cbegin(); matchItr != segmentsMatches.cend(); matchItr++) {
+            KeyLines lines;
+            for (auto lineItr = matchItr->segment1.data().cbegin(); lineItr != matchItr->segment1.data().cend(); lineItr++) {
+                lines.push_back(lineItr->toKeyLine());
+            }
+            KeyLines reversedLines(lines.rbegin(), lines.rend());
+            EXPECT_EQ(1, countMatches(graphMatches, lines) + countMatches(graphMatches, reversedLines));
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
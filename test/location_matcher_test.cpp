@@ -1,5 +1,7 @@
 #include <gtest/gtest.h>
 
+#include <thread>
+
 #include <opencv2/highgui.hpp>
 
 #include "test/test_datasets.hpp"
@@ -25,6 +27,47 @@ namespace lm {
             
         }
 
+        // filterMatches() as first written, with a summed-area table of the mask, as the reference for the packed versions
+        void summedAreaFilter(const Mat& mask, vector<LocationMatch>& matchesInOut) {
+            const int wallTolerance = 3;
+            const float maxFreeRatio = 0.2;
+            const int boxSize = 2*wallTolerance + 1;
+            const int boxArea = boxSize * boxSize;
+
+            Mat explored, summedArea;
+            threshold(mask, explored, 127, 1, THRESH_BINARY);
+            integral(explored, summedArea, CV_32S);
+            const Rect imageRect(0, 0, mask.cols, mask.rows);
+
+            auto isMatchValid = [&](const LocationMatch& match) {
+                const Blueprint& blueprint = matcher.blueprints_.at(match.name);
+                const KeyLines& lines = matcher.compiledBlueprints_.at(match.name).lines;
+                int numSamples = 0;
+                int numFree = 0;
+                for (auto lineItr = lines.cbegin(); lineItr != lines.cend(); lineItr++) {
+                    Point2f start = matcher.blueprintToImage(blueprint, match, lineItr->getStartPoint());
+                    Point2f end = matcher.blueprintToImage(blueprint, match, lineItr->getEndPoint());
+                    int lineSamples = max(1, (int)ceil(dist(start, end) / boxSize));
+                    for (int i = 0; i <= lineSamples; i++) {
+                        Point2f pt = start + (end - start) * ((float)i / lineSamples);
+                        Rect box(cvRound(pt.x) - wallTolerance, cvRound(pt.y) - wallTolerance, boxSize, boxSize);
+                        numSamples++;
+                        if ((box & imageRect).area() == boxArea) {
+                            int sum = summedArea.at<int>(box.y + box.height, box.x + box.width) - summedArea.at<int>(box.y, box.x + box.width)
+                                - summedArea.at<int>(box.y + box.height, box.x) + summedArea.at<int>(box.y, box.x);
+                            numFree += sum == boxArea;
+                        }
+                    }
+                }
+                return numSamples == 0 || (float)numFree / numSamples <= maxFreeRatio;
+            };
+
+            auto newEnd = remove_if(matchesInOut.begin(), matchesInOut.end(), [&](const LocationMatch& match) {
+                return !isMatchValid(match);
+            });
+            matchesInOut.erase(newEnd, matchesInOut.end());
+        }
+
         LocationMatcher matcher;
 
         Blueprint bp3_;
@@ -32,7 +75,7 @@ namespace lm {
 
     void EXPECT_EQ_LOCATION_MATCH(const LocationMatch& ans, const LocationMatch& test) {
         EXPECT_EQ(ans.name, test.name);
-        EXPECT_NEAR(ans.angle, test.angle, M_PI*5/180);
+        EXPECT_NEAR(0, angleDiff(ans.angle, test.angle), M_PI*5/180);
         EXPECT_NEAR(ans.position.x, test.position.x, 3.0);
         EXPECT_NEAR(ans.position.y, test.position.y, 3.0
         );
@@ -119,7 +162,302 @@ namespace lm {
 
     }
 
-    
+    TEST_F(LocationMatcherTest, concurrentFindMatch) {
+        matcher.addBlueprint(bp3_);
+
+        vector<LocationMatch> expected;
+        matcher.findMatch(testImg4_, expected);
+
+        // Every thread queries the same matcher repeatedly
+        const int numThreads = 4;
+        const int numCalls = 5;
+        vector<vector<LocationMatch>> results(numThreads);
+        vector<thread> threads;
+        for (int i = 0; i < numThreads; i++) {
+            threads.push_back(thread([this, &results, i]() {
+                for (int j = 0; j < numCalls; j++) {
+                    results[i].clear();
+                    matcher.findMatch(testImg4_, results[i]);
+                }
+            }));
+        }
+        for (auto threadItr = threads.begin(); threadItr != threads.end(); threadItr++) {
+            threadItr->join();
+        }
+
+        for (int i = 0; i < numThreads; i++) {
+            ASSERT_EQ(expected.size(), results[i].size());
+            for (int j = 0; j < expected.size(); j++) {
+                EXPECT_EQ_LOCATION_MATCH(expected[j], results[i][j]);
+            }
+        }
+    }
+
+    TEST_F(LocationMatcherTest, mapScale) {
+        matcher.addBlueprint(bp3_);
+
+        vector<LocationMatch> expected;
+        matcher.findMatch(testImg4_, expected);
+        ASSERT_FALSE(expected.empty());
+
+        // The same map at twice the resolution of the blueprint
+        Mat largeImg;
+        resize(testImg4_, largeImg, Size(), 2, 2, INTER_NEAREST);
+        vector<LocationMatch> matches;
+        EXPECT_EQ(LM_STATUS_OK, matcher.findMatch(largeImg, bp3_.scale / 2, matches));
+
+        // Every match is found again at twice the pixel position
+        for (auto expectedItr = expected.cbegin(); expectedItr != expected.cend(); expectedItr++) {
+            bool found = false;
+            for (auto matchItr = matches.cbegin(); matchItr != matches.cend(); matchItr++) {
+                if (dist(expectedItr->position * 2, matchItr->position) < 6 && abs(angleDiff(expectedItr->angle, matchItr->angle)) < M_PI*5/180) {
+                    found = true;
+                }
+            }
+            EXPECT_TRUE(found);
+        }
+
+        // A blueprint without a scale cannot be converted to metres
+        Blueprint unscaled = bp3_;
+        unscaled.scale = 0;
+        EXPECT_EQ(LM_STATUS_ERROR_GENERIC, matcher.addBlueprint(unscaled));
+    }
+
+    TEST_F(LocationMatcherTest, filterMatches) {
+        matcher.addBlueprint(bp3_);
+
+        // The L section lies in the top left of the long wall at the same orientation
+        LocationMatch match;
+        match.name = bp3_.name;
+        match.position = Point2f(56, 48);
+        match.angle = 0;
+        match.certainty = 0;
+
+        // Nothing explored; the match is kept
+        vector<LocationMatch> matches(1, match);
+        Mat unexplored = Mat::zeros(testImg4_.size(), CV_8UC1);
+        EXPECT_EQ(LM_STATUS_OK, matcher.filterMatches(unexplored, matches));
+        EXPECT_EQ(1, matches.size());
+
+        // Everything but the walls themselves explored; the match is kept
+        Mat explored(testImg4_.size(), CV_8UC1, Scalar(255));
+        for (auto lineItr = lines4_.cbegin(); lineItr != lines4_.cend(); lineItr++) {
+            line(explored, lineItr->getStartPoint(), lineItr->getEndPoint(), Scalar(0), 5);
+        }
+        EXPECT_EQ(LM_STATUS_OK, matcher.filterMatches(explored, matches));
+        EXPECT_EQ(1, matches.size());
+
+        // Everything explored; the walls of the match would be in free space
+        Mat allExplored(testImg4_.size(), CV_8UC1, Scalar(255));
+        EXPECT_EQ(LM_STATUS_OK, matcher.filterMatches(allExplored, matches));
+        EXPECT_EQ(0, matches.size());
+    }
+
+    TEST_F(LocationMatcherTest, filterMatchesPacked) {
+        matcher.addBlueprint(bp3_);
+
+        // Poses all over the image and past its edges, so that many wall boxes cross the border
+        vector<LocationMatch> matches;
+        for (int y = -40; y <= testImg4_.rows + 40; y += 13) {
+            for (int x = -40; x <= testImg4_.cols + 40; x += 13) {
+                for (float angle : {0.0, M_PI/4, M_PI/2, M_PI}) {
+                    LocationMatch match;
+                    match.name = bp3_.name;
+                    match.position = Point2f(x, y);
+                    match.angle = angle;
+                    match.certainty = 0;
+                    matches.push_back(match);
+                }
+            }
+        }
+
+        // A match which puts the corner of the L of lines3_ two pixels in from the corner of the image, so its walls run along the top and left edges
+        LocationMatch cornerMatch;
+        cornerMatch.name = bp3_.name;
+        cornerMatch.position = bp3_.centroid - Point2f(26 - 2, 21 - 2);
+        cornerMatch.angle = 0;
+        cornerMatch.certainty = 0;
+        matches.push_back(cornerMatch);
+
+        // Everything explored, everything but the walls explored, and only the bottom right explored so the explored area ends at two edges of the image
+        Mat allExplored(testImg4_.size(), CV_8UC1, Scalar(255));
+        Mat wallsUnexplored = allExplored.clone();
+        for (auto lineItr = lines4_.cbegin(); lineItr != lines4_.cend(); lineItr++) {
+            line(wallsUnexplored, lineItr->getStartPoint(), lineItr->getEndPoint(), Scalar(0), 5);
+        }
+        Mat cornerExplored = Mat::zeros(testImg4_.size(), CV_8UC1);
+        cornerExplored(Rect(testImg4_.cols / 2, testImg4_.rows / 2, testImg4_.cols - testImg4_.cols / 2, testImg4_.rows - testImg4_.rows / 2)).setTo(255);
+
+        for (const Mat& mask : {allExplored, wallsUnexplored, cornerExplored}) {
+            vector<LocationMatch> expected = matches;
+            summedAreaFilter(mask, expected);
+            EXPECT_LT(0, expected.size());
+            EXPECT_GT(matches.size(), expected.size());
+
+            vector<LocationMatch> fromMat = matches;
+            EXPECT_EQ(LM_STATUS_OK, matcher.filterMatches(mask, fromMat));
+
+            OccupancyBitmap explored;
+            ASSERT_EQ(LM_STATUS_OK, explored.fromMat(mask, 127));
+            vector<LocationMatch> fromBitmap = matches;
+            EXPECT_EQ(LM_STATUS_OK, matcher.filterMatches(explored, 0, fromBitmap));
+
+            // remove_if keeps the order, so the survivors must be the same matches in the same order
+            ASSERT_EQ(expected.size(), fromMat.size());
+            ASSERT_EQ(expected.size(), fromBitmap.size());
+            for (int i = 0; i < expected.size(); i++) {
+                EXPECT_EQ(expected[i].position, fromMat[i].position);
+                EXPECT_EQ(expected[i].angle, fromMat[i].angle);
+                EXPECT_EQ(expected[i].position, fromBitmap[i].position);
+                EXPECT_EQ(expected[i].angle, fromBitmap[i].angle);
+            }
+        }
+
+        // An empty bitmap cannot be checked against
+        vector<LocationMatch> unchecked = matches;
+        EXPECT_EQ(LM_STATUS_ERROR_GENERIC, matcher.filterMatches(OccupancyBitmap(), 0, unchecked));
+    }
+
+    TEST_F(LocationMatcherTest, deadline) {
+        matcher.addBlueprint(bp3_);
+
+        vector<LocationMatch> expected;
+        matcher.findMatch(testImg4_, bp3_.scale, expected);
+        ASSERT_FALSE(expected.empty());
+
+        // With plenty of time every match is found, though possibly in a different order
+        vector<LocationMatch> matches;
+        EXPECT_EQ(LM_STATUS_OK, matcher.findMatch(testImg4_, bp3_.scale, chrono::steady_clock::now() + chrono::seconds(10), matches));
+        ASSERT_EQ(expected.size(), matches.size());
+        for (auto expectedItr = expected.cbegin(); expectedItr != expected.cend(); expectedItr++) {
+            bool found = false;
+            for (auto matchItr = matches.cbegin(); matchItr != matches.cend(); matchItr++) {
+                if (dist(expectedItr->position, matchItr->position) < 3 && abs(angleDiff(expectedItr->angle, matchItr->angle)) < M_PI*5/180) {
+                    found = true;
+                }
+            }
+            EXPECT_TRUE(found);
+        }
+
+        // A deadline which has already passed stops the search before any blueprint is matched
+        matches.clear();
+        EXPECT_EQ(LM_STATUS_DEADLINE_EXCEEDED, matcher.findMatch(testImg4_, bp3_.scale, chrono::steady_clock::now(), matches));
+        EXPECT_EQ(0, matches.size());
+    }
+
+    TEST_F(LocationMatcherTest, matchCallback) {
+        EXPECT_EQ(-1, matcher.blueprintId(bp3_.name));
+        matcher.addBlueprint(bp3_);
+        const int bp3Id = matcher.blueprintId(bp3_.name);
+        EXPECT_EQ(0, bp3Id);
+        EXPECT_EQ(bp3_.name, matcher.blueprintName(bp3Id));
+
+        vector<LocationMatch> expected;
+        matcher.findMatch(testImg4_, bp3_.scale, expected);
+        ASSERT_LT(1, expected.size());
+
+        // The callback is passed the same matches in the same order
+        vector<LocationMatch> matches;
+        EXPECT_EQ(LM_STATUS_OK, matcher.findMatch(testImg4_, bp3_.scale, [&](const BlueprintMatch& match) {
+            EXPECT_EQ(bp3Id, match.blueprintId);
+            matches.push_back(matcher.toLocationMatch(match));
+            return true;
+        }));
+        ASSERT_EQ(expected.size(), matches.size());
+        for (int i = 0; i < expected.size(); i++) {
+            EXPECT_EQ_LOCATION_MATCH(expected[i], matches[i]);
+        }
+
+        // Returning false stops at the first match
+        int numCalls = 0;
+        EXPECT_EQ(LM_STATUS_OK, matcher.findMatch(testImg4_, bp3_.scale, [&](const BlueprintMatch&) {
+            numCalls++;
+            return false;
+        }));
+        EXPECT_EQ(1, numCalls);
+
+        // Replacing a blueprint keeps its id
+        matcher.addBlueprint(bp3_);
+        EXPECT_EQ(bp3Id, matcher.blueprintId(bp3_.name));
+    }
+
+    TEST_F(LocationMatcherTest, blueprintStats) {
+        // Without any queries a blueprint is as likely to match as not
+        EXPECT_DOUBLE_EQ(0.5, BlueprintStats().expectedHitRate());
+
+        matcher.addBlueprint(bp3_);
+        EXPECT_TRUE(matcher.blueprintStats().empty());
+
+        vector<LocationMatch> matches;
+        matcher.findMatch(testImg4_, bp3_.scale, matches);
+        ASSERT_FALSE(matches.empty());
+        matcher.findMatch(testImg4_, bp3_.scale, chrono::steady_clock::now() + chrono::seconds(10), matches);
+
+        map<string, BlueprintStats> stats = matcher.blueprintStats();
+        ASSERT_EQ(1, stats.count(bp3_.name));
+        EXPECT_EQ(2, stats[bp3_.name].numQueries);
+        EXPECT_EQ(2, stats[bp3_.name].numHits);
+        EXPECT_EQ(2, stats[bp3_.name].numTimed);
+        EXPECT_LT(0, stats[bp3_.name].averageSeconds);
+        EXPECT_LT(0.5, stats[bp3_.name].expectedHitRate());
+
+        // Scheduled matching stops at the limit
+        matcher.setMaxMatches(1);
+        matches.clear();
+        EXPECT_EQ(LM_STATUS_OK, matcher.findMatch(testImg4_, bp3_.scale, chrono::steady_clock::now() + chrono::seconds(10), matches));
+        EXPECT_EQ(1, matches.size());
+        EXPECT_EQ(3, matcher.blueprintStats()[bp3_.name].numQueries);
+
+        // So does matching without a deadline
+        matches.clear();
+        EXPECT_EQ(LM_STATUS_OK, matcher.findMatch(testImg4_, bp3_.scale, matches));
+        EXPECT_EQ(1, matches.size());
+        EXPECT_EQ(4, matcher.blueprintStats()[bp3_.name].numQueries);
+
+        // Adding the blueprint again starts its statistics over
+        matcher.addBlueprint(bp3_);
+        EXPECT_EQ(0, matcher.blueprintStats().count(bp3_.name));
+    }
+
+    TEST_F(LocationMatcherTest, priors) {
+        matcher.addBlueprint(bp3_);
+
+        vector<LocationMatch> expected;
+        matcher.findMatch(testImg4_, bp3_.scale, expected);
+        ASSERT_FALSE(expected.empty());
+
+        // A prior at each match finds it again
+        for (auto expectedItr = expected.cbegin(); expectedItr != expected.cend(); expectedItr++) {
+            PosePrior prior;
+            prior.name = bp3_.name;
+            prior.position = expectedItr->position;
+            prior.uncertainty = 0.5;
+
+            vector<LocationMatch> matches;
+            EXPECT_EQ(LM_STATUS_OK, matcher.findMatch(testImg4_, bp3_.scale, vector<PosePrior>(1, prior), matches));
+            bool found = false;
+            for (auto matchItr = matches.cbegin(); matchItr != matches.cend(); matchItr++) {
+                EXPECT_GE(prior.uncertainty, dist(prior.position, matchItr->position) * bp3_.scale);
+                if (dist(expectedItr->position, matchItr->position) < 3 && abs(angleDiff(expectedItr->angle, matchItr->angle)) < M_PI*5/180) {
+                    found = true;
+                }
+            }
+            EXPECT_TRUE(found);
+        }
+
+        // Nothing is found far outside the map, or for an unknown blueprint
+        PosePrior farPrior;
+        farPrior.name = bp3_.name;
+        farPrior.position = Point2f(-10000, -10000);
+        farPrior.uncertainty = 0.5;
+        PosePrior unknownPrior = farPrior;
+        unknownPrior.name = "unknown";
+        unknownPrior.position = expected.front().position;
+
+        vector<LocationMatch> matches;
+        EXPECT_EQ(LM_STATUS_OK, matcher.findMatch(testImg4_, bp3_.scale, {farPrior, unknownPrior}, matches));
+        EXPECT_EQ(0, matches.size());
+    }
 }
 
 int main(int argc, char* argv[]) {
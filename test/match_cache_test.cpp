@@ -0,0 +1,124 @@
+#include <gtest/gtest.h>
+
+#include "test/test_datasets.hpp"
+#include "location_matcher/utils.hpp"
+#include "location_matcher/match_cache.hpp"
+
+using namespace testing;
+using namespace std;
+using namespace cv;
+using namespace cv::line_descriptor;
+
+namespace lm {
+    class MatchCacheTest : public BaseTest {
+        public:
+        pmr::vector<SegmentRun> getRuns(int numRuns) {
+            pmr::vector<SegmentRun> runs;
+            for (int i = 0; i < numRuns; i++) {
+                runs.push_back({i, i + 1, i, i + 1});
+            }
+            return runs;
+        }
+    };
+
+    TEST_F(MatchCacheTest, leastRecentlyUsedEvicted) {
+        MatchCache cache(2);
+        cache.insert(1, 10, getRuns(1));
+        cache.insert(2, 10, getRuns(2));
+        EXPECT_EQ(2, cache.size());
+
+        // Using the first pair makes the second the least recently used
+        ASSERT_NE(nullptr, cache.find(1, 10));
+        EXPECT_EQ(1, cache.find(1, 10)->size());
+        cache.insert(3, 10, getRuns(3));
+
+        EXPECT_EQ(2, cache.size());
+        EXPECT_EQ(nullptr, cache.find(2, 10));
+        EXPECT_NE(nullptr, cache.find(1, 10));
+        EXPECT_NE(nullptr, cache.find(3, 10));
+        EXPECT_EQ(nullptr, cache.find(1, 11));
+        EXPECT_EQ(4, cache.numHits());
+        EXPECT_EQ(2, cache.numMisses());
+
+        cache.clear();
+        EXPECT_EQ(0, cache.size());
+        EXPECT_EQ(nullptr, cache.find(1, 10));
+    }
+
+    TEST_F(MatchCacheTest, matchSegmentsCached) {
+        Segments wall, section;
+        wall.addLines(lines4_);
+        section.addLines(lines3_);
+
+        vector<SegmentMatch> expected;
+        wall.matchSegments(section, expected);
+
+        MatchCache cache;
+        MatchThresholds thresholds;
+        for (int i = 0; i < 2; i++) {
+            vector<SegmentMatch> matches;
+            EXPECT_EQ(LM_STATUS_OK, wall.matchSegments(section, matches, thresholds, cache));
+
+            ASSERT_EQ(expected.size(), matches.size());
+            for (int j = 0; j < expected.size(); j++) {
+                EXPECT_EQ(expected[j].segment1Index[0], matches[j].segment1Index[0]);
+                EXPECT_EQ(expected[j].segment2Index[0], matches[j].segment2Index[0]);
+                EXPECT_NEAR(expected[j].angleOffset, matches[j].angleOffset, 1e-5);
+            }
+        }
+        EXPECT_EQ(cache.numMisses(), cache.numHits());
+
+        // The same wall moved elsewhere in the map still uses the cached runs
+        KeyLines movedLines = lines4_;
+        for (auto lineItr = movedLines.begin(); lineItr != movedLines.end(); lineItr++) {
+            *lineItr = getKeyLine(lineItr->startPointX + 100, lineItr->startPointY, lineItr->endPointX + 100, lineItr->endPointY);
+        }
+        Segments movedWall;
+        movedWall.addLines(movedLines);
+        size_t numMisses = cache.numMisses();
+
+        vector<SegmentMatch> matches;
+        movedWall.matchSegments(section, matches, thresholds, cache);
+        EXPECT_EQ(numMisses, cache.numMisses());
+        ASSERT_EQ(expected.size(), matches.size());
+        for (int j = 0; j < expected.size(); j++) {
+            EXPECT_NEAR(expected[j].positionOffset.x - 100, matches[j].positionOffset.x, 1e-3);
+        }
+    }
+
+    TEST_F(MatchCacheTest, matchSegmentsJittered) {
+        Segments wall, section;
+        wall.addLines(lines4_);
+        section.addLines(lines3_);
+
+        MatchCache cache;
+        MatchThresholds thresholds;
+        vector<SegmentMatch> expected;
+        wall.matchSegments(section, expected, thresholds, cache);
+        ASSERT_FALSE(expected.empty());
+
+        // The same wall detected again in the next map, with each end half a pixel in from where it was
+        KeyLines jitteredLines = lines4_;
+        for (auto lineItr = jitteredLines.begin(); lineItr != jitteredLines.end(); lineItr++) {
+            Point2f direction = (lineItr->getEndPoint() - lineItr->getStartPoint()) / lineItr->lineLength;
+            Point2f start = lineItr->getStartPoint() + 0.5 * direction;
+            Point2f end = lineItr->getEndPoint() - 0.5 * direction;
+            *lineItr = getKeyLine(start.x, start.y, end.x, end.y);
+        }
+        Segments jitteredWall;
+        jitteredWall.addLines(jitteredLines);
+        size_t numMisses = cache.numMisses();
+        size_t numHits = cache.numHits();
+
+        vector<SegmentMatch> matches;
+        jitteredWall.matchSegments(section, matches, thresholds, cache);
+        EXPECT_EQ(numMisses, cache.numMisses());
+        EXPECT_LT(numHits, cache.numHits());
+        EXPECT_EQ(expected.size(), matches.size());
+    }
+}
+
+int main(int argc, char* argv[]) {
+    InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
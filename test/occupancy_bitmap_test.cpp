@@ -0,0 +1,169 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <random>
+
+#include "location_matcher/occupancy_bitmap.hpp"
+
+using namespace testing;
+using namespace std;
+using namespace cv;
+
+namespace lm {
+    class OccupancyBitmapTest : public Test {
+        public:
+        // Wider than two words and not a multiple of 64, so rows end part way through a word
+        static constexpr int ROWS = 40;
+        static constexpr int COLS = 150;
+
+        void SetUp() override {
+            mt19937 rng(1);
+            uniform_int_distribution<int> value(-1, 100);
+            for (int i = 0; i < ROWS * COLS; i++) {
+                grid_.push_back(value(rng));
+                gridB_.push_back(value(rng));
+            }
+        }
+
+        // Distance of pt from the segment from pt1 to pt2
+        static float segmentDist(Point2f pt, Point2f pt1, Point2f pt2) {
+            Point2f dir = pt2 - pt1;
+            float t = dir.dot(dir) > 0 ? max(0.0f, min(1.0f, (pt - pt1).dot(dir) / dir.dot(dir))) : 0;
+            return dist(pt, pt1 + dir * t);
+        }
+
+        vector<int8_t> grid_;
+        vector<int8_t> gridB_;
+    };
+
+    TEST_F(OccupancyBitmapTest, fromGrid) {
+        OccupancyBitmap bitmap;
+        ASSERT_EQ(LM_STATUS_OK, bitmap.fromGrid(grid_.data(), ROWS, COLS, 50));
+        EXPECT_EQ(ROWS, bitmap.rows());
+        EXPECT_EQ(COLS, bitmap.cols());
+
+        int expectedCount = 0;
+        for (int y = 0; y < ROWS; y++) {
+            for (int x = 0; x < COLS; x++) {
+                bool isOccupied = grid_[y * COLS + x] >= 50;
+                EXPECT_EQ(isOccupied, bitmap.get(x, y));
+                expectedCount += isOccupied;
+            }
+        }
+        EXPECT_EQ(expectedCount, bitmap.count());
+
+        // Unknown cells are never set
+        ASSERT_EQ(LM_STATUS_OK, bitmap.fromGrid(grid_.data(), ROWS, COLS, 0));
+        EXPECT_EQ(ROWS * COLS - count(grid_.begin(), grid_.end(), -1), bitmap.count());
+
+        EXPECT_EQ(LM_STATUS_ERROR_GENERIC, bitmap.fromGrid(nullptr, ROWS, COLS, 0));
+    }
+
+    TEST_F(OccupancyBitmapTest, fromMat) {
+        vector<uchar> pixels(grid_.begin(), grid_.end());
+        Mat img(ROWS, COLS, CV_8UC1, pixels.data());
+
+        OccupancyBitmap bitmap, inverted;
+        ASSERT_EQ(LM_STATUS_OK, bitmap.fromMat(img, 50));
+        ASSERT_EQ(LM_STATUS_OK, inverted.fromMat(img, 50, true));
+        for (int y = 0; y < ROWS; y++) {
+            for (int x = 0; x < COLS; x++) {
+                EXPECT_EQ(pixels[y * COLS + x] > 50, bitmap.get(x, y));
+                EXPECT_NE(bitmap.get(x, y), inverted.get(x, y));
+            }
+        }
+        EXPECT_EQ(ROWS * COLS, bitmap.count() + inverted.count());
+
+        // Converting back gives 255 for set cells and 0 for clear cells
+        Mat converted;
+        bitmap.toMat(converted);
+        for (int y = 0; y < ROWS; y++) {
+            for (int x = 0; x < COLS; x++) {
+                EXPECT_EQ(bitmap.get(x, y) ? 255 : 0, converted.ptr<uchar>(y)[x]);
+            }
+        }
+
+        EXPECT_EQ(LM_STATUS_ERROR_GENERIC, bitmap.fromMat(Mat(), 50));
+    }
+
+    TEST_F(OccupancyBitmapTest, andOr) {
+        OccupancyBitmap a, b, intersection, combined;
+        a.fromGrid(grid_.data(), ROWS, COLS, 50);
+        b.fromGrid(gridB_.data(), ROWS, COLS, 50);
+        intersection = a;
+        combined = a;
+        ASSERT_EQ(LM_STATUS_OK, intersection.andWith(b));
+        ASSERT_EQ(LM_STATUS_OK, combined.orWith(b));
+
+        for (int y = 0; y < ROWS; y++) {
+            for (int x = 0; x < COLS; x++) {
+                EXPECT_EQ(a.get(x, y) && b.get(x, y), intersection.get(x, y));
+                EXPECT_EQ(a.get(x, y) || b.get(x, y), combined.get(x, y));
+            }
+        }
+        EXPECT_EQ(a.count() + b.count(), intersection.count() + combined.count());
+
+        OccupancyBitmap smaller(ROWS, COLS - 1);
+        EXPECT_EQ(LM_STATUS_SIZE_MISMATCH, a.andWith(smaller));
+        EXPECT_EQ(LM_STATUS_SIZE_MISMATCH, a.orWith(smaller));
+    }
+
+    TEST_F(OccupancyBitmapTest, isAllSet) {
+        // Mostly set, so that some boxes are all set
+        OccupancyBitmap bitmap;
+        bitmap.fromGrid(grid_.data(), ROWS, COLS, 2);
+
+        mt19937 rng(2);
+        uniform_int_distribution<int> x(-5, COLS), y(-5, ROWS), size(1, 70);
+        int numAllSet = 0;
+        for (int i = 0; i < 2000; i++) {
+            Rect box(x(rng), y(rng), size(rng), size(rng) % 4 + 1);
+
+            bool expected = box.x >= 0 && box.y >= 0 && box.x + box.width <= COLS && box.y + box.height <= ROWS;
+            for (int by = box.y; expected && by < box.y + box.height; by++) {
+                for (int bx = box.x; expected && bx < box.x + box.width; bx++) {
+                    expected = bitmap.get(bx, by);
+                }
+            }
+            ASSERT_EQ(expected, bitmap.isAllSet(box)) << box;
+            numAllSet += expected;
+        }
+        EXPECT_LT(0, numAllSet);
+
+        // A range set across words
+        OccupancyBitmap cleared(ROWS, COLS);
+        cleared.setRange(3, 60, 130);
+        EXPECT_EQ(71, cleared.count());
+        EXPECT_TRUE(cleared.isAllSet(Rect(60, 3, 71, 1)));
+        EXPECT_FALSE(cleared.isAllSet(Rect(59, 3, 72, 1)));
+    }
+
+    TEST_F(OccupancyBitmapTest, fillLine) {
+        const Point2f lines[][2] = {
+            {Point2f(10, 10), Point2f(140, 30)},
+            {Point2f(70, -5), Point2f(70, 50)},
+            {Point2f(5.5, 20), Point2f(100.5, 20)},
+            {Point2f(30, 30), Point2f(30, 30)}
+        };
+        const float radius = 2.5;
+        for (int i = 0; i < sizeof(lines) / sizeof(lines[0]); i++) {
+            OccupancyBitmap bitmap(ROWS, COLS);
+            bitmap.fillLine(lines[i][0], lines[i][1], radius);
+
+            // Every cell whose centre is within radius of the line is set. Cells on the edge can go either way with rounding.
+            for (int y = 0; y < ROWS; y++) {
+                for (int x = 0; x < COLS; x++) {
+                    float d = segmentDist(Point2f(x, y), lines[i][0], lines[i][1]);
+                    if (abs(d - radius) > 1e-3) {
+                        EXPECT_EQ(d < radius, bitmap.get(x, y)) << "line " << i << " at " << x << ", " << y;
+                    }
+                }
+            }
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,80 @@
+#include <gtest/gtest.h>
+
+#include "test/test_datasets.hpp"
+#include "location_matcher/utils.hpp"
+#include "location_matcher/segment_grid.hpp"
+
+using namespace testing;
+using namespace std;
+using namespace cv;
+using namespace cv::line_descriptor;
+
+namespace lm {
+    class SegmentGridTest : public BaseTest {
+        public:
+        void SetUp() override {
+            BaseTest::SetUp();
+
+            // Two separate walls far apart, and a long wall spanning both
+            KeyLines lines;
+            lines.push_back(getKeyLine(0, 0, 10, 0));
+            lines.push_back(getKeyLine(10, 0, 10, 10));
+            lines.push_back(getKeyLine(100, 100, 110, 100));
+            lines.push_back(getKeyLine(110, 100, 110, 110));
+            lines.push_back(getKeyLine(0, 200, 200, 200));
+            segments_.addLines(lines);
+        }
+
+        // Indexes of the segments whose bounding boxes intersect box, found by checking every segment
+        vector<int> bruteForce(const Rect2f& box) {
+            vector<int> indexes;
+            for (int i = 0; i < segments_.data().size(); i++) {
+                Rect2f segmentBox = segments_.data()[i]->boundingBox();
+                if (box.x <= segmentBox.x + segmentBox.width && segmentBox.x <= box.x + box.width &&
+                    box.y <= segmentBox.y + segmentBox.height && segmentBox.y <= box.y + box.height) {
+                    indexes.push_back(i);
+                }
+            }
+            return indexes;
+        }
+
+        Segments segments_;
+    };
+
+    TEST_F(SegmentGridTest, query) {
+        SegmentGrid grid;
+        ASSERT_EQ(LM_STATUS_OK, grid.build(segments_, 20));
+        ASSERT_EQ(3, segments_.data().size());
+        EXPECT_LT(1, grid.numCells());
+
+        const Rect2f boxes[] = {
+            Rect2f(-5, -5, 20, 20),         // First wall
+            Rect2f(95, 95, 20, 20),         // Second wall
+            Rect2f(150, 190, 5, 20),        // Middle of the long wall
+            Rect2f(40, 40, 20, 20),         // Nothing
+            Rect2f(-1000, -1000, 3000, 3000),   // Everything
+            Rect2f(1e30, 1e30, 1, 1)        // Far outside the grid
+        };
+        for (int i = 0; i < sizeof(boxes) / sizeof(boxes[0]); i++) {
+            pmr::vector<int> indexes;
+            grid.query(boxes[i], indexes);
+            vector<int> expected = bruteForce(boxes[i]);
+            EXPECT_EQ(expected, vector<int>(indexes.begin(), indexes.end())) << "box " << i;
+        }
+    }
+
+    TEST_F(SegmentGridTest, invalidCellSize) {
+        SegmentGrid grid;
+        EXPECT_EQ(LM_STATUS_ERROR_GENERIC, grid.build(segments_, 0));
+
+        // An empty grid finds nothing
+        pmr::vector<int> indexes;
+        grid.query(Rect2f(0, 0, 100, 100), indexes);
+        EXPECT_TRUE(indexes.empty());
+    }
+}
+
+int main(int argc, char* argv[]) {
+    InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
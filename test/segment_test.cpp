@@ -1,9 +1,12 @@
 #include <gtest/gtest.h>
 
+#include <random>
+
 #include <opencv2/highgui.hpp>
 
 #include "test/test_datasets.hpp"
 #include "location_matcher/utils.hpp"
+#include "location_matcher/match_cache.hpp"
 #include "location_matcher/segment.hpp"
 
 using namespace testing;
@@ -45,6 +48,15 @@ namespace lm {
             return seg;
         }
 
+        // Likeness matrix of seg1 and seg2, the dense reference for findRuns()
+        static Mat likenessMatrix(const Segment& seg1, const Segment& seg2, float lengthThreshold) {
+            return seg1.likenessMatrix(seg2, lengthThreshold);
+        }
+
+        static void summarise(Segment& seg) {
+            seg.summarise();
+        }
+
         vector<Segment> getSegmentsVec(KeyLines lines) {
             vector<Segment> segVec;
             for (int i = 0; i < lines.size(); i++) {
@@ -125,6 +137,15 @@ namespace lm {
         
     };
 
+    TEST_F(SegmentTest, lineConversion) {
+        for (auto lineItr = lines5_.cbegin(); lineItr != lines5_.cend(); lineItr++) {
+            Line line(*lineItr);
+            EXPECT_KEYLINE_EQUAL(*lineItr, line.toKeyLine());
+            EXPECT_FLOAT_EQ(lineItr->startPointX, line.getStartPoint().x);
+            EXPECT_FLOAT_EQ(lineItr->endPointY, line.getEndPoint().y);
+        }
+    }
+
     TEST_F(SegmentTest, isJoinedToUnconnected) {
         EXPECT_EQ(SEGMENT_JOINT_NONE, segmentsVec1_[0].isJoinedTo(segmentsVec1_[1]));
     }
@@ -246,6 +267,215 @@ namespace lm {
     }
 
     // ########### SegmentMatch Test ############
+    TEST_F(SegmentsTest, mayMatch) {
+        Segments wall, section;
+        wall.addLines(lines4_);
+        section.addLines(lines3_);
+        ASSERT_FALSE(wall.data().empty());
+        ASSERT_FALSE(section.data().empty());
+        EXPECT_TRUE(wall.data().front()->mayMatch(*section.data().front()));
+
+        // No line of the section is within lengthThreshold of a line ten times as long
+        KeyLines largeLines;
+        scaleKeyLines(lines3_, 10, largeLines);
+        MatchThresholds largeThresholds;
+        largeThresholds.joinDistThreshold *= 10;
+        Segments largeSection;
+        largeSection.addLines(largeLines, largeThresholds);
+        ASSERT_FALSE(largeSection.data().empty());
+        EXPECT_FALSE(wall.data().front()->mayMatch(*largeSection.data().front()));
+
+        // Every pair ruled out would not have produced a match
+        vector<SegmentMatch> matches;
+        largeSection.data().front()->compareWith(*wall.data().front(), matches);
+        EXPECT_EQ(0, matches.size());
+
+        // A single line cannot be matched
+        Segment line(lines3_[0]);
+        EXPECT_FALSE(line.mayMatch(*section.data().front()));
+    }
+
+    TEST_F(SegmentsTest, findRunsSummarised) {
+        Segments wall;
+        wall.addLines(lines4_);
+        ASSERT_FALSE(wall.data().empty());
+        const Segment& summarised = *wall.data().front();
+        ASSERT_TRUE(summarised.isSummarised());
+
+        // Copy of the lines without a summary, so findRuns() sorts the lengths itself
+        KeyLines lines;
+        for (auto lineItr = summarised.data().cbegin(); lineItr != summarised.data().cend(); lineItr++) {
+            lines.push_back(lineItr->toKeyLine());
+        }
+        Segment unsummarised = autogenSegment(lines);
+        ASSERT_FALSE(unsummarised.isSummarised());
+
+        const Segment& section = segmentsVecAutogen3_[0];
+        pmr::vector<SegmentRun> runsSummarised, runsUnsummarised;
+        section.findRuns(summarised, runsSummarised);
+        section.findRuns(unsummarised, runsUnsummarised);
+
+        ASSERT_FALSE(runsSummarised.empty());
+        ASSERT_EQ(runsUnsummarised.size(), runsSummarised.size());
+        for (int i = 0; i < runsSummarised.size(); i++) {
+            EXPECT_EQ(runsUnsummarised[i].startIndex1, runsSummarised[i].startIndex1);
+            EXPECT_EQ(runsUnsummarised[i].endIndex1, runsSummarised[i].endIndex1);
+            EXPECT_EQ(runsUnsummarised[i].startIndex2, runsSummarised[i].startIndex2);
+            EXPECT_EQ(runsUnsummarised[i].endIndex2, runsSummarised[i].endIndex2);
+        }
+    }
+
+    TEST_F(SegmentTest, findRunsDense) {
+        // Long segments of lengths which are alike or not in no particular pattern, so there are runs along many diagonals in both directions and across several words of each row
+        mt19937 rng(3);
+        uniform_int_distribution<int> length(1, 6);
+        uniform_real_distribution<float> noise(0, 6);
+        auto randomSegment = [&](int numLines) {
+            KeyLines lines;
+            for (int i = 0; i < numLines; i++) {
+                lines.push_back(getKeyLine(0, i, 10 * length(rng) + noise(rng), i));
+            }
+            Segment seg = autogenSegment(lines);
+            summarise(seg);
+            return seg;
+        };
+        const Segment seg1 = randomSegment(150);
+        const Segment seg2 = randomSegment(140);
+        const float lengthThreshold = MatchThresholds().lengthThreshold;
+
+        // Every maximal run of likes along a diagonal of the likeness matrix
+        Mat likeness = likenessMatrix(seg1, seg2, lengthThreshold);
+        auto isLike = [&](int i, int j) {
+            return i >= 0 && j >= 0 && i < likeness.rows && j < likeness.cols && likeness.at<float>(i, j) >= SEGMENT_LIKENESS_THRESHOLD;
+        };
+        pmr::vector<SegmentRun> expected;
+        for (int increment = 1; increment >= -1; increment -= 2) {
+            for (int i = 0; i < likeness.rows; i++) {
+                for (int j = 0; j < likeness.cols; j++) {
+                    if (!isLike(i, j) || isLike(i - 1, j - increment)) {
+                        continue;
+                    }
+                    int runLength = 1;
+                    while (isLike(i + runLength, j + runLength*increment)) {
+                        runLength++;
+                    }
+                    if (runLength >= SEGMENT_MIN_MATCH_LENGTH) {
+                        expected.push_back({i, i + runLength - 1, j, j + (runLength - 1)*increment});
+                    }
+                }
+            }
+        }
+        sortRuns(expected.begin(), expected.end(), likeness.cols);
+
+        pmr::vector<SegmentRun> runs;
+        seg1.findRuns(seg2, runs, lengthThreshold);
+        ASSERT_LT(100, expected.size());
+        ASSERT_EQ(expected.size(), runs.size());
+        for (int r = 0; r < runs.size(); r++) {
+            EXPECT_EQ(expected[r].startIndex1, runs[r].startIndex1);
+            EXPECT_EQ(expected[r].endIndex1, runs[r].endIndex1);
+            EXPECT_EQ(expected[r].startIndex2, runs[r].startIndex2);
+            EXPECT_EQ(expected[r].endIndex2, runs[r].endIndex2);
+        }
+    }
+
+    TEST_F(SegmentTest, summaryInvalidated) {
+        // Joining changes the lines, so the summary no longer applies and findRuns() sorts the lengths itself
+        Segment joined = autogenSegment({getKeyLine(0, 0, 100, 0), getKeyLine(100, 0, 100, 50)});
+        summarise(joined);
+        ASSERT_TRUE(joined.isSummarised());
+
+        Segment extension(getKeyLine(100, 50, 130, 50));
+        summarise(extension);
+        ASSERT_EQ(LM_STATUS_OK, joined.join(extension));
+        EXPECT_EQ(3, joined.data().size());
+        EXPECT_FALSE(joined.isSummarised());
+        EXPECT_FALSE(extension.isSummarised());
+        summarise(joined);
+        EXPECT_TRUE(joined.isSummarised());
+
+        // A copy keeps the summary, and a slice does not
+        EXPECT_TRUE(Segment(joined).isSummarised());
+        EXPECT_FALSE(Segment(joined, 0, 1).isSummarised());
+    }
+
+    TEST_F(SegmentsTest, matchSegmentsDeadline) {
+        Segments wall, section;
+        wall.addLines(lines4_);
+        section.addLines(lines3_);
+
+        // Longest segments first
+        vector<int> order = section.orderByLength();
+        ASSERT_EQ(section.data().size(), order.size());
+        for (int i = 1; i < order.size(); i++) {
+            EXPECT_GE(section.data()[order[i - 1]]->length(), section.data()[order[i]]->length());
+        }
+
+        // The same matches are found in any order when there is time
+        MatchCache cache;
+        vector<SegmentMatch> expected, matches;
+        wall.matchSegments(section, expected, MatchThresholds(), cache);
+        EXPECT_EQ(LM_STATUS_OK, wall.matchSegments(section, order, matches, MatchThresholds(), cache, chrono::steady_clock::now() + chrono::seconds(10)));
+        EXPECT_EQ(expected.size(), matches.size());
+
+        // Nothing is matched after the deadline
+        matches.clear();
+        EXPECT_EQ(LM_STATUS_DEADLINE_EXCEEDED, wall.matchSegments(section, order, matches, MatchThresholds(), cache, chrono::steady_clock::now()));
+        EXPECT_EQ(0, matches.size());
+    }
+
+    TEST_F(SegmentsTest, findSymmetries) {
+        // A Z shape is unchanged by half a turn, a U shape only by a mirror
+        KeyLines zLines, uLines;
+        zLines.push_back(getKeyLine(100, 100, 140, 100));
+        zLines.push_back(getKeyLine(140, 100, 140, 160));
+        zLines.push_back(getKeyLine(140, 160, 180, 160));
+        uLines.push_back(getKeyLine(100, 100, 150, 100));
+        uLines.push_back(getKeyLine(150, 100, 150, 130));
+        uLines.push_back(getKeyLine(150, 130, 100, 130));
+        Segments zShape, uShape;
+        zShape.addLines(zLines);
+        uShape.addLines(uLines);
+        ASSERT_EQ(1, zShape.data().size());
+        EXPECT_FALSE(zShape.data()[0]->isSymmetric());
+        EXPECT_EQ(1, zShape.findSymmetries());
+        EXPECT_EQ(Point2f(140, 130), zShape.data()[0]->symmetryCentre());
+        EXPECT_EQ(0, uShape.findSymmetries());
+
+        // A Z whose ends differ by less than the match thresholds, but more than the symmetry tolerance, is not symmetric, so its second pose is estimated and validated
+        KeyLines nearlyZLines = zLines;
+        nearlyZLines[2] = getKeyLine(140, 160, 184, 160);
+        Segments nearlyZShape;
+        nearlyZShape.addLines(nearlyZLines);
+        EXPECT_LT(SEGMENT_LIKENESS_THRESHOLD, compareLengths(40, 44, MatchThresholds().lengthThreshold));
+        EXPECT_EQ(0, nearlyZShape.findSymmetries());
+
+        // The Z turned and moved matches in two poses half a turn apart. The second is derived from the first, and agrees with estimating it.
+        KeyLines mapLines;
+        for (auto lineItr = zLines.cbegin(); lineItr != zLines.cend(); lineItr++) {
+            Point2f start = rotateVector(lineItr->getStartPoint(), 0.7) + Point2f(50, 20);
+            Point2f end = rotateVector(lineItr->getEndPoint(), 0.7) + Point2f(50, 20);
+            mapLines.push_back(getKeyLine(start.x, start.y, end.x, end.y));
+        }
+        Segments map;
+        map.addLines(mapLines);
+        ASSERT_EQ(1, map.data().size());
+
+        Segments zEstimated;
+        zEstimated.addLines(zLines);
+        vector<SegmentMatch> expected, matches;
+        map.matchSegments(zEstimated, expected);
+        map.matchSegments(zShape, matches);
+        ASSERT_EQ(2, expected.size());
+        ASSERT_EQ(expected.size(), matches.size());
+        for (int i = 0; i < matches.size(); i++) {
+            EXPECT_NEAR(0, fastAngleDiff(expected[i].angleOffset, matches[i].angleOffset), 1e-3);
+            EXPECT_NEAR(expected[i].positionOffset.x, matches[i].positionOffset.x, 1e-2);
+            EXPECT_NEAR(expected[i].positionOffset.y, matches[i].positionOffset.y, 1e-2);
+        }
+        EXPECT_NEAR(M_PI, abs(fastAngleDiff(matches[0].angleOffset, matches[1].angleOffset)), 1e-3);
+    }
+
     TEST_F(SegmentMatchTest, computeOffsetsIdentical) {
         SegmentMatch match;
         match.segment1 = segmentsVecAns2_[0];
@@ -335,6 +565,84 @@ namespace lm {
         EXPECT_NEAR(0, angleDiff(match.angleOffset, M_PI), M_PI * 5/180);
     }
 
+    TEST_F(SegmentMatchTest, memoryResource) {
+        const Segment& wall = segmentsVecAutogen4_[0];
+        const Segment& section = segmentsVecAutogen3_[0];
+
+        // Both segments are copied into the given resource, whatever the resources of the originals
+        pmr::monotonic_buffer_resource buffer;
+        SegmentMatch match(wall, 0, 1, section, 1, 0, &buffer);
+        EXPECT_EQ(&buffer, match.segment1.data().get_allocator().resource());
+        EXPECT_EQ(&buffer, match.segment2.data().get_allocator().resource());
+        EXPECT_EQ(2, match.segment2.data().size());
+
+        // Without one they keep the resources of the originals
+        SegmentMatch defaultMatch(wall, 0, 1, section, 1, 0);
+        EXPECT_EQ(section.data().get_allocator().resource(), defaultMatch.segment2.data().get_allocator().resource());
+
+        // Matches of a segment held in a resource are held in it too
+        Segment mapWall(wall, 0, wall.data().size() - 1, &buffer);
+        vector<SegmentMatch> matches;
+        mapWall.compareWith(section, matches);
+        for (auto matchItr = matches.cbegin(); matchItr != matches.cend(); matchItr++) {
+            EXPECT_EQ(&buffer, matchItr->segment2.data().get_allocator().resource());
+        }
+    }
+
+    TEST_F(SegmentMatchTest, computeOffsetsRun) {
+        // Validating a run in place gives the same result as building its match, whether it is accepted or not
+        const Segment& wall = segmentsVecAutogen4_[0];
+        const Segment& section = segmentsVecAutogen3_[0];
+        const SegmentRun runs[] = {{0, 1, 0, 1}, {0, 1, 1, 0}, {1, 2, 0, 1}, {1, 2, 1, 0}};
+        for (int i = 0; i < sizeof(runs) / sizeof(runs[0]); i++) {
+            const SegmentRun& run = runs[i];
+            SegmentMatch match(wall, run.startIndex1, run.endIndex1, section, run.startIndex2, run.endIndex2);
+            LmStatus expectedStatus = match.computeOffsets();
+
+            float angleOffset;
+            Point2f positionOffset;
+            LmStatus status = SegmentMatch::computeOffsets(wall, section, run, MatchThresholds(), angleOffset, positionOffset);
+            EXPECT_EQ(expectedStatus, status) << "run " << i;
+            if (status == LM_STATUS_OK) {
+                EXPECT_EQ(match.angleOffset, angleOffset);
+                EXPECT_EQ(match.positionOffset, positionOffset);
+            }
+        }
+
+        // Runs of different lengths cannot match
+        float angleOffset;
+        Point2f positionOffset;
+        EXPECT_EQ(LM_STATUS_SIZE_MISMATCH, SegmentMatch::computeOffsets(wall, section, {0, 2, 0, 1}, MatchThresholds(), angleOffset, positionOffset));
+    }
+
+    TEST_F(SegmentMatchTest, computeConfidence) {
+        Segments section, wall;
+        section.addLines(lines3_);
+        wall.addLines(lines4_);
+
+        vector<SegmentMatch> matches;
+        wall.matchSegments(section, matches);
+        ASSERT_EQ(3, matches.size());
+
+        ChamferModel model;
+        EXPECT_EQ(LM_STATUS_OK, buildChamferModel(lines3_, CHAMFER_SAMPLE_STEP, model));
+
+        // Every match is a real placement of the section on the wall
+        Mat distanceMap;
+        EXPECT_EQ(LM_STATUS_OK, computeDistanceMap(testImg4_, distanceMap));
+        for (auto matchItr = matches.begin(); matchItr != matches.end(); matchItr++) {
+            EXPECT_EQ(LM_STATUS_OK, matchItr->computeConfidence(distanceMap, model, 0.5));
+            EXPECT_LE(0.5, matchItr->confidence);
+            EXPECT_GE(1.0, matchItr->confidence);
+        }
+
+        // There are no walls in an empty map
+        Mat empty(testImg4_.size(), CV_8UC1, Scalar(255));
+        EXPECT_EQ(LM_STATUS_OK, computeDistanceMap(empty, distanceMap));
+        EXPECT_EQ(LM_STATUS_ERROR_MATCH_FAILED, matches[0].computeConfidence(distanceMap, model, 0.5));
+        EXPECT_GT(0.5, matches[0].confidence);
+    }
+
     void drawMatches(vector<SegmentMatch> matches, InputOutputArray img) {
         Segments matchedSegments;
         for (auto matchItr = matches.cbegin(); matchItr != matches.cend(); matchItr++) {
@@ -0,0 +1,128 @@
+#include <gtest/gtest.h>
+
+#include <deque>
+
+#include "test/test_datasets.hpp"
+#include "location_matcher/utils.hpp"
+#include "location_matcher/segment_trie.hpp"
+
+using namespace testing;
+using namespace std;
+using namespace cv;
+using namespace cv::line_descriptor;
+
+namespace lm {
+    class SegmentTrieTest : public BaseTest {
+        public:
+        // Adds a staircase of walls with the given whole number lengths, alternately along x and y, as one segment
+        const Segment& addStaircase(const vector<int>& lengths) {
+            KeyLines lines;
+            Point2f pt(0, 0);
+            for (int i = 0; i < lengths.size(); i++) {
+                Point2f next = pt + (i % 2 == 0 ? Point2f(lengths[i], 0) : Point2f(0, lengths[i]));
+                lines.push_back(getKeyLine(pt.x, pt.y, next.x, next.y));
+                pt = next;
+            }
+            segments_.emplace_back();
+            segments_.back().addLines(lines);
+            EXPECT_EQ(1, segments_.back().data().size());
+            return *segments_.back().data()[0];
+        }
+
+        deque<Segments> segments_;
+    };
+
+    TEST_F(SegmentTrieTest, findRuns) {
+        // Variants of the same walls, sharing prefixes
+        const vector<vector<int>> blueprintLengths = {
+            {20, 30, 40, 50},
+            {20, 30, 40, 60, 70},
+            {20, 30},
+            {50, 40, 30, 20},
+            {30, 40, 50, 20},
+            {20, 30, 40, 50, 40, 30}
+        };
+        vector<const Segment*> blueprints;
+        int numLines = 0;
+        SegmentTrie trie;
+        ASSERT_EQ(LM_STATUS_OK, trie.setLengthQuantum(1));
+        for (int i = 0; i < blueprintLengths.size(); i++) {
+            blueprints.push_back(&addStaircase(blueprintLengths[i]));
+            trie.add(i, *blueprints.back());
+            numLines += blueprintLengths[i].size();
+        }
+        EXPECT_LT(trie.numNodes(), numLines);
+
+        const Segment& map = addStaircase({10, 20, 30, 40, 50, 40, 30, 20, 30});
+        const float lengthThreshold = MatchThresholds().lengthThreshold;
+
+        // Any subset of the ids, in any order, gives the same runs as comparing the segments one by one
+        pmr::vector<int> ids = {5, 0, 3, 1, 4, 2};
+        pmr::vector<SegmentRun> runs;
+        pmr::vector<int> offsets;
+        trie.findRuns(map, ids, lengthThreshold, runs, offsets);
+        ASSERT_EQ(ids.size() + 1, offsets.size());
+
+        int numRuns = 0;
+        for (int k = 0; k < ids.size(); k++) {
+            pmr::vector<SegmentRun> expected;
+            map.findRuns(*blueprints[ids[k]], expected, lengthThreshold);
+            numRuns += expected.size();
+
+            ASSERT_EQ(expected.size(), offsets[k + 1] - offsets[k]) << "id " << ids[k];
+            for (int r = 0; r < expected.size(); r++) {
+                const SegmentRun& run = runs[offsets[k] + r];
+                EXPECT_EQ(expected[r].startIndex1, run.startIndex1);
+                EXPECT_EQ(expected[r].endIndex1, run.endIndex1);
+                EXPECT_EQ(expected[r].startIndex2, run.startIndex2);
+                EXPECT_EQ(expected[r].endIndex2, run.endIndex2);
+            }
+        }
+        EXPECT_LT(0, numRuns);
+
+        // A scratch kept between calls gives the same runs, and is left clear after each call
+        TrieScratch scratch;
+        for (int repeat = 0; repeat < 2; repeat++) {
+            pmr::vector<SegmentRun> scratchRuns;
+            pmr::vector<int> scratchOffsets;
+            trie.findRuns(map, pmr::vector<int>({ids[0], ids[1]}), lengthThreshold, scratchRuns, scratchOffsets, scratch);
+            trie.findRuns(map, ids, lengthThreshold, scratchRuns, scratchOffsets, scratch);
+            EXPECT_EQ(count(scratch.isWanted.cbegin(), scratch.isWanted.cend(), 0), scratch.isWanted.size());
+            EXPECT_EQ(count(scratch.firstId.cbegin(), scratch.firstId.cend(), -1), scratch.firstId.size());
+
+            ASSERT_EQ(offsets.size(), scratchOffsets.size() - 3);
+            for (int k = 0; k < offsets.size(); k++) {
+                EXPECT_EQ(offsets[k], scratchOffsets[k + 3] - scratchOffsets[3]);
+            }
+            ASSERT_EQ(runs.size(), scratchRuns.size() - scratchOffsets[3]);
+            for (int r = 0; r < runs.size(); r++) {
+                EXPECT_EQ(runs[r].startIndex1, scratchRuns[scratchOffsets[3] + r].startIndex1);
+                EXPECT_EQ(runs[r].startIndex2, scratchRuns[scratchOffsets[3] + r].startIndex2);
+            }
+        }
+    }
+
+    TEST_F(SegmentTrieTest, sharedPrefix) {
+        SegmentTrie trie;
+        ASSERT_EQ(LM_STATUS_OK, trie.setLengthQuantum(1));
+        trie.add(0, addStaircase({20, 30, 40}));
+        EXPECT_EQ(3, trie.numNodes());
+
+        // Only the lines after the shared prefix add nodes
+        trie.add(1, addStaircase({20, 30, 40, 50}));
+        EXPECT_EQ(4, trie.numNodes());
+        trie.add(2, addStaircase({20, 35}));
+        EXPECT_EQ(5, trie.numNodes());
+
+        // The quantum cannot be changed once segments have been added
+        EXPECT_EQ(LM_STATUS_ERROR_GENERIC, trie.setLengthQuantum(2));
+        trie.clear();
+        EXPECT_EQ(0, trie.numNodes());
+        EXPECT_EQ(LM_STATUS_OK, trie.setLengthQuantum(2));
+    }
+}
+
+int main(int argc, char* argv[]) {
+    InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
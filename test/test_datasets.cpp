@@ -26,6 +26,10 @@ namespace lm{
         EXPECT_GE(POSITION_TOLERANCE, endOffset);
     }
 
+    void EXPECT_KEYLINE_EQUAL(const Line& expected, const Line& actual) {
+        EXPECT_KEYLINE_EQUAL(expected.toKeyLine(), actual.toKeyLine());
+    }
+
     void EXPECT_KEYLINES_EQUAL(const KeyLines& expected_, const KeyLines& actual_) {
         KeyLines expected = expected_;
         KeyLines actual = actual_;
@@ -0,0 +1,98 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+// Tracing is compiled out by default, so force it on for this test
+#undef LM_TRACE_LEVEL
+#define LM_TRACE_LEVEL 3
+#include "location_matcher/trace.hpp"
+
+using namespace testing;
+using namespace std;
+
+namespace lm {
+
+    class TraceTest : public ::testing::Test {
+        public:
+        void SetUp() override {
+            trace::flush();
+            trace::setSink(&output_);
+        }
+
+        void TearDown() override {
+            trace::flush();
+            trace::setSink(&clog);
+        }
+
+        int countLines() {
+            string text = output_.str();
+            return count(text.begin(), text.end(), '\n');
+        }
+
+        ostringstream output_;
+    };
+
+    TEST_F(TraceTest, writeAndFlush) {
+        LM_TRACE(LM_TRACE_LEVEL_DEBUG, TRACE_SEGMENT, "value " << 42);
+        trace::flush();
+
+        EXPECT_EQ("[DEBUG][segment] value 42\n", output_.str());
+    }
+
+    TEST_F(TraceTest, longMessage) {
+        string message(1000, 'x');
+        LM_TRACE(LM_TRACE_LEVEL_INFO, TRACE_MATCHER, message);
+        trace::flush();
+
+        EXPECT_EQ("[INFO][matcher] " + message + "\n", output_.str());
+    }
+
+    TEST_F(TraceTest, truncatedMessage) {
+        uint64_t numTruncatedBefore = trace::numTruncated();
+        string message(trace::MAX_MESSAGE_SIZE + 100, 'x');
+        LM_TRACE(LM_TRACE_LEVEL_INFO, TRACE_MATCHER, message);
+        trace::flush();
+
+        // Cut to the limit, ending with the marker
+        string marker = trace::TRUNCATION_MARKER;
+        string expected = message.substr(0, trace::MAX_MESSAGE_SIZE - marker.size()) + marker;
+        EXPECT_EQ("[INFO][matcher] " + expected + "\n", output_.str());
+        EXPECT_EQ(numTruncatedBefore + 1, trace::numTruncated());
+
+        // A message of exactly the limit is written in full
+        output_.str("");
+        message.resize(trace::MAX_MESSAGE_SIZE);
+        LM_TRACE(LM_TRACE_LEVEL_INFO, TRACE_MATCHER, message);
+        trace::flush();
+        EXPECT_EQ("[INFO][matcher] " + message + "\n", output_.str());
+        EXPECT_EQ(numTruncatedBefore + 1, trace::numTruncated());
+    }
+
+    TEST_F(TraceTest, manyThreads) {
+        const int numThreads = 4;
+        const int numMessages = 100;
+
+        vector<thread> threads;
+        for (int i = 0; i < numThreads; i++) {
+            threads.push_back(thread([]() {
+                for (int j = 0; j < numMessages; j++) {
+                    LM_TRACE(LM_TRACE_LEVEL_DEBUG, TRACE_VERIFY, "message " << j);
+                }
+            }));
+        }
+        for (auto threadItr = threads.begin(); threadItr != threads.end(); threadItr++) {
+            threadItr->join();
+        }
+        trace::flush();
+
+        EXPECT_EQ(numThreads * numMessages, countLines());
+        EXPECT_EQ(0, trace::numDropped());
+    }
+}
+
+int main(int argc, char* argv[]) {
+    InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,101 @@
+#include <gtest/gtest.h>
+
+#include "test/test_datasets.hpp"
+#include "location_matcher/utils.hpp"
+#include "location_matcher/tracker.hpp"
+
+using namespace testing;
+using namespace std;
+using namespace cv;
+using namespace cv::line_descriptor;
+
+namespace lm {
+    class TrackerTest : public BaseTest {
+        public:
+        void SetUp() override {
+            BaseTest::SetUp();
+
+            bp3_.blueprintImg = testImg3_;
+            bp3_.centroid = Point2f(56,48);
+            bp3_.name = "L section";
+            bp3_.scale = 0.05;
+        }
+
+        // Blueprint lines placed in a map at pose, in metres
+        KeyLines placeBlueprint(const string& name, const LocationMatch& pose, float mapScale) {
+            const Blueprint& blueprint = matcher.blueprints_.at(name);
+            KeyLines lines;
+            for (auto lineItr = matcher.compiledBlueprints_.at(name).lines.cbegin(); lineItr != matcher.compiledBlueprints_.at(name).lines.cend(); lineItr++) {
+                Point2f start = matcher.blueprintToImage(blueprint, pose, lineItr->getStartPoint(), mapScale) * mapScale;
+                Point2f end = matcher.blueprintToImage(blueprint, pose, lineItr->getEndPoint(), mapScale) * mapScale;
+                lines.push_back(getKeyLine(start.x, start.y, end.x, end.y));
+            }
+            return lines;
+        }
+
+        LocationMatcher matcher;
+
+        Blueprint bp3_;
+    };
+
+    TEST_F(TrackerTest, refine) {
+        ASSERT_EQ(LM_STATUS_OK, matcher.addBlueprint(bp3_));
+
+        const float mapScale = 0.1;
+        LocationMatch truePose;
+        truePose.name = bp3_.name;
+        truePose.position = Point2f(200, 150);
+        truePose.angle = 0.7;
+        truePose.certainty = 1;
+        KeyLines mapLines = placeBlueprint(bp3_.name, truePose, mapScale);
+
+        // Starting 0.2m and 0.1 radians away the pose is found again
+        LocationMatch pose = truePose;
+        pose.position += Point2f(2, -2);
+        pose.angle += 0.1;
+
+        Tracker tracker(matcher);
+        EXPECT_EQ(LM_STATUS_OK, tracker.refine(mapLines, mapScale, pose));
+        EXPECT_NEAR(truePose.position.x, pose.position.x, 0.1);
+        EXPECT_NEAR(truePose.position.y, pose.position.y, 0.1);
+        EXPECT_NEAR(0, angleDiff(truePose.angle, pose.angle), 1e-3);
+        EXPECT_NEAR(1, pose.certainty, 1e-3);
+        EXPECT_GT(0.01, tracker.residual());
+
+        // Nothing to refine against
+        LocationMatch lostPose = pose;
+        EXPECT_EQ(LM_STATUS_ERROR_MATCH_FAILED, tracker.refine(KeyLines(), mapScale, lostPose));
+        EXPECT_EQ(pose.position, lostPose.position);
+
+        // Unknown blueprint
+        lostPose.name = "unknown";
+        EXPECT_EQ(LM_STATUS_ERROR_GENERIC, tracker.refine(mapLines, mapScale, lostPose));
+    }
+
+    TEST_F(TrackerTest, track) {
+        matcher.addBlueprint(bp3_);
+
+        vector<LocationMatch> matches;
+        matcher.findMatch(testImg4_, bp3_.scale, matches);
+        ASSERT_FALSE(matches.empty());
+
+        // Tracking the same map from a slightly wrong pose stays local
+        LocationMatch pose = matches.front();
+        pose.position += Point2f(2, 2);
+        Tracker tracker(matcher);
+        EXPECT_EQ(LM_STATUS_OK, tracker.track(testImg4_, bp3_.scale, pose));
+        EXPECT_FALSE(tracker.usedGlobalSearch());
+        EXPECT_GT(3, dist(matches.front().position, pose.position));
+
+        // From a pose far away the blueprint is searched for again
+        pose.position += Point2f(1000, 1000);
+        EXPECT_EQ(LM_STATUS_OK, tracker.track(testImg4_, bp3_.scale, pose));
+        EXPECT_TRUE(tracker.usedGlobalSearch());
+        EXPECT_EQ(bp3_.name, pose.name);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}